@@ -0,0 +1,139 @@
+// User body parsing: the strstr-based parse_user_json that api.c used
+// against the validating tokenizer (json_parse plus two json_object_get
+// lookups), in MB/s, on a bare user body and on bodies that carry a
+// larger profile ahead of the fields the handler wants.
+//
+//   make bench && ./bench/json_bench [MB-per-case]
+//
+// The baseline only looks for the two keys; the tokenizer checks every
+// byte (structure, escapes, UTF-8), so it does strictly more work.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "utils/json.h"
+
+#define BENCH_TAPE 256
+
+// The api.c parser as it was
+static int old_parse_user_json(const char *json, char *name, size_t name_size, char *email,
+                               size_t email_size) {
+    name[0] = '\0';
+    email[0] = '\0';
+    const char *name_field = strstr(json, "\"name\":");
+    if (name_field) {
+        name_field += 7;
+        while (*name_field == ' ' || *name_field == '\t') name_field++;
+        if (*name_field == '"') {
+            name_field++;
+            const char *name_end = strchr(name_field, '"');
+            if (name_end) {
+                size_t name_len = name_end - name_field;
+                if (name_len < name_size) {
+                    strncpy(name, name_field, name_len);
+                    name[name_len] = '\0';
+                }
+            }
+        }
+    }
+    const char *email_field = strstr(json, "\"email\":");
+    if (email_field) {
+        email_field += 8;
+        while (*email_field == ' ' || *email_field == '\t') email_field++;
+        if (*email_field == '"') {
+            email_field++;
+            const char *email_end = strchr(email_field, '"');
+            if (email_end) {
+                size_t email_len = email_end - email_field;
+                if (email_len < email_size) {
+                    strncpy(email, email_field, email_len);
+                    email[email_len] = '\0';
+                }
+            }
+        }
+    }
+    return (name[0] != '\0' && email[0] != '\0');
+}
+
+static int new_parse_user_json(const char *json, size_t len, char *name, size_t name_size,
+                               char *email, size_t email_size) {
+    json_token_t tape[BENCH_TAPE];
+    json_doc_t doc;
+    if (json_parse(&doc, json, len, tape, BENCH_TAPE) != 0) {
+        return 0;
+    }
+    return json_get_string(&doc, json_object_get(&doc, 0, "name"), name, name_size) > 0 &&
+           json_get_string(&doc, json_object_get(&doc, 0, "email"), email, email_size) > 0;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// A user body behind a profile of about profile_bytes: prose with the odd
+// escaped quote and accented letter, and a list of tags
+static char *make_body(size_t profile_bytes) {
+    static const char sentence[] =
+        "Wrote the first published algorithm meant for a machine, and said \\\"the engine "
+        "weaves algebraic patterns\\\" \xc3\xa0 la Jacquard loom. ";
+    size_t cap = profile_bytes + 512;
+    char *body = malloc(cap);
+    size_t len = 0;
+    if (profile_bytes > 0) {
+        len += snprintf(body + len, cap - len, "{\"profile\": {\"bio\": \"");
+        while (len + sizeof(sentence) < profile_bytes) {
+            memcpy(body + len, sentence, sizeof(sentence) - 1);
+            len += sizeof(sentence) - 1;
+        }
+        len += snprintf(body + len, cap - len,
+                        "\", \"tags\": [\"math\", \"poetry\", \"engines\"], \"born\": 1815}, ");
+    } else {
+        body[len++] = '{';
+    }
+    snprintf(body + len, cap - len, "\"name\": \"Ada Lovelace\", \"email\": \"ada@example.com\"}");
+    return body;
+}
+
+static void run_case(const char *label, size_t profile_bytes, double megabytes) {
+    char *body = make_body(profile_bytes);
+    size_t len = strlen(body);
+    long iterations = (long)(megabytes * 1e6 / len) + 1;
+    char name[64], email[128];
+    long ok = 0;
+
+    double start = now_sec();
+    for (long i = 0; i < iterations; i++) {
+        ok += old_parse_user_json(body, name, sizeof(name), email, sizeof(email));
+    }
+    double old_sec = now_sec() - start;
+
+    start = now_sec();
+    for (long i = 0; i < iterations; i++) {
+        ok += new_parse_user_json(body, len, name, sizeof(name), email, sizeof(email));
+    }
+    double new_sec = now_sec() - start;
+
+    if (ok != 2 * iterations) {
+        fprintf(stderr, "%s: a parser missed the fields\n", label);
+    }
+    double total = (double)len * iterations / 1e6;
+    printf("%-8s %8zu %12.0f %12.0f %10.0f %10.0f\n", label, len, total / old_sec,
+           total / new_sec, iterations / old_sec / 1e3, iterations / new_sec / 1e3);
+    free(body);
+}
+
+int main(int argc, char **argv) {
+    double megabytes = argc > 1 ? atof(argv[1]) : 500;
+
+    printf("%-8s %8s %12s %12s %10s %10s\n", "body", "bytes", "old MB/s", "new MB/s",
+           "old k/s", "new k/s");
+    run_case("small", 0, megabytes / 10);
+    run_case("1 KB", 1024, megabytes);
+    run_case("4 KB", 4096, megabytes);
+    run_case("64 KB", 65536, megabytes);
+    run_case("1 MB", 1 << 20, megabytes);
+    return 0;
+}
@@ -0,0 +1,168 @@
+// Enqueue/dequeue throughput of the worker queue: the original mutex and
+// condition variable ring against the per-worker work-stealing deques.
+//
+//   make bench && ./bench/pool_bench [items-per-producer]
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "utils/work_queue.h"
+
+#define PRODUCERS 2
+#define QUEUE_SIZE 1024
+
+static const int thread_counts[] = {4, 16, 64};
+
+// The thread_pool_t queue as it was: one ring, one lock, one condvar
+typedef struct {
+    void **items;
+    int size;
+    int front;
+    int rear;
+    int count;
+    int shutdown;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} ring_queue_t;
+
+static int ring_push(ring_queue_t *ring, void *item) {
+    pthread_mutex_lock(&ring->mutex);
+    if (ring->count >= ring->size) {
+        pthread_mutex_unlock(&ring->mutex);
+        return -1;
+    }
+    ring->items[ring->rear] = item;
+    ring->rear = (ring->rear + 1) % ring->size;
+    ring->count++;
+    pthread_cond_signal(&ring->cond);
+    pthread_mutex_unlock(&ring->mutex);
+    return 0;
+}
+
+static void *ring_pop(ring_queue_t *ring) {
+    pthread_mutex_lock(&ring->mutex);
+    while (ring->count == 0 && !ring->shutdown) {
+        pthread_cond_wait(&ring->cond, &ring->mutex);
+    }
+    void *item = NULL;
+    if (ring->count > 0) {
+        item = ring->items[ring->front];
+        ring->front = (ring->front + 1) % ring->size;
+        ring->count--;
+    }
+    pthread_mutex_unlock(&ring->mutex);
+    return item;
+}
+
+typedef struct {
+    int use_ring;
+    ring_queue_t ring;
+    work_queue_t deques;
+    long items_per_producer;
+    _Atomic long consumed;
+    _Atomic int next_worker;
+} bench_t;
+
+static int bench_push(bench_t *bench, void *item) {
+    return bench->use_ring ? ring_push(&bench->ring, item)
+                           : work_queue_push(&bench->deques, item);
+}
+
+static void *producer(void *arg) {
+    bench_t *bench = arg;
+    for (long i = 1; i <= bench->items_per_producer; i++) {
+        // Items are never dereferenced; any non-NULL pointer will do
+        while (bench_push(bench, (void *)i) != 0) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void *consumer(void *arg) {
+    bench_t *bench = arg;
+    int worker = atomic_fetch_add(&bench->next_worker, 1);
+    for (;;) {
+        void *item = bench->use_ring ? ring_pop(&bench->ring)
+                                     : work_queue_pop(&bench->deques, worker);
+        if (!item) {
+            return NULL;
+        }
+        atomic_fetch_add_explicit(&bench->consumed, 1, memory_order_relaxed);
+    }
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(int use_ring, int workers, long items_per_producer) {
+    bench_t bench = {0};
+    bench.use_ring = use_ring;
+    bench.items_per_producer = items_per_producer;
+    if (use_ring) {
+        bench.ring.items = malloc(QUEUE_SIZE * sizeof(void *));
+        bench.ring.size = QUEUE_SIZE;
+        pthread_mutex_init(&bench.ring.mutex, NULL);
+        pthread_cond_init(&bench.ring.cond, NULL);
+    } else if (work_queue_init(&bench.deques, workers, QUEUE_SIZE / workers) != 0) {
+        perror("work_queue_init");
+        exit(1);
+    }
+
+    pthread_t consumers[64];
+    pthread_t producers[PRODUCERS];
+    for (int i = 0; i < workers; i++) {
+        pthread_create(&consumers[i], NULL, consumer, &bench);
+    }
+
+    double start = now_seconds();
+    for (int i = 0; i < PRODUCERS; i++) {
+        pthread_create(&producers[i], NULL, producer, &bench);
+    }
+    for (int i = 0; i < PRODUCERS; i++) {
+        pthread_join(producers[i], NULL);
+    }
+    long total = items_per_producer * PRODUCERS;
+    while (atomic_load(&bench.consumed) < total) {
+        sched_yield();
+    }
+    double elapsed = now_seconds() - start;
+
+    if (use_ring) {
+        pthread_mutex_lock(&bench.ring.mutex);
+        bench.ring.shutdown = 1;
+        pthread_cond_broadcast(&bench.ring.cond);
+        pthread_mutex_unlock(&bench.ring.mutex);
+    } else {
+        work_queue_shutdown(&bench.deques);
+    }
+    for (int i = 0; i < workers; i++) {
+        pthread_join(consumers[i], NULL);
+    }
+    if (use_ring) {
+        free(bench.ring.items);
+    } else {
+        work_queue_destroy(&bench.deques);
+    }
+    return total / elapsed;
+}
+
+int main(int argc, char **argv) {
+    long items = argc > 1 ? atol(argv[1]) : 500000;
+
+    printf("%d producers, %ld items each, %d queued items max\n", PRODUCERS, items, QUEUE_SIZE);
+    printf("%8s %18s %18s %8s\n", "workers", "mutex ring ops/s", "deques ops/s", "speedup");
+    for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++) {
+        int workers = thread_counts[i];
+        double ring = run(1, workers, items);
+        double deques = run(0, workers, items);
+        printf("%8d %18.0f %18.0f %7.2fx\n", workers, ring, deques, deques / ring);
+    }
+    return 0;
+}
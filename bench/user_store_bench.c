@@ -0,0 +1,319 @@
+// User store under a mixed read/write load: the original locked array
+// (linear scans, shifting deletes) against the hash-indexed slab store,
+// then the store alone at 1M users, where reads take no lock and should
+// scale with cores.
+//
+//   make bench && ./bench/user_store_bench [users] [ops-per-thread]
+//
+// Run it on a machine with several cores to see read scaling.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "utils/user_store.h"
+
+// Writes split as half updates, 30% creates, 20% deletes; the rest of
+// the operations are lookups
+#define MIXED_WRITE_PERCENT 10
+#define READ_HEAVY_WRITE_PERCENT 2
+#define LIST_BATCH 32
+// The array baseline scans linearly, so it is only run this large
+#define BASELINE_USERS 10000
+#define BASELINE_OPS 20000
+// Users per page when listing as JSON (the GET /api/users maximum)
+#define JSON_PAGE 1000
+
+static const int thread_counts[] = {1, 2, 4, 8, 16};
+
+// The api.c array as it was, without the 100-user cap
+typedef struct {
+    user_t *users;
+    int count;
+    int cap;
+    int next_id;
+    pthread_mutex_t mutex;
+} array_store_t;
+
+static array_store_t array_store = {NULL, 0, 0, 1, PTHREAD_MUTEX_INITIALIZER};
+
+static int array_create(const char *name, const char *email) {
+    pthread_mutex_lock(&array_store.mutex);
+    if (array_store.count == array_store.cap) {
+        array_store.cap = array_store.cap ? array_store.cap * 2 : 1024;
+        array_store.users = realloc(array_store.users, array_store.cap * sizeof(user_t));
+    }
+    user_t *user = &array_store.users[array_store.count++];
+    memset(user, 0, sizeof(*user));
+    user->id = array_store.next_id++;
+    strncpy(user->name, name, sizeof(user->name) - 1);
+    strncpy(user->email, email, sizeof(user->email) - 1);
+    int id = user->id;
+    pthread_mutex_unlock(&array_store.mutex);
+    return id;
+}
+
+static int array_get(int id, user_t *out) {
+    pthread_mutex_lock(&array_store.mutex);
+    for (int i = 0; i < array_store.count; i++) {
+        if (array_store.users[i].id == id) {
+            *out = array_store.users[i];
+            pthread_mutex_unlock(&array_store.mutex);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&array_store.mutex);
+    return -1;
+}
+
+static int array_update(int id, const char *name, const char *email) {
+    pthread_mutex_lock(&array_store.mutex);
+    for (int i = 0; i < array_store.count; i++) {
+        if (array_store.users[i].id == id) {
+            strncpy(array_store.users[i].name, name, sizeof(array_store.users[i].name) - 1);
+            strncpy(array_store.users[i].email, email, sizeof(array_store.users[i].email) - 1);
+            pthread_mutex_unlock(&array_store.mutex);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&array_store.mutex);
+    return -1;
+}
+
+static int array_delete(int id) {
+    pthread_mutex_lock(&array_store.mutex);
+    for (int i = 0; i < array_store.count; i++) {
+        if (array_store.users[i].id == id) {
+            memmove(&array_store.users[i], &array_store.users[i + 1],
+                    (array_store.count - i - 1) * sizeof(user_t));
+            array_store.count--;
+            pthread_mutex_unlock(&array_store.mutex);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&array_store.mutex);
+    return -1;
+}
+
+typedef struct {
+    int (*create)(const char *, const char *);
+    int (*get)(int, user_t *);
+    int (*update)(int, const char *, const char *);
+    int (*remove)(int);
+} store_ops_t;
+
+static const store_ops_t array_ops = {array_create, array_get, array_update, array_delete};
+static const store_ops_t hash_ops = {user_store_create, user_store_get, user_store_update,
+                                     user_store_delete};
+
+typedef struct {
+    const store_ops_t *ops;
+    long ops_per_thread;
+    int id_range;
+    unsigned write_percent;
+    unsigned seed;
+    long found;
+    double start;
+    double end;
+} worker_arg_t;
+
+static pthread_barrier_t start_barrier;
+
+// Emails are unique in the store, so every create and update gets a fresh one
+static unsigned long email_counter;
+
+static const char *next_email(char *buf, size_t size) {
+    snprintf(buf, size, "bench%lu@example.com",
+             __atomic_fetch_add(&email_counter, 1, __ATOMIC_RELAXED));
+    return buf;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline unsigned next_random(unsigned *state) {
+    unsigned x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static void *mixed_worker(void *p) {
+    worker_arg_t *arg = p;
+    user_t user;
+    char email[64];
+    pthread_barrier_wait(&start_barrier);
+    arg->start = now_sec();
+    for (long i = 0; i < arg->ops_per_thread; i++) {
+        unsigned r = next_random(&arg->seed);
+        int id = (int)(next_random(&arg->seed) % arg->id_range) + 1;
+        unsigned pick = r % (100 * 10);
+        unsigned writes = arg->write_percent * 10;
+        if (pick < writes / 2) {
+            arg->ops->update(id, "Updated Name", next_email(email, sizeof(email)));
+        } else if (pick < writes * 8 / 10) {
+            arg->ops->create("Bench User", next_email(email, sizeof(email)));
+        } else if (pick < writes) {
+            arg->ops->remove(id);
+        } else if (arg->ops->get(id, &user) == 0) {
+            arg->found++;
+        }
+    }
+    arg->end = now_sec();
+    return NULL;
+}
+
+static double run_mixed(const store_ops_t *ops, int threads, long ops_per_thread, int id_range,
+                        unsigned write_percent) {
+    pthread_t tids[64];
+    worker_arg_t args[64];
+    pthread_barrier_init(&start_barrier, NULL, threads + 1);
+    for (int t = 0; t < threads; t++) {
+        args[t] = (worker_arg_t){ops, ops_per_thread, id_range, write_percent,
+                                 0x9E3779B9u * (t + 1), 0, 0, 0};
+        pthread_create(&tids[t], NULL, mixed_worker, &args[t]);
+    }
+    pthread_barrier_wait(&start_barrier);
+    double start = 0, end = 0;
+    for (int t = 0; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+        if (t == 0 || args[t].start < start) start = args[t].start;
+        if (args[t].end > end) end = args[t].end;
+    }
+    pthread_barrier_destroy(&start_barrier);
+    return threads * ops_per_thread / (end - start);
+}
+
+// A response body being built: JSON pages appended end to end
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    int last_id;
+} body_t;
+
+static void body_append(body_t *body, const char *data, size_t len) {
+    if (body->len + len > body->cap) {
+        body->cap = (body->len + len) * 2;
+        body->data = realloc(body->data, body->cap);
+    }
+    memcpy(body->data + body->len, data, len);
+    body->len += len;
+}
+
+static void append_fragment(int id, const char *json, size_t len, void *ctx) {
+    body_t *body = ctx;
+    body_append(body, json, len);
+    body_append(body, ",", 1);
+    body->last_id = id;
+}
+
+// Every user as JSON a page at a time: formatted from copies as api.c did
+// (without even escaping), or joined from the JSON each record carries
+static double list_json(int cached, body_t *body) {
+    user_t *page = malloc(JSON_PAGE * sizeof(user_t));
+    char line[512];
+    body->len = 0;
+    body->last_id = 0;
+    double start = now_sec();
+    for (;;) {
+        int count;
+        if (cached) {
+            count = user_store_list_json(body->last_id, JSON_PAGE, append_fragment, body);
+        } else {
+            count = user_store_list(body->last_id, page, JSON_PAGE);
+            for (int i = 0; i < count; i++) {
+                int n = snprintf(line, sizeof(line),
+                                 "{\"id\": %d, \"name\": \"%s\", \"email\": \"%s\", \"created_at\": \"%s\"},",
+                                 page[i].id, page[i].name, page[i].email, page[i].created_at);
+                body_append(body, line, n);
+            }
+            if (count > 0) {
+                body->last_id = page[count - 1].id;
+            }
+        }
+        if (count < JSON_PAGE) {
+            break;
+        }
+    }
+    free(page);
+    return now_sec() - start;
+}
+
+static double load(const store_ops_t *ops, int users) {
+    char email[64];
+    double start = now_sec();
+    for (int i = 0; i < users; i++) {
+        ops->create("Bench User", next_email(email, sizeof(email)));
+    }
+    return now_sec() - start;
+}
+
+int main(int argc, char **argv) {
+    int users = argc > 1 ? atoi(argv[1]) : 1000000;
+    long ops = argc > 2 ? atol(argv[2]) : 1000000;
+    int nthreads = sizeof(thread_counts) / sizeof(thread_counts[0]);
+
+    if (user_store_init() != 0) {
+        fprintf(stderr, "user_store_init failed\n");
+        return 1;
+    }
+
+    // Both stores at a size the array can still manage
+    load(&array_ops, BASELINE_USERS);
+    load(&hash_ops, BASELINE_USERS);
+    printf("%d users, %d%% writes: ops/s\n%8s %14s %14s %8s\n", BASELINE_USERS,
+           MIXED_WRITE_PERCENT, "threads", "array", "hash", "speedup");
+    for (int i = 0; i < nthreads; i++) {
+        int t = thread_counts[i];
+        double array = run_mixed(&array_ops, t, BASELINE_OPS / t, BASELINE_USERS, MIXED_WRITE_PERCENT);
+        double hash = run_mixed(&hash_ops, t, BASELINE_OPS / t, BASELINE_USERS, MIXED_WRITE_PERCENT);
+        printf("%8d %14.0f %14.0f %7.1fx\n", t, array, hash, hash / array);
+    }
+
+    // The store alone at full size: each thread does the same work, so
+    // with lock-free reads ops/s should grow with the threads up to the
+    // core count
+    double loaded = load(&hash_ops, users - BASELINE_USERS);
+    printf("\nload %d users: %.2f s (%.0f creates/s)\n", users, loaded, (users - BASELINE_USERS) / loaded);
+    printf("%d users: ops/s\n%8s %14s %14s %14s\n", users, "threads", "reads only",
+           "2% writes", "10% writes");
+    for (int i = 0; i < nthreads; i++) {
+        int t = thread_counts[i];
+        double reads = run_mixed(&hash_ops, t, ops, users, 0);
+        double read_heavy = run_mixed(&hash_ops, t, ops, users, READ_HEAVY_WRITE_PERCENT);
+        double mixed = run_mixed(&hash_ops, t, ops, users, MIXED_WRITE_PERCENT);
+        printf("%8d %14.0f %14.0f %14.0f\n", t, reads, read_heavy, mixed);
+    }
+
+    // Full listing through the id cursor, as GET /api/users streams it
+    user_t batch[LIST_BATCH];
+    long listed = 0;
+    int after = 0;
+    double start = now_sec();
+    int count;
+    while ((count = user_store_list(after, batch, LIST_BATCH)) > 0) {
+        listed += count;
+        after = batch[count - 1].id;
+    }
+    printf("\nlist %ld users: %.3f s\n", listed, now_sec() - start);
+    body_t body = {NULL, 0, 0, 0};
+    double formatted = list_json(0, &body);
+    double cached = list_json(1, &body);
+    printf("as JSON, %.1f MB: formatted %.3f s, cached fragments %.3f s (%.1fx)\n",
+           body.len / (1024.0 * 1024.0), formatted, cached, formatted / cached);
+    free(body.data);
+
+    user_store_stats_t stats;
+    user_store_get_stats(&stats);
+    printf("index %zu buckets (%zu tombstones), email index %.1f MB, %zu slabs, %.1f MB\n",
+           stats.index_capacity, stats.index_tombstones,
+           stats.email_index_bytes / (1024.0 * 1024.0), stats.slabs,
+           stats.memory_bytes / (1024.0 * 1024.0));
+    return 0;
+}
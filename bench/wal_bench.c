@@ -0,0 +1,230 @@
+// User store persistence: create throughput under each WAL sync policy as
+// writers are added (with "always", concurrent writers share fdatasyncs),
+// then recovery time at 1M users from a snapshot plus WAL tail against
+// replaying the WAL alone.
+//
+//   make bench && ./bench/wal_bench [dir] [users]
+//
+// dir should be on the disk being measured; on tmpfs fdatasync is free.
+// Each case runs in its own process, since the store is process-wide.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "utils/user_store.h"
+
+// Creates per case, split across the writers; syncing every write is slow
+#define ALWAYS_CREATES 20000
+#define BUFFERED_CREATES 200000
+// Changes left in the WAL after the snapshot in the recovery case
+#define TAIL_CREATES 100000
+#define TAIL_UPDATES 50000
+
+static const int thread_counts[] = {1, 4, 16};
+static const wal_sync_t policies[] = {WAL_SYNC_ALWAYS, WAL_SYNC_INTERVAL, WAL_SYNC_NONE};
+
+static const char *data_dir;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void clear_dir(void) {
+    mkdir(data_dir, 0755);
+    DIR *d = opendir(data_dir);
+    if (!d) {
+        return;
+    }
+    struct dirent *entry;
+    char path[1024];
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        snprintf(path, sizeof(path), "%s/%s", data_dir, entry->d_name);
+        unlink(path);
+    }
+    closedir(d);
+}
+
+// Snapshots only when a case asks for one
+static int open_store(wal_sync_t sync) {
+    user_store_persist_t config = {0};
+    config.dir = data_dir;
+    config.wal.sync = sync;
+    config.wal.flush_interval_ms = WAL_FLUSH_INTERVAL_MS;
+    config.snapshot_bytes = (size_t)1 << 40;
+    config.snapshot_interval_sec = 1 << 30;
+    if (user_store_open(&config) != 0) {
+        fprintf(stderr, "user_store_open failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Run fn in a child process and wait for it
+static void run_case(void (*fn)(void *), void *arg) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        fn(arg);
+        fflush(stdout);
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+}
+
+typedef struct {
+    int creates;
+    double start;
+    double end;
+} writer_arg_t;
+
+static pthread_barrier_t start_barrier;
+
+// Emails are unique in the store, so every create and update gets a fresh one
+static unsigned long email_counter;
+
+static const char *next_email(char *buf, size_t size) {
+    snprintf(buf, size, "bench%lu@example.com",
+             __atomic_fetch_add(&email_counter, 1, __ATOMIC_RELAXED));
+    return buf;
+}
+
+static void *writer(void *p) {
+    writer_arg_t *arg = p;
+    char email[64];
+    pthread_barrier_wait(&start_barrier);
+    arg->start = now_sec();
+    for (int i = 0; i < arg->creates; i++) {
+        user_store_create("Bench User", next_email(email, sizeof(email)));
+    }
+    arg->end = now_sec();
+    return NULL;
+}
+
+typedef struct {
+    wal_sync_t sync;
+    int threads;
+} throughput_case_t;
+
+static void throughput_case(void *p) {
+    throughput_case_t *c = p;
+    clear_dir();
+    if (open_store(c->sync) != 0) {
+        return;
+    }
+    int total = c->sync == WAL_SYNC_ALWAYS ? ALWAYS_CREATES : BUFFERED_CREATES;
+    pthread_t tids[64];
+    writer_arg_t args[64];
+    pthread_barrier_init(&start_barrier, NULL, c->threads);
+    for (int t = 0; t < c->threads; t++) {
+        args[t] = (writer_arg_t){total / c->threads, 0, 0};
+        pthread_create(&tids[t], NULL, writer, &args[t]);
+    }
+    double start = 0, end = 0;
+    for (int t = 0; t < c->threads; t++) {
+        pthread_join(tids[t], NULL);
+        if (t == 0 || args[t].start < start) start = args[t].start;
+        if (args[t].end > end) end = args[t].end;
+    }
+    user_store_persist_stats_t stats;
+    user_store_get_persist_stats(&stats);
+    user_store_close();
+
+    uint64_t appends = (uint64_t)(total / c->threads) * c->threads;
+    printf("%-10s %8d %14.0f %10llu %12.1f\n", wal_sync_name(c->sync), c->threads,
+           appends / (end - start), (unsigned long long)stats.wal.syncs,
+           stats.wal.syncs ? (double)appends / stats.wal.syncs : 0.0);
+}
+
+typedef struct {
+    int users;
+    int snapshot;
+} build_case_t;
+
+// Leave users in the data directory: with a snapshot, it holds all but a
+// tail of creates and updates; without, everything is in the WAL
+static void build_case(void *p) {
+    build_case_t *c = p;
+    clear_dir();
+    if (open_store(WAL_SYNC_NONE) != 0) {
+        return;
+    }
+    char email[64];
+    int logged = c->snapshot ? c->users - TAIL_CREATES : c->users;
+    double start = now_sec();
+    for (int i = 0; i < logged; i++) {
+        user_store_create("Bench User", next_email(email, sizeof(email)));
+    }
+    double loaded = now_sec() - start;
+    if (c->snapshot) {
+        start = now_sec();
+        if (user_store_snapshot() != 0) {
+            fprintf(stderr, "snapshot failed\n");
+        }
+        double snapped = now_sec() - start;
+        for (int i = 0; i < TAIL_CREATES; i++) {
+            user_store_create("Bench User", next_email(email, sizeof(email)));
+        }
+        for (int i = 0; i < TAIL_UPDATES; i++) {
+            user_store_update(i * 7 % c->users + 1, "Updated Name",
+                              next_email(email, sizeof(email)));
+        }
+        printf("logged %d creates in %.2f s, snapshot of %d users in %.2f s\n", logged, loaded,
+               logged, snapped);
+    } else {
+        printf("logged %d creates in %.2f s\n", logged, loaded);
+    }
+    user_store_close();
+}
+
+static void recover_case(void *p) {
+    const char *label = p;
+    double start = now_sec();
+    if (open_store(WAL_SYNC_NONE) != 0) {
+        return;
+    }
+    double elapsed = now_sec() - start;
+    user_store_persist_stats_t stats;
+    user_store_get_persist_stats(&stats);
+    printf("recover %-22s %8llu users %8llu WAL records %8.3f s\n", label,
+           (unsigned long long)stats.recovered_users, (unsigned long long)stats.replayed_records,
+           elapsed);
+    user_store_close();
+}
+
+int main(int argc, char **argv) {
+    data_dir = argc > 1 ? argv[1] : "wal_bench_data";
+    int users = argc > 2 ? atoi(argv[2]) : 1000000;
+    if (users <= TAIL_CREATES) {
+        users = TAIL_CREATES * 2;
+    }
+
+    printf("creates/s by sync policy\n%-10s %8s %14s %10s %12s\n", "sync", "threads", "creates/s",
+           "syncs", "per sync");
+    for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); p++) {
+        for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++) {
+            throughput_case_t c = {policies[p], thread_counts[t]};
+            run_case(throughput_case, &c);
+        }
+    }
+
+    printf("\nrecovery at %d users\n", users);
+    build_case_t with_snapshot = {users, 1};
+    run_case(build_case, &with_snapshot);
+    run_case(recover_case, "snapshot + WAL tail");
+    build_case_t wal_only = {users, 0};
+    run_case(build_case, &wal_only);
+    run_case(recover_case, "WAL only");
+
+    clear_dir();
+    rmdir(data_dir);
+    return 0;
+}
@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include "utils/access_log.h"
+
+// Formatted output is written in batches of up to this many bytes
+#define ACCESS_LOG_WRITE_BATCH 65536
+// Room for one formatted line
+#define ACCESS_LOG_LINE_MAX (ACCESS_LOG_PATH_MAX + 192)
+
+int debug_logging = 0;
+
+// One request, copied by value so the writer never touches request memory
+typedef struct {
+    uint64_t timestamp_ns;   // wall clock
+    uint64_t bytes;
+    uint32_t latency_us;
+    uint16_t status;
+    uint16_t path_len;
+    peer_addr_t peer;
+    char method[12];
+    char path[ACCESS_LOG_PATH_MAX];
+} access_record_t;
+
+// Single-producer, single-consumer ring: the owning thread advances head,
+// the writer advances tail. Rings outlive their threads and are adopted by
+// new threads once released.
+typedef struct access_ring {
+    _Atomic uint64_t head;
+    char pad_head[64 - sizeof(uint64_t)];
+    _Atomic uint64_t tail;
+    char pad_tail[64 - sizeof(uint64_t)];
+    _Atomic uint64_t dropped;
+    _Atomic int released;
+    unsigned sample_count;   // owner only
+    struct access_ring *next;
+    access_record_t records[ACCESS_LOG_RING_SIZE];
+} access_ring_t;
+
+static int log_fd = -1;
+static int log_running = 0;
+static unsigned sample_every = 1;
+static pthread_t writer_thread;
+static _Atomic int writer_stop = 0;
+static _Atomic uint64_t written_count = 0;
+
+static _Atomic(access_ring_t *) rings = NULL;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static __thread access_ring_t *thread_ring = NULL;
+
+// Thread exit: leave the ring for the writer to drain and a later thread
+// to take over
+static void release_ring(void *arg) {
+    access_ring_t *ring = (access_ring_t *)arg;
+    atomic_store(&ring->released, 1);
+}
+
+static access_ring_t *get_thread_ring(void) {
+    if (thread_ring) {
+        return thread_ring;
+    }
+
+    pthread_mutex_lock(&rings_mutex);
+    access_ring_t *ring;
+    for (ring = atomic_load(&rings); ring; ring = ring->next) {
+        int released = 1;
+        if (atomic_compare_exchange_strong(&ring->released, &released, 0)) {
+            break;
+        }
+    }
+    if (!ring) {
+        ring = calloc(1, sizeof(access_ring_t));
+        if (ring) {
+            ring->next = atomic_load(&rings);
+            atomic_store(&rings, ring);
+        }
+    }
+    pthread_mutex_unlock(&rings_mutex);
+
+    if (ring) {
+        ring->sample_count = 0;
+        pthread_setspecific(ring_key, ring);
+        thread_ring = ring;
+    }
+    return ring;
+}
+
+void peer_addr_from(const struct sockaddr *addr, peer_addr_t *peer) {
+    memset(peer, 0, sizeof(*peer));
+    peer->family = addr->sa_family;
+    if (addr->sa_family == AF_INET) {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+        memcpy(peer->addr, &in->sin_addr, 4);
+        peer->port = ntohs(in->sin_port);
+    } else if (addr->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)addr;
+        memcpy(peer->addr, &in6->sin6_addr, 16);
+        peer->port = ntohs(in6->sin6_port);
+    }
+}
+
+static void copy_field(char *dst, size_t size, const char *src, uint16_t *len_out) {
+    size_t len = 0;
+    if (src) {
+        len = strnlen(src, size);
+        memcpy(dst, src, len);
+    }
+    if (len_out) {
+        *len_out = (uint16_t)len;
+    } else if (len < size) {
+        dst[len] = '\0';
+    }
+}
+
+// Queue a record for the writer. Never blocks: a full ring counts a drop.
+// Successful requests are sampled; errors are always kept.
+void access_log_record(const peer_addr_t *peer, const char *method, const char *path,
+                       int status, size_t bytes, uint64_t latency_ns) {
+    if (!log_running) {
+        return;
+    }
+    access_ring_t *ring = get_thread_ring();
+    if (!ring) {
+        return;
+    }
+    if (status < 400 && sample_every > 1 && ring->sample_count++ % sample_every != 0) {
+        return;
+    }
+
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= ACCESS_LOG_RING_SIZE) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    access_record_t *record = &ring->records[head % ACCESS_LOG_RING_SIZE];
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    record->timestamp_ns = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+    record->bytes = bytes;
+    record->latency_us = latency_ns / 1000 > UINT32_MAX ? UINT32_MAX : (uint32_t)(latency_ns / 1000);
+    record->status = (uint16_t)status;
+    if (peer) {
+        record->peer = *peer;
+    } else {
+        memset(&record->peer, 0, sizeof(record->peer));
+    }
+    copy_field(record->method, sizeof(record->method), method ? method : "-", NULL);
+    copy_field(record->path, sizeof(record->path), path ? path : "-", &record->path_len);
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// One logfmt line per request
+static size_t format_record(const access_record_t *record, char *out) {
+    time_t seconds = (time_t)(record->timestamp_ns / 1000000000ULL);
+    unsigned millis = (unsigned)(record->timestamp_ns / 1000000ULL % 1000);
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+
+    char peer[INET6_ADDRSTRLEN] = "-";
+    if (record->peer.family == AF_INET || record->peer.family == AF_INET6) {
+        inet_ntop(record->peer.family, record->peer.addr, peer, sizeof(peer));
+    }
+
+    int len = snprintf(out, ACCESS_LOG_LINE_MAX,
+                       "time=%04d-%02d-%02dT%02d:%02d:%02d.%03uZ peer=%s:%u method=%.*s "
+                       "path=%.*s status=%u bytes=%llu latency_us=%u\n",
+                       tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+                       tm.tm_hour, tm.tm_min, tm.tm_sec, millis,
+                       peer, record->peer.port,
+                       (int)strnlen(record->method, sizeof(record->method)), record->method,
+                       (int)record->path_len, record->path,
+                       record->status, (unsigned long long)record->bytes, record->latency_us);
+    if (len < 0) return 0;
+    return (size_t)len < ACCESS_LOG_LINE_MAX ? (size_t)len : ACCESS_LOG_LINE_MAX - 1;
+}
+
+static void write_all(const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(log_fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+// Format everything queued on every ring, writing in large batches.
+// Returns the number of records written.
+static uint64_t drain_rings(char *batch, uint64_t *dropped_total) {
+    size_t used = 0;
+    uint64_t drained = 0;
+    uint64_t dropped = 0;
+
+    for (access_ring_t *ring = atomic_load(&rings); ring; ring = ring->next) {
+        uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        for (; tail != head; tail++) {
+            if (ACCESS_LOG_WRITE_BATCH - used < ACCESS_LOG_LINE_MAX) {
+                write_all(batch, used);
+                used = 0;
+            }
+            used += format_record(&ring->records[tail % ACCESS_LOG_RING_SIZE], batch + used);
+            drained++;
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+        dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    }
+
+    // Report new drops in the log itself so gaps are visible
+    if (dropped != *dropped_total) {
+        used += snprintf(batch + used, ACCESS_LOG_WRITE_BATCH - used,
+                         "access_log dropped=%llu total_dropped=%llu\n",
+                         (unsigned long long)(dropped - *dropped_total),
+                         (unsigned long long)dropped);
+        *dropped_total = dropped;
+    }
+    if (used > 0) {
+        write_all(batch, used);
+    }
+    atomic_fetch_add_explicit(&written_count, drained, memory_order_relaxed);
+    return drained;
+}
+
+static void *access_log_writer(void *arg) {
+    (void)arg;
+    char *batch = malloc(ACCESS_LOG_WRITE_BATCH);
+    if (!batch) {
+        return NULL;
+    }
+    uint64_t dropped_total = 0;
+    struct timespec idle = {0, ACCESS_LOG_IDLE_MS * 1000000L};
+
+    while (!atomic_load(&writer_stop)) {
+        if (drain_rings(batch, &dropped_total) == 0) {
+            nanosleep(&idle, NULL);
+        }
+    }
+    drain_rings(batch, &dropped_total);
+    free(batch);
+    return NULL;
+}
+
+int access_log_start(const access_log_config_t *config) {
+    if (config->path && strcmp(config->path, "-") != 0) {
+        log_fd = open(config->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (log_fd < 0) {
+            perror("Failed to open access log");
+            return -1;
+        }
+    } else {
+        log_fd = STDOUT_FILENO;
+    }
+    sample_every = config->sample_every ? config->sample_every : 1;
+
+    if (pthread_key_create(&ring_key, release_ring) != 0 ||
+        pthread_create(&writer_thread, NULL, access_log_writer, NULL) != 0) {
+        perror("Failed to start access log");
+        return -1;
+    }
+    log_running = 1;
+    return 0;
+}
+
+// Write out whatever is queued and stop the writer
+void access_log_stop(void) {
+    if (!log_running) {
+        return;
+    }
+    log_running = 0;
+    atomic_store(&writer_stop, 1);
+    pthread_join(writer_thread, NULL);
+}
+
+int access_log_enabled(void) {
+    return log_running;
+}
+
+void access_log_get_stats(access_log_stats_t *stats) {
+    uint64_t dropped = 0;
+    for (access_ring_t *ring = atomic_load(&rings); ring; ring = ring->next) {
+        dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    }
+    stats->written = atomic_load(&written_count);
+    stats->dropped = dropped;
+    stats->sample_every = sample_every;
+}
@@ -1,10 +1,18 @@
 #include "utils/http.h"
 #include "utils/parse_req.h"
+#include "utils/client.h"
+#include "utils/rate_limit.h"
+#include "utils/access_log.h"
+#include "utils/metrics.h"
+#include "utils/trace.h"
+#include "utils/user_store.h"
+#include "utils/json.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <pthread.h>
+#include <arpa/inet.h>
 
 #ifdef USE_SSL
 #include "utils/ssl.h"
@@ -13,451 +21,933 @@
 // Forward declaration
 void init_metrics(void);
 
-// Simple in-memory database for users
-typedef struct {
-    int id;
-    char name[64];
-    char email[128];
-    char created_at[32];
-} user_t;
+// GET /api/users pages: ?limit= defaults to and is capped at these
+#define USER_PAGE_DEFAULT 100
+#define USER_PAGE_MAX 1000
+// Users read from the store per flush when streaming the whole list
+#define USER_STREAM_BATCH 256
+// Query parameters looked at per request; the rest are ignored
+#define MAX_QUERY_PARAMS 16
+// Answer to a write the log could not make durable; it may be visible
+// until the next restart
+#define USER_NOT_SAVED "{\"error\": \"Change could not be saved\"}\n"
+// Answer to a create or update sent without a body
+#define BODY_REQUIRED "{\"error\": \"A JSON body is required\"}\n"
 
-#define MAX_USERS 100
-static user_t users[MAX_USERS];
-static int user_count = 0;
-static pthread_mutex_t users_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Fields ?fields= can select, in output order
+#define USER_FIELD_ID 0x1
+#define USER_FIELD_NAME 0x2
+#define USER_FIELD_EMAIL 0x4
+#define USER_FIELD_CREATED_AT 0x8
+#define USER_FIELDS_ALL 0xF
 
-// Server metrics
+// Server metrics; request counters are kept per thread in metrics.c
 typedef struct {
-    int total_requests;
-    int successful_requests;
-    int error_requests;
     time_t start_time;
-    pthread_mutex_t mutex;
 } server_metrics_t;
 
-static server_metrics_t metrics = {0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER};
+static server_metrics_t metrics = {0};
 
 // Initialize metrics
 void init_metrics() {
     metrics.start_time = time(NULL);
 }
 
-// Update metrics
-void update_metrics(int success) {
-    pthread_mutex_lock(&metrics.mutex);
-    metrics.total_requests++;
-    if (success) {
-        metrics.successful_requests++;
-    } else {
-        metrics.error_requests++;
-    }
-    pthread_mutex_unlock(&metrics.mutex);
+// JSON helper functions
+static const char cors_headers[] =
+    "Access-Control-Allow-Origin: *\r\n"
+    "Access-Control-Allow-Methods: GET, POST, PUT, DELETE, OPTIONS\r\n"
+    "Access-Control-Allow-Headers: Content-Type\r\n";
+
+// Start a JSON response with the CORS headers; append the body, then send
+// it with finish_json_response
+static void begin_json_response(http_response_t *resp, const char *status) {
+    response_init(resp, status);
+    add_response_header(resp, "Content-Type", CONTENT_TYPE_JSON);
+    response_add_headers(resp, cors_headers, sizeof(cors_headers) - 1);
+}
+
+static void finish_json_response(int client_fd, void *ssl, http_response_t *resp) {
+    send_full_response(client_fd, ssl, resp);
+    response_free(resp);
 }
 
-// JSON helper functions
 void send_json_response(int client_fd, void *ssl, const char *status, const char *json_data) {
-    char response[8192];
-    snprintf(response, sizeof(response),
-             "%s\r\n"
-             "Content-Type: %s\r\n"
-             "Content-Length: %zu\r\n"
-             "Access-Control-Allow-Origin: *\r\n"
-             "Access-Control-Allow-Methods: GET, POST, PUT, DELETE, OPTIONS\r\n"
-             "Access-Control-Allow-Headers: Content-Type\r\n"
-             "\r\n"
-             "%s",
-             status, CONTENT_TYPE_JSON, strlen(json_data), json_data);
-    
-#ifdef USE_SSL
-    if (ssl) {
-        ssl_write((SSL*)ssl, response, strlen(response));
-    } else {
-        write(client_fd, response, strlen(response));
-    }
-#else
-    write(client_fd, response, strlen(response));
-#endif
+    http_response_t resp;
+    begin_json_response(&resp, status);
+    response_append_ref(&resp, json_data, strlen(json_data));
+    finish_json_response(client_fd, ssl, &resp);
 }
 
 void send_json_response_plain(int client_fd, const char *status, const char *json_data) {
-    char response[8192];
-    snprintf(response, sizeof(response),
-             "%s\r\n"
-             "Content-Type: %s\r\n"
-             "Content-Length: %zu\r\n"
-             "Access-Control-Allow-Origin: *\r\n"
-             "Access-Control-Allow-Methods: GET, POST, PUT, DELETE, OPTIONS\r\n"
-             "Access-Control-Allow-Headers: Content-Type\r\n"
-             "\r\n"
-             "%s",
-             status, CONTENT_TYPE_JSON, strlen(json_data), json_data);
-    
-    write(client_fd, response, strlen(response));
+    send_json_response(client_fd, NULL, status, json_data);
 }
 
-void send_cors_headers(int client_fd) {
-    const char *cors_headers = 
-        "HTTP/1.1 200 OK\r\n"
-        "Access-Control-Allow-Origin: *\r\n"
-        "Access-Control-Allow-Methods: GET, POST, PUT, DELETE, OPTIONS\r\n"
-        "Access-Control-Allow-Headers: Content-Type\r\n"
-        "Content-Length: 0\r\n"
-        "\r\n";
-    
-    write(client_fd, cors_headers, strlen(cors_headers));
+void send_cors_headers(int client_fd, void *ssl) {
+    http_response_t resp;
+    response_init(&resp, HTTP_STATUS_200);
+    response_add_headers(&resp, cors_headers, sizeof(cors_headers) - 1);
+    send_full_response(client_fd, ssl, &resp);
+    response_free(&resp);
 }
 
 // Health check endpoint
 int handle_api_health(int client_fd, void *ssl) {
     time_t uptime = time(NULL) - metrics.start_time;
+    char started[32];
+    ctime_r(&metrics.start_time, started);
     
-    char json_response[512];
-    snprintf(json_response, sizeof(json_response),
-             "{\"status\": \"healthy\", \"uptime\": %ld, \"timestamp\": \"%s\"}\n",
-             uptime, ctime(&metrics.start_time));
+    http_response_t resp;
+    begin_json_response(&resp, HTTP_STATUS_200);
+    response_appendf(&resp, "{\"status\": \"healthy\", \"uptime\": %ld, \"timestamp\": \"%s\"}\n",
+                     uptime, started);
+    finish_json_response(client_fd, ssl, &resp);
+    return 0;
+}
+
+// Everything /metrics reports, gathered once per read
+typedef struct {
+    metrics_totals_t totals;
+    uint64_t total;
+    uint64_t success;
+    uint64_t errors;
+    time_t uptime;
+    uint64_t active_connections;
+    size_t queue_depth;
+    int has_pool;
+    thread_pool_stats_t pool;
+    user_store_stats_t users;
+    user_store_persist_stats_t persist;
+} metrics_snapshot_t;
+
+static const char *status_class_names[STATUS_CLASS_COUNT] = {"1xx", "2xx", "3xx", "4xx", "5xx"};
+static const double reported_quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+static void take_metrics_snapshot(metrics_snapshot_t *snap) {
+    memset(snap, 0, sizeof(*snap));
+    metrics_get_totals(&snap->totals);
+    for (int r = 0; r < ROUTE_COUNT; r++) {
+        for (int c = 0; c < STATUS_CLASS_COUNT; c++) {
+            uint64_t n = snap->totals.requests[r][c];
+            snap->total += n;
+            if (c < 3) {
+                snap->success += n;
+            } else {
+                snap->errors += n;
+            }
+        }
+    }
+    snap->uptime = time(NULL) - metrics.start_time;
+    user_store_get_stats(&snap->users);
+    user_store_get_persist_stats(&snap->persist);
+    // Connections close on workers and reactors alike, so the sums may
+    // briefly disagree
+    if (snap->totals.connections_opened > snap->totals.connections_closed) {
+        snap->active_connections = snap->totals.connections_opened - snap->totals.connections_closed;
+    }
+    if (global_pool) {
+        snap->has_pool = 1;
+        get_thread_pool_stats(global_pool, &snap->pool);
+        snap->queue_depth = work_queue_depth(&global_pool->queue);
+    }
+}
+
+// Prometheus scrapers ask for text/plain (or OpenMetrics); browsers and
+// scripts get JSON unless they pass ?format=prometheus
+static int wants_prometheus(const http_request_t *req) {
+    if (!req) return 0;
+    query_param_t params[MAX_QUERY_PARAMS];
+    int count = parse_query_string(req->query_string, req->query_len, params, MAX_QUERY_PARAMS);
+    const query_param_t *format = find_query_param(params, count, "format");
+    char value[16];
+    if (format && query_decode(format->value, format->value_len, value, sizeof(value)) >= 0 &&
+        strcmp(value, "prometheus") == 0) {
+        return 1;
+    }
+    const char *accept = find_request_header(req, "Accept");
+    return accept && (strstr(accept, "text/plain") || strstr(accept, "application/openmetrics-text"));
+}
+
+static void append_metrics_json(http_response_t *resp, const metrics_snapshot_t *snap) {
+    response_appendf(resp,
+                     "{\"total_requests\": %llu, \"successful_requests\": %llu, "
+                     "\"error_requests\": %llu, \"uptime_seconds\": %ld, "
+                     "\"success_rate\": %.2f, \"bytes_in\": %llu, \"bytes_out\": %llu, "
+                     "\"active_connections\": %llu, \"queue_depth\": %zu",
+                     (unsigned long long)snap->total, (unsigned long long)snap->success,
+                     (unsigned long long)snap->errors, snap->uptime,
+                     snap->total > 0 ? (float)snap->success / snap->total * 100 : 0.0,
+                     (unsigned long long)snap->totals.bytes_in,
+                     (unsigned long long)snap->totals.bytes_out,
+                     (unsigned long long)snap->active_connections, snap->queue_depth);
+
+    // Per route and status class: count and latency percentiles
+    latency_histogram_t hist;
+    response_append(resp, ", \"routes\": {", 13);
+    for (int r = 0; r < ROUTE_COUNT; r++) {
+        response_appendf(resp, "%s\"%s\": {", r > 0 ? ", " : "", metrics_route_name(r));
+        int first = 1;
+        for (int c = 0; c < STATUS_CLASS_COUNT; c++) {
+            if (snap->totals.requests[r][c] == 0) continue;
+            metrics_get_histogram(r, c, &hist);
+            response_appendf(resp,
+                             "%s\"%s\": {\"requests\": %llu, \"p50_us\": %llu, "
+                             "\"p90_us\": %llu, \"p99_us\": %llu, \"p999_us\": %llu}",
+                             first ? "" : ", ", status_class_names[c],
+                             (unsigned long long)snap->totals.requests[r][c],
+                             (unsigned long long)metrics_percentile(&hist, 0.5),
+                             (unsigned long long)metrics_percentile(&hist, 0.9),
+                             (unsigned long long)metrics_percentile(&hist, 0.99),
+                             (unsigned long long)metrics_percentile(&hist, 0.999));
+            first = 0;
+        }
+        response_append(resp, "}", 1);
+    }
+    response_append(resp, "}", 1);
     
-#ifdef USE_SSL
-    if (ssl) {
-        send_json_response(client_fd, ssl, HTTP_STATUS_200, json_response);
-    } else {
-        send_json_response_plain(client_fd, HTTP_STATUS_200, json_response);
+    // Where request time goes, phase by phase
+    response_append(resp, ", \"phases\": {", 13);
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        metrics_get_phase_histogram(p, &hist);
+        response_appendf(resp,
+                         "%s\"%s\": {\"count\": %llu, \"p50_us\": %llu, \"p99_us\": %llu, "
+                         "\"p999_us\": %llu}",
+                         p > 0 ? ", " : "", trace_phase_name(p), (unsigned long long)hist.count,
+                         (unsigned long long)metrics_percentile(&hist, 0.5),
+                         (unsigned long long)metrics_percentile(&hist, 0.99),
+                         (unsigned long long)metrics_percentile(&hist, 0.999));
+    }
+    response_append(resp, "}", 1);
+    
+    // Current pool sizing and load-shedding state
+    if (snap->has_pool) {
+        const thread_pool_stats_t *pool = &snap->pool;
+        response_appendf(resp,
+                         ", \"pool\": {\"threads\": %d, \"min_threads\": %d, "
+                         "\"max_threads\": %d, \"utilization_percent\": %d, "
+                         "\"queue_wait_us\": %llu, \"decision\": \"%s\", "
+                         "\"grown\": %llu, \"shrunk\": %llu, \"shedding\": %s, "
+                         "\"shed_queue_delay\": %llu, \"shed_queue_full\": %llu}",
+                         pool->threads, pool->min_threads, pool->max_threads,
+                         pool->utilization, (unsigned long long)pool->queue_wait_us,
+                         pool->decision, (unsigned long long)pool->grown,
+                         (unsigned long long)pool->shrunk, pool->shedding ? "true" : "false",
+                         (unsigned long long)pool->shed_codel,
+                         (unsigned long long)pool->shed_full);
+    }
+    response_appendf(resp,
+                     ", \"users\": {\"count\": %zu, \"index_capacity\": %zu, "
+                     "\"index_tombstones\": %zu, \"email_index_capacity\": %zu, "
+                     "\"email_index_tombstones\": %zu, \"email_index_bytes\": %zu, "
+                     "\"slot_tombstones\": %zu, \"slabs\": %zu, "
+                     "\"retired\": %zu, \"memory_bytes\": %zu}",
+                     snap->users.users, snap->users.index_capacity, snap->users.index_tombstones,
+                     snap->users.email_index_capacity, snap->users.email_index_tombstones,
+                     snap->users.email_index_bytes, snap->users.slot_tombstones,
+                     snap->users.slabs, snap->users.retired, snap->users.memory_bytes);
+    if (snap->persist.enabled) {
+        const user_store_persist_stats_t *persist = &snap->persist;
+        response_appendf(resp,
+                         ", \"persistence\": {\"sync\": \"%s\", \"wal_segment\": %llu, "
+                         "\"wal_segment_bytes\": %llu, \"wal_appends\": %llu, \"wal_bytes\": %llu, "
+                         "\"wal_flushes\": %llu, \"wal_syncs\": %llu, \"wal_failed\": %s, "
+                         "\"snapshots\": %llu, \"snapshot_failures\": %llu, "
+                         "\"last_snapshot_users\": %llu, \"last_snapshot_ms\": %llu, "
+                         "\"recovered_users\": %llu, \"replayed_records\": %llu, "
+                         "\"recovery_ms\": %llu}",
+                         wal_sync_name(persist->sync), (unsigned long long)persist->wal.segment,
+                         (unsigned long long)persist->wal.segment_bytes,
+                         (unsigned long long)persist->wal.appends,
+                         (unsigned long long)persist->wal.bytes,
+                         (unsigned long long)persist->wal.flushes,
+                         (unsigned long long)persist->wal.syncs,
+                         persist->wal.failed ? "true" : "false",
+                         (unsigned long long)persist->snapshots,
+                         (unsigned long long)persist->snapshot_failures,
+                         (unsigned long long)persist->snapshot_users,
+                         (unsigned long long)persist->snapshot_ms,
+                         (unsigned long long)persist->recovered_users,
+                         (unsigned long long)persist->replayed_records,
+                         (unsigned long long)persist->recovery_ms);
+    }
+    if (access_log_enabled()) {
+        access_log_stats_t log;
+        access_log_get_stats(&log);
+        response_appendf(resp,
+                         ", \"access_log\": {\"written\": %llu, \"dropped\": %llu, "
+                         "\"sample_every\": %u}",
+                         (unsigned long long)log.written, (unsigned long long)log.dropped,
+                         log.sample_every);
+    }
+    if (rate_limit_enabled()) {
+        rate_limit_stats_t limiter;
+        rate_limit_get_stats(&limiter);
+        response_appendf(resp,
+                         ", \"rate_limit\": {\"limited\": %llu, \"evicted\": %llu, "
+                         "\"entries\": %u}",
+                         (unsigned long long)limiter.limited,
+                         (unsigned long long)limiter.evicted, limiter.entries);
+    }
+    response_append(resp, "}\n", 2);
+}
+
+// Prometheus text exposition format 0.0.4
+static void append_metric_header(http_response_t *resp, const char *name, const char *type,
+                                 const char *help) {
+    response_appendf(resp, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void append_metrics_prometheus(http_response_t *resp, const metrics_snapshot_t *snap) {
+    append_metric_header(resp, "http_requests_total", "counter",
+                         "Requests answered, by route and status class.");
+    for (int r = 0; r < ROUTE_COUNT; r++) {
+        for (int c = 0; c < STATUS_CLASS_COUNT; c++) {
+            if (snap->totals.requests[r][c] == 0) continue;
+            response_appendf(resp, "http_requests_total{route=\"%s\",status=\"%s\"} %llu\n",
+                             metrics_route_name(r), status_class_names[c],
+                             (unsigned long long)snap->totals.requests[r][c]);
+        }
+    }
+
+    latency_histogram_t hist;
+    append_metric_header(resp, "http_request_duration_seconds", "summary",
+                         "Time from hand-off to response written.");
+    for (int r = 0; r < ROUTE_COUNT; r++) {
+        for (int c = 0; c < STATUS_CLASS_COUNT; c++) {
+            if (snap->totals.requests[r][c] == 0) continue;
+            metrics_get_histogram(r, c, &hist);
+            const char *route = metrics_route_name(r);
+            for (size_t q = 0; q < sizeof(reported_quantiles) / sizeof(reported_quantiles[0]); q++) {
+                response_appendf(resp,
+                                 "http_request_duration_seconds{route=\"%s\",status=\"%s\",quantile=\"%g\"} %.6f\n",
+                                 route, status_class_names[c], reported_quantiles[q],
+                                 metrics_percentile(&hist, reported_quantiles[q]) / 1e6);
+            }
+            response_appendf(resp,
+                             "http_request_duration_seconds_sum{route=\"%s\",status=\"%s\"} %.6f\n"
+                             "http_request_duration_seconds_count{route=\"%s\",status=\"%s\"} %llu\n",
+                             route, status_class_names[c], hist.sum_us / 1e6,
+                             route, status_class_names[c], (unsigned long long)hist.count);
+        }
+    }
+
+    append_metric_header(resp, "http_request_phase_seconds", "summary",
+                         "Time spent in each phase of a request.");
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        metrics_get_phase_histogram(p, &hist);
+        if (hist.count == 0) continue;
+        const char *phase = trace_phase_name(p);
+        for (size_t q = 0; q < sizeof(reported_quantiles) / sizeof(reported_quantiles[0]); q++) {
+            response_appendf(resp, "http_request_phase_seconds{phase=\"%s\",quantile=\"%g\"} %.6f\n",
+                             phase, reported_quantiles[q],
+                             metrics_percentile(&hist, reported_quantiles[q]) / 1e6);
+        }
+        response_appendf(resp,
+                         "http_request_phase_seconds_sum{phase=\"%s\"} %.6f\n"
+                         "http_request_phase_seconds_count{phase=\"%s\"} %llu\n",
+                         phase, hist.sum_us / 1e6, phase, (unsigned long long)hist.count);
+    }
+
+    append_metric_header(resp, "http_request_bytes_total", "counter", "Request bytes received.");
+    response_appendf(resp, "http_request_bytes_total %llu\n", (unsigned long long)snap->totals.bytes_in);
+    append_metric_header(resp, "http_response_bytes_total", "counter", "Response bytes sent.");
+    response_appendf(resp, "http_response_bytes_total %llu\n", (unsigned long long)snap->totals.bytes_out);
+    append_metric_header(resp, "http_connections_active", "gauge", "Open client connections.");
+    response_appendf(resp, "http_connections_active %llu\n", (unsigned long long)snap->active_connections);
+    append_metric_header(resp, "http_queue_depth", "gauge", "Requests waiting for a worker.");
+    response_appendf(resp, "http_queue_depth %zu\n", snap->queue_depth);
+    append_metric_header(resp, "user_store_users", "gauge", "Users in the store.");
+    response_appendf(resp, "user_store_users %zu\n", snap->users.users);
+    append_metric_header(resp, "user_store_memory_bytes", "gauge",
+                         "Memory held by the user indexes, slots and slabs.");
+    response_appendf(resp, "user_store_memory_bytes %zu\n", snap->users.memory_bytes);
+    append_metric_header(resp, "user_store_email_index_bytes", "gauge",
+                         "Memory held by the unique email index.");
+    response_appendf(resp, "user_store_email_index_bytes %zu\n", snap->users.email_index_bytes);
+    if (snap->persist.enabled) {
+        const user_store_persist_stats_t *persist = &snap->persist;
+        append_metric_header(resp, "user_store_wal_appends_total", "counter", "Changes logged.");
+        response_appendf(resp, "user_store_wal_appends_total %llu\n", (unsigned long long)persist->wal.appends);
+        append_metric_header(resp, "user_store_wal_bytes_total", "counter", "Bytes written to the WAL.");
+        response_appendf(resp, "user_store_wal_bytes_total %llu\n", (unsigned long long)persist->wal.bytes);
+        append_metric_header(resp, "user_store_wal_syncs_total", "counter",
+                             "WAL fdatasync calls, each covering a batch of changes.");
+        response_appendf(resp, "user_store_wal_syncs_total %llu\n", (unsigned long long)persist->wal.syncs);
+        append_metric_header(resp, "user_store_wal_segment_bytes", "gauge",
+                             "Size of the WAL segment being appended to.");
+        response_appendf(resp, "user_store_wal_segment_bytes %llu\n",
+                         (unsigned long long)persist->wal.segment_bytes);
+        append_metric_header(resp, "user_store_snapshots_total", "counter", "Snapshots written.");
+        response_appendf(resp, "user_store_snapshots_total %llu\n", (unsigned long long)persist->snapshots);
+    }
+    append_metric_header(resp, "process_uptime_seconds", "gauge", "Seconds since the server started.");
+    response_appendf(resp, "process_uptime_seconds %ld\n", snap->uptime);
+
+    if (snap->has_pool) {
+        const thread_pool_stats_t *pool = &snap->pool;
+        append_metric_header(resp, "http_pool_threads", "gauge", "Active worker threads.");
+        response_appendf(resp, "http_pool_threads %d\n", pool->threads);
+        append_metric_header(resp, "http_pool_utilization_ratio", "gauge",
+                             "Busy share of the workers over the last interval.");
+        response_appendf(resp, "http_pool_utilization_ratio %.2f\n", pool->utilization / 100.0);
+        append_metric_header(resp, "http_pool_queue_wait_seconds", "gauge",
+                             "Mean queue wait over the last interval.");
+        response_appendf(resp, "http_pool_queue_wait_seconds %.6f\n", pool->queue_wait_us / 1e6);
+        append_metric_header(resp, "http_shed_total", "counter", "Requests refused with 503.");
+        response_appendf(resp, "http_shed_total{reason=\"queue_delay\"} %llu\n"
+                               "http_shed_total{reason=\"queue_full\"} %llu\n",
+                         (unsigned long long)pool->shed_codel, (unsigned long long)pool->shed_full);
+    }
+    if (access_log_enabled()) {
+        access_log_stats_t log;
+        access_log_get_stats(&log);
+        append_metric_header(resp, "http_access_log_lines_total", "counter", "Access log lines written.");
+        response_appendf(resp, "http_access_log_lines_total %llu\n", (unsigned long long)log.written);
+        append_metric_header(resp, "http_access_log_dropped_total", "counter",
+                             "Access log records dropped on full rings.");
+        response_appendf(resp, "http_access_log_dropped_total %llu\n", (unsigned long long)log.dropped);
+    }
+    if (rate_limit_enabled()) {
+        rate_limit_stats_t limiter;
+        rate_limit_get_stats(&limiter);
+        append_metric_header(resp, "http_rate_limited_total", "counter", "Requests refused with 429.");
+        response_appendf(resp, "http_rate_limited_total %llu\n", (unsigned long long)limiter.limited);
+        append_metric_header(resp, "http_rate_limit_evictions_total", "counter",
+                             "Rate limit buckets recycled.");
+        response_appendf(resp, "http_rate_limit_evictions_total %llu\n", (unsigned long long)limiter.evicted);
     }
-#else
-    send_json_response_plain(client_fd, HTTP_STATUS_200, json_response);
-#endif
-    update_metrics(1);
-    return 0;
 }
 
 // Metrics endpoint
-int handle_api_metrics(int client_fd, void *ssl) {
-    pthread_mutex_lock(&metrics.mutex);
-    int total = metrics.total_requests;
-    int success = metrics.successful_requests;
-    int errors = metrics.error_requests;
-    time_t uptime = time(NULL) - metrics.start_time;
-    pthread_mutex_unlock(&metrics.mutex);
-    
-    char json_response[1024];
-    snprintf(json_response, sizeof(json_response),
-             "{\"total_requests\": %d, \"successful_requests\": %d, "
-             "\"error_requests\": %d, \"uptime_seconds\": %ld, "
-             "\"success_rate\": %.2f}\n",
-             total, success, errors, uptime,
-             total > 0 ? (float)success / total * 100 : 0.0);
+int handle_api_metrics(int client_fd, void *ssl, const http_request_t *req) {
+    metrics_snapshot_t snap;
+    take_metrics_snapshot(&snap);
     
-#ifdef USE_SSL
-    if (ssl) {
-        send_json_response(client_fd, ssl, HTTP_STATUS_200, json_response);
+    http_response_t resp;
+    if (wants_prometheus(req)) {
+        response_init(&resp, HTTP_STATUS_200);
+        add_response_header(&resp, "Content-Type", "text/plain; version=0.0.4");
+        append_metrics_prometheus(&resp, &snap);
     } else {
-        send_json_response_plain(client_fd, HTTP_STATUS_200, json_response);
+        begin_json_response(&resp, HTTP_STATUS_200);
+        append_metrics_json(&resp, &snap);
     }
-#else
-    send_json_response_plain(client_fd, HTTP_STATUS_200, json_response);
-#endif
-    update_metrics(1);
+    finish_json_response(client_fd, ssl, &resp);
     return 0;
 }
 
-// User management functions
-int create_user(const char *name, const char *email) {
-    pthread_mutex_lock(&users_mutex);
-    
-    if (user_count >= MAX_USERS) {
-        pthread_mutex_unlock(&users_mutex);
+// Bytes escaped per pass of append_json_string
+#define JSON_ESCAPE_BLOCK 256
+
+// Request paths and user fields go out as JSON strings, escaped a block
+// at a time through the stack
+static void append_json_string(http_response_t *resp, const char *str, size_t len) {
+    char escaped[JSON_ESCAPED_MAX(JSON_ESCAPE_BLOCK)];
+    response_append(resp, "\"", 1);
+    for (size_t done = 0; done < len; done += JSON_ESCAPE_BLOCK) {
+        size_t block = len - done < JSON_ESCAPE_BLOCK ? len - done : JSON_ESCAPE_BLOCK;
+        response_append(resp, escaped, json_escape(str + done, block, escaped));
+    }
+    response_append(resp, "\"", 1);
+}
+
+// A decimal query value within [min, max]; -1 if it is anything else
+static int query_int(const query_param_t *param, long min, long max, int *out) {
+    char value[24];
+    if (query_decode(param->value, param->value_len, value, sizeof(value)) <= 0) {
         return -1;
     }
+    char *end;
+    long n = strtol(value, &end, 10);
+    if (*end != '\0' || value[0] == '+' || value[0] == '-' || n < min || n > max) {
+        return -1;
+    }
+    *out = (int)n;
+    return 0;
+}
+
+// Slowest recent requests with their phase breakdown; ?limit=N
+int handle_api_debug_slow(int client_fd, void *ssl, const http_request_t *req) {
+    slow_request_t slow[2 * SLOW_REQUEST_SLOTS];
+    int limit = 10;
+    query_param_t params[MAX_QUERY_PARAMS];
+    int param_count = parse_query_string(req->query_string, req->query_len, params, MAX_QUERY_PARAMS);
+    const query_param_t *param = find_query_param(params, param_count, "limit");
+    if (param && query_int(param, 1, 2 * SLOW_REQUEST_SLOTS, &limit) != 0) {
+        limit = 2 * SLOW_REQUEST_SLOTS;
+    }
+    int count = trace_get_slow_requests(slow, limit);
     
-    user_t *user = &users[user_count];
-    user->id = user_count + 1;
-    strncpy(user->name, name, sizeof(user->name) - 1);
-    strncpy(user->email, email, sizeof(user->email) - 1);
-    
-    time_t now = time(NULL);
-    strftime(user->created_at, sizeof(user->created_at), "%Y-%m-%d %H:%M:%S", localtime(&now));
-    
-    user_count++;
-    pthread_mutex_unlock(&users_mutex);
-    return user->id;
+    http_response_t resp;
+    begin_json_response(&resp, HTTP_STATUS_200);
+    response_appendf(&resp, "{\"window_seconds\": %d, \"requests\": [", SLOW_WINDOW_SEC);
+    for (int i = 0; i < count; i++) {
+        const slow_request_t *r = &slow[i];
+        time_t seconds = (time_t)(r->timestamp_ns / 1000000000ULL);
+        struct tm tm;
+        gmtime_r(&seconds, &tm);
+        char peer[INET6_ADDRSTRLEN] = "-";
+        if (r->peer.family == AF_INET || r->peer.family == AF_INET6) {
+            inet_ntop(r->peer.family, r->peer.addr, peer, sizeof(peer));
+        }
+        
+        response_appendf(&resp,
+                         "%s{\"time\": \"%04d-%02d-%02dT%02d:%02d:%02dZ\", \"peer\": \"%s:%u\", "
+                         "\"method\": ",
+                         i > 0 ? ", " : "", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+                         tm.tm_hour, tm.tm_min, tm.tm_sec, peer, r->peer.port);
+        append_json_string(&resp, r->method, strlen(r->method));
+        response_append(&resp, ", \"path\": ", 10);
+        append_json_string(&resp, r->path, r->path_len);
+        response_appendf(&resp, ", \"status\": %u, \"total_us\": %u, \"phases_us\": {",
+                         r->status, r->total_us);
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            response_appendf(&resp, "%s\"%s\": %u", p > 0 ? ", " : "", trace_phase_name(p),
+                             r->phase_us[p]);
+        }
+        response_append(&resp, "}}", 2);
+    }
+    response_append(&resp, "]}\n", 3);
+    finish_json_response(client_fd, ssl, &resp);
+    return 0;
 }
 
-user_t* get_user(int id) {
-    pthread_mutex_lock(&users_mutex);
-    for (int i = 0; i < user_count; i++) {
-        if (users[i].id == id) {
-            pthread_mutex_unlock(&users_mutex);
-            return &users[i];
+// Convert user to JSON. The store keeps the same rendering with each
+// record; this is for copies, such as ?email= lookups.
+void user_to_json(const user_t *user, http_response_t *resp) {
+    response_appendf(resp, "{\"id\": %d, \"name\": ", user->id);
+    append_json_string(resp, user->name, strlen(user->name));
+    response_append(resp, ", \"email\": ", 11);
+    append_json_string(resp, user->email, strlen(user->email));
+    response_append(resp, ", \"created_at\": ", 16);
+    append_json_string(resp, user->created_at, strlen(user->created_at));
+    response_append(resp, "}", 1);
+}
+
+// user_json_fn for a single user
+static void append_user_json(int id, const char *json, size_t len, void *ctx) {
+    (void)id;
+    response_append(ctx, json, len);
+}
+
+// One page of GET /api/users
+typedef struct {
+    int after;                 // keyset cursor: users with larger ids
+    int limit;
+    unsigned fields;           // USER_FIELD_* mask
+    int paged;                 // ?limit= or ?after= given; else the whole list
+    int by_email;              // ?email= given: look up that user instead
+    char email[128];
+} user_page_t;
+
+static const struct {
+    const char *name;
+    unsigned bit;
+} user_field_names[] = {
+    {"id", USER_FIELD_ID},
+    {"name", USER_FIELD_NAME},
+    {"email", USER_FIELD_EMAIL},
+    {"created_at", USER_FIELD_CREATED_AT},
+};
+
+static int parse_user_fields(const query_param_t *param, unsigned *fields) {
+    char list[96];
+    if (query_decode(param->value, param->value_len, list, sizeof(list)) <= 0) {
+        return -1;
+    }
+    *fields = 0;
+    char *save;
+    for (char *field = strtok_r(list, ",", &save); field; field = strtok_r(NULL, ",", &save)) {
+        size_t i;
+        for (i = 0; i < sizeof(user_field_names) / sizeof(user_field_names[0]); i++) {
+            if (strcmp(field, user_field_names[i].name) == 0) {
+                *fields |= user_field_names[i].bit;
+                break;
+            }
+        }
+        if (i == sizeof(user_field_names) / sizeof(user_field_names[0])) {
+            return -1;
         }
     }
-    pthread_mutex_unlock(&users_mutex);
-    return NULL;
+    return *fields ? 0 : -1;
 }
 
-int update_user(int id, const char *name, const char *email) {
-    pthread_mutex_lock(&users_mutex);
-    for (int i = 0; i < user_count; i++) {
-        if (users[i].id == id) {
-            if (name) strncpy(users[i].name, name, sizeof(users[i].name) - 1);
-            if (email) strncpy(users[i].email, email, sizeof(users[i].email) - 1);
-            pthread_mutex_unlock(&users_mutex);
-            return 0;
+// The mask as a ?fields= value, for the next page's link: the field names
+// in their fixed order, so its size is bounded whatever the client sent
+static void format_user_fields(unsigned fields, char *out, size_t size) {
+    size_t len = 0;
+    out[0] = '\0';
+    for (size_t i = 0; i < sizeof(user_field_names) / sizeof(user_field_names[0]); i++) {
+        if (fields & user_field_names[i].bit) {
+            len += snprintf(out + len, size - len, "%s%s", len ? "," : "",
+                            user_field_names[i].name);
         }
     }
-    pthread_mutex_unlock(&users_mutex);
-    return -1;
 }
 
-int delete_user(int id) {
-    pthread_mutex_lock(&users_mutex);
-    for (int i = 0; i < user_count; i++) {
-        if (users[i].id == id) {
-            // Shift remaining users
-            for (int j = i; j < user_count - 1; j++) {
-                users[j] = users[j + 1];
-            }
-            user_count--;
-            pthread_mutex_unlock(&users_mutex);
-            return 0;
+// ?limit=N&after=<id>&fields=id,name, or ?email=<address>&fields=...
+// Returns -1 with an error body on a bad value.
+static int parse_user_page(const http_request_t *req, user_page_t *page, const char **error) {
+    query_param_t params[MAX_QUERY_PARAMS];
+    int count = parse_query_string(req->query_string, req->query_len, params, MAX_QUERY_PARAMS);
+    page->after = 0;
+    page->limit = USER_PAGE_DEFAULT;
+    page->fields = USER_FIELDS_ALL;
+    page->by_email = 0;
+    page->paged = find_query_param(params, count, "limit") ||
+                  find_query_param(params, count, "after");
+
+    const query_param_t *param = find_query_param(params, count, "limit");
+    if (param && query_int(param, 1, USER_PAGE_MAX, &page->limit) != 0) {
+        *error = "{\"error\": \"limit must be between 1 and 1000\"}\n";
+        return -1;
+    }
+    param = find_query_param(params, count, "after");
+    if (param && query_int(param, 0, INT32_MAX, &page->after) != 0) {
+        *error = "{\"error\": \"after must be a user id\"}\n";
+        return -1;
+    }
+    param = find_query_param(params, count, "fields");
+    if (param) {
+        if (parse_user_fields(param, &page->fields) != 0) {
+            *error = "{\"error\": \"fields must list id, name, email or created_at\"}\n";
+            return -1;
         }
     }
-    pthread_mutex_unlock(&users_mutex);
-    return -1;
+    param = find_query_param(params, count, "email");
+    if (param) {
+        if (query_decode(param->value, param->value_len, page->email, sizeof(page->email)) <= 0) {
+            *error = "{\"error\": \"email must be an address\"}\n";
+            return -1;
+        }
+        page->by_email = 1;
+    }
+    return 0;
 }
 
-// Convert user to JSON
-void user_to_json(const user_t *user, char *json, size_t size) {
-    snprintf(json, size,
-             "{\"id\": %d, \"name\": \"%s\", \"email\": \"%s\", \"created_at\": \"%s\"}\n",
-             user->id, user->name, user->email, user->created_at);
+// The selected fields of a user, in the same form as user_to_json
+static void user_fields_to_json(const user_t *user, unsigned fields, http_response_t *resp) {
+    if (fields == USER_FIELDS_ALL) {
+        user_to_json(user, resp);
+        return;
+    }
+    const char *sep = "{";
+    if (fields & USER_FIELD_ID) {
+        response_appendf(resp, "%s\"id\": %d", sep, user->id);
+        sep = ", ";
+    }
+    if (fields & USER_FIELD_NAME) {
+        response_appendf(resp, "%s\"name\": ", sep);
+        append_json_string(resp, user->name, strlen(user->name));
+        sep = ", ";
+    }
+    if (fields & USER_FIELD_EMAIL) {
+        response_appendf(resp, "%s\"email\": ", sep);
+        append_json_string(resp, user->email, strlen(user->email));
+        sep = ", ";
+    }
+    if (fields & USER_FIELD_CREATED_AT) {
+        response_appendf(resp, "%s\"created_at\": ", sep);
+        append_json_string(resp, user->created_at, strlen(user->created_at));
+    }
+    response_append(resp, "}", 1);
 }
 
-// Convert all users to JSON array
-void users_to_json_array(char *json, size_t size) {
-    char *ptr = json;
-    int written = snprintf(ptr, size, "[");
-    ptr += written;
-    size -= written;
-    
-    pthread_mutex_lock(&users_mutex);
-    for (int i = 0; i < user_count && size > 0; i++) {
-        if (i > 0) {
-            written = snprintf(ptr, size, ",");
-            ptr += written;
-            size -= written;
+// A page being written out: commas between users, and whether any
+// follow the last one (the store is asked for one more than the limit)
+typedef struct {
+    http_response_t *resp;
+    int limit;
+    int count;
+    int last_id;
+    int more;
+} page_writer_t;
+
+static void append_page_user(int id, const char *json, size_t len, void *ctx) {
+    page_writer_t *writer = ctx;
+    if (writer->count == writer->limit) {
+        writer->more = 1;
+        return;
+    }
+    if (writer->count++ > 0) {
+        response_append(writer->resp, ",", 1);
+    }
+    response_append(writer->resp, json, len);
+    writer->last_id = id;
+}
+
+// ?fields= pages are built from copies of the users
+static int append_page_fields(const user_page_t *page, page_writer_t *writer) {
+    user_t *users = malloc((page->limit + 1) * sizeof(user_t));
+    if (!users) {
+        return -1;
+    }
+    int count = user_store_list(page->after, users, page->limit + 1);
+    writer->more = count > page->limit;
+    if (writer->more) {
+        count = page->limit;
+    }
+    for (int i = 0; i < count; i++) {
+        if (writer->count++ > 0) {
+            response_append(writer->resp, ",", 1);
         }
-        
-        written = snprintf(ptr, size,
-                          "{\"id\": %d, \"name\": \"%s\", \"email\": \"%s\", \"created_at\": \"%s\"}",
-                          users[i].id, users[i].name, users[i].email, users[i].created_at);
-        ptr += written;
-        size -= written;
+        user_fields_to_json(&users[i], page->fields, writer->resp);
     }
-    pthread_mutex_unlock(&users_mutex);
-    
-    snprintf(ptr, size, "]\n");
+    if (count > 0) {
+        writer->last_id = users[count - 1].id;
+    }
+    free(users);
+    return 0;
 }
 
-// Parse JSON-like body for user creation/update
-int parse_user_json(const char *json, char *name, size_t name_size, char *email, size_t email_size) {
-    // Initialize with empty strings
-    name[0] = '\0';
-    email[0] = '\0';
-    
-    // Find "name" field
-    const char *name_field = strstr(json, "\"name\":");
-    if (name_field) {
-        // Skip past "name": and any whitespace
-        name_field += 7; // length of "\"name\":"
-        while (*name_field == ' ' || *name_field == '\t') name_field++;
-        
-        // Check if it's a quoted string
-        if (*name_field == '"') {
-            name_field++; // skip opening quote
-            const char *name_end = strchr(name_field, '"');
-            if (name_end) {
-                size_t name_len = name_end - name_field;
-                if (name_len < name_size) {
-                    strncpy(name, name_field, name_len);
-                    name[name_len] = '\0';
-                }
-            }
+// Up to page->limit users after page->after onto the writer, whole or
+// projected; -1 when out of memory
+static int append_user_batch(const user_page_t *page, page_writer_t *writer) {
+    if (page->fields == USER_FIELDS_ALL) {
+        user_store_list_json(page->after, page->limit + 1, append_page_user, writer);
+        return 0;
+    }
+    return append_page_fields(page, writer);
+}
+
+// A page of users as a JSON array, read straight off the id-ordered store:
+// one binary search for the cursor, then limit users, whatever the table
+// size. Whole users are the JSON each record already carries, joined with
+// commas, so nothing is formatted or escaped per request. When more
+// follow, a Link header carries the next page's cursor.
+static void send_user_page(int client_fd, void *ssl, const user_page_t *page) {
+    http_response_t resp;
+    begin_json_response(&resp, HTTP_STATUS_200);
+    response_append(&resp, "[", 1);
+    page_writer_t writer = {&resp, page->limit, 0, 0, 0};
+    if (append_user_batch(page, &writer) != 0) {
+        response_free(&resp);
+        send_json_response(client_fd, ssl, HTTP_STATUS_500, "{\"error\": \"Out of memory\"}\n");
+        return;
+    }
+    response_append(&resp, "]\n", 2);
+    if (writer.more) {
+        char fields[64] = "";
+        if (page->fields != USER_FIELDS_ALL) {
+            format_user_fields(page->fields, fields, sizeof(fields));
         }
+        char link[160];
+        snprintf(link, sizeof(link), "</api/users?after=%d&limit=%d%s%s>; rel=\"next\"",
+                 writer.last_id, page->limit, fields[0] ? "&fields=" : "", fields);
+        add_response_header(&resp, "Link", link);
     }
-    
-    // Find "email" field
-    const char *email_field = strstr(json, "\"email\":");
-    if (email_field) {
-        // Skip past "email": and any whitespace
-        email_field += 8; // length of "\"email\":"
-        while (*email_field == ' ' || *email_field == '\t') email_field++;
-        
-        // Check if it's a quoted string
-        if (*email_field == '"') {
-            email_field++; // skip opening quote
-            const char *email_end = strchr(email_field, '"');
-            if (email_end) {
-                size_t email_len = email_end - email_field;
-                if (email_len < email_size) {
-                    strncpy(email, email_field, email_len);
-                    email[email_len] = '\0';
-                }
-            }
+    finish_json_response(client_fd, ssl, &resp);
+}
+
+// The whole list, without ?limit= or ?after=: streamed as one JSON array,
+// a batch of users per chunk, so neither the table nor the response is
+// ever held whole. Returns -1 when the stream broke off.
+static int stream_user_list(int client_fd, void *ssl, const http_request_t *req, const user_page_t *page) {
+    http_response_t resp;
+    begin_json_response(&resp, HTTP_STATUS_200);
+    if (response_stream_begin(client_fd, ssl, &resp, req) != 0) {
+        response_free(&resp);
+        return -1;
+    }
+
+    response_append(&resp, "[", 1);
+    user_page_t batch = *page;
+    batch.limit = USER_STREAM_BATCH;
+    int total = 0;
+    int ret = 0;
+    for (;;) {
+        // The writer's count runs across batches, for the commas
+        page_writer_t writer = {&resp, total + USER_STREAM_BATCH, total, 0, 0};
+        if (append_user_batch(&batch, &writer) != 0) {
+            ret = -1;
+            break;
+        }
+        total = writer.count;
+        batch.after = writer.last_id;
+        if (response_stream_flush(&resp, 0) != 0) {
+            ret = -1;
+            break;
+        }
+        if (!writer.more) {
+            break;
         }
     }
-    
-    // Return true if both name and email were successfully parsed
-    return (name[0] != '\0' && email[0] != '\0');
+
+    if (ret == 0) {
+        response_append(&resp, "]\n", 2);
+        ret = response_stream_end(&resp);
+    } else {
+        // The status line is out; all that is left is to cut the body short
+        set_response_keep_alive(0);
+    }
+    response_free(&resp);
+    return ret;
+}
+
+// ?email= lookup: one probe of the email index, answered in the shape of a
+// page so clients can treat both alike
+static void send_user_by_email(int client_fd, void *ssl, const user_page_t *page) {
+    user_t user;
+    http_response_t resp;
+    begin_json_response(&resp, HTTP_STATUS_200);
+    response_append(&resp, "[", 1);
+    if (user_store_find_email(page->email, &user) == 0) {
+        user_fields_to_json(&user, page->fields, &resp);
+    }
+    response_append(&resp, "]\n", 2);
+    finish_json_response(client_fd, ssl, &resp);
+}
+
+// Tape entries for a user body: the object, name and email, and room for
+// a few more members a client may send along
+#define USER_JSON_TAPE 64
+
+// Take name and email from a JSON user body; members left out keep the
+// caller's values. Returns -1 with a 400 body in error for anything that
+// is not a JSON object with string name and email that fit.
+static int parse_user_json(const char *json, size_t len, char *name, size_t name_size,
+                           char *email, size_t email_size, char *error, size_t error_size) {
+    json_token_t tape[USER_JSON_TAPE];
+    json_doc_t doc;
+    if (json_parse(&doc, json, len, tape, USER_JSON_TAPE) != 0) {
+        snprintf(error, error_size, "{\"error\": \"Invalid JSON: %s at byte %zu\"}\n",
+                 doc.error, doc.error_offset);
+        return -1;
+    }
+    if (tape[0].type != JSON_OBJECT) {
+        snprintf(error, error_size, "{\"error\": \"Body must be a JSON object\"}\n");
+        return -1;
+    }
+    int value = json_object_get(&doc, 0, "name");
+    if (value >= 0 && json_get_string(&doc, value, name, name_size) < 0) {
+        snprintf(error, error_size, "{\"error\": \"name must be a string of at most %zu bytes\"}\n",
+                 name_size - 1);
+        return -1;
+    }
+    value = json_object_get(&doc, 0, "email");
+    if (value >= 0 && json_get_string(&doc, value, email, email_size) < 0) {
+        snprintf(error, error_size, "{\"error\": \"email must be a string of at most %zu bytes\"}\n",
+                 email_size - 1);
+        return -1;
+    }
+    return 0;
 }
 
 // Users API endpoint
 int handle_api_users(int client_fd, void *ssl, const char *method, const char *path, const http_request_t *req) {
+    http_response_t resp;
+    
     if (strcmp(method, "GET") == 0) {
         if (strcmp(path, "/api/users") == 0) {
-            // Get all users
-            char json_response[4096];
-            users_to_json_array(json_response, sizeof(json_response));
-#ifdef USE_SSL
-            if (ssl) {
-                send_json_response(client_fd, ssl, HTTP_STATUS_200, json_response);
+            // All users, a page of them, or the one with ?email=
+            user_page_t page;
+            const char *error;
+            if (parse_user_page(req, &page, &error) != 0) {
+                send_json_response(client_fd, ssl, HTTP_STATUS_400, error);
+            } else if (page.by_email) {
+                send_user_by_email(client_fd, ssl, &page);
+            } else if (!page.paged) {
+                stream_user_list(client_fd, ssl, req, &page);
             } else {
-                send_json_response_plain(client_fd, HTTP_STATUS_200, json_response);
+                send_user_page(client_fd, ssl, &page);
             }
-#else
-            send_json_response_plain(client_fd, HTTP_STATUS_200, json_response);
-#endif
-            update_metrics(1);
             return 0;
         } else if (strncmp(path, "/api/users/", 11) == 0) {
             // Get specific user
             int user_id = atoi(path + 11);
-            user_t *user = get_user(user_id);
             
-            if (user) {
-                char json_response[512];
-                user_to_json(user, json_response, sizeof(json_response));
-#ifdef USE_SSL
-                if (ssl) {
-                    send_json_response(client_fd, ssl, HTTP_STATUS_200, json_response);
-                } else {
-                    send_json_response_plain(client_fd, HTTP_STATUS_200, json_response);
-                }
-#else
-                send_json_response_plain(client_fd, HTTP_STATUS_200, json_response);
-#endif
-                update_metrics(1);
+            begin_json_response(&resp, HTTP_STATUS_200);
+            if (user_store_get_json(user_id, append_user_json, &resp) == 0) {
+                response_append(&resp, "\n", 1);
+                finish_json_response(client_fd, ssl, &resp);
             } else {
-#ifdef USE_SSL
-                if (ssl) {
-                    send_json_response(client_fd, ssl, HTTP_STATUS_404, "{\"error\": \"User not found\"}\n");
-                } else {
-                    send_json_response_plain(client_fd, HTTP_STATUS_404, "{\"error\": \"User not found\"}\n");
-                }
-#else
-                send_json_response_plain(client_fd, HTTP_STATUS_404, "{\"error\": \"User not found\"}\n");
-#endif
-                update_metrics(0);
+                response_free(&resp);
+                send_json_response(client_fd, ssl, HTTP_STATUS_404, "{\"error\": \"User not found\"}\n");
             }
             return 0;
         }
     } else if (strcmp(method, "POST") == 0 && strcmp(path, "/api/users") == 0) {
-        // Create new user with JSON body parsing
+        // Create new user with JSON body parsing. Emails are unique, so
+        // there is no default one: the body has to carry it.
         char name[64] = "John Doe";
-        char email[128] = "john@example.com";
+        char email[128] = "";
+        char error[160];
         
-        // Try to parse JSON from request body if available
-        if (req->body[0] != '\0') {
-            if (parse_user_json(req->body, name, sizeof(name), email, sizeof(email))) {
-                printf("Creating user: %s (%s)\n", name, email);
-            } else {
-                printf("Failed to parse JSON, using default values\n");
-            }
+        if (req->content_length == 0) {
+            send_json_response(client_fd, ssl, HTTP_STATUS_400, BODY_REQUIRED);
+            return 0;
         }
+        if (parse_user_json(req->body, req->content_length, name, sizeof(name), email,
+                            sizeof(email), error, sizeof(error)) != 0) {
+            send_json_response(client_fd, ssl, HTTP_STATUS_400, error);
+            return 0;
+        }
+        if (!email[0]) {
+            send_json_response(client_fd, ssl, HTTP_STATUS_400, "{\"error\": \"email is required\"}\n");
+            return 0;
+        }
+        DEBUG_LOG("Creating user: %s (%s)\n", name, email);
         
-        int user_id = create_user(name, email);
-        if (user_id > 0) {
-            char json_response[512];
-            snprintf(json_response, sizeof(json_response),
-                     "{\"message\": \"User created successfully\", \"id\": %d, \"name\": \"%s\", \"email\": \"%s\"}\n", 
-                     user_id, name, email);
-#ifdef USE_SSL
-            if (ssl) {
-                send_json_response(client_fd, ssl, HTTP_STATUS_201, json_response);
-            } else {
-                send_json_response_plain(client_fd, HTTP_STATUS_201, json_response);
-            }
-#else
-            send_json_response_plain(client_fd, HTTP_STATUS_201, json_response);
-#endif
-            update_metrics(1);
+        int user_id = user_store_create(name, email);
+        if (user_id == USER_STORE_CONFLICT) {
+            send_json_response(client_fd, ssl, HTTP_STATUS_409, "{\"error\": \"Email already in use\"}\n");
+        } else if (user_id > 0) {
+            begin_json_response(&resp, HTTP_STATUS_201);
+            response_appendf(&resp, "{\"message\": \"User created successfully\", \"id\": %d, \"name\": ",
+                             user_id);
+            append_json_string(&resp, name, strlen(name));
+            response_append(&resp, ", \"email\": ", 11);
+            append_json_string(&resp, email, strlen(email));
+            response_append(&resp, "}\n", 2);
+            finish_json_response(client_fd, ssl, &resp);
+        } else if (user_id == USER_STORE_IO_ERROR) {
+            send_json_response(client_fd, ssl, HTTP_STATUS_500, USER_NOT_SAVED);
         } else {
-#ifdef USE_SSL
-            if (ssl) {
-                send_json_response(client_fd, ssl, HTTP_STATUS_500, "{\"error\": \"Failed to create user\"}\n");
-            } else {
-                send_json_response_plain(client_fd, HTTP_STATUS_500, "{\"error\": \"Failed to create user\"}\n");
-            }
-#else
-            send_json_response_plain(client_fd, HTTP_STATUS_500, "{\"error\": \"Failed to create user\"}\n");
-#endif
-            update_metrics(0);
+            send_json_response(client_fd, ssl, HTTP_STATUS_500, "{\"error\": \"Failed to create user\"}\n");
         }
         return 0;
     } else if (strcmp(method, "PUT") == 0 && strncmp(path, "/api/users/", 11) == 0) {
         // Update user
         int user_id = atoi(path + 11);
-        if (update_user(user_id, "Updated Name", "updated@example.com") == 0) {
-#ifdef USE_SSL
-            if (ssl) {
-                send_json_response(client_fd, ssl, HTTP_STATUS_200, "{\"message\": \"User updated successfully\"}\n");
-            } else {
-                send_json_response_plain(client_fd, HTTP_STATUS_200, "{\"message\": \"User updated successfully\"}\n");
-            }
-#else
-            send_json_response_plain(client_fd, HTTP_STATUS_200, "{\"message\": \"User updated successfully\"}\n");
-#endif
-            update_metrics(1);
+        char name[64] = "";
+        char email[128] = "";
+        char error[160];
+        // Members the body leaves out (or empty) keep their values
+        if (req->content_length == 0) {
+            send_json_response(client_fd, ssl, HTTP_STATUS_400, BODY_REQUIRED);
+            return 0;
         }
-        else {
-#ifdef USE_SSL
-            if (ssl) {
-                send_json_response(client_fd, ssl, HTTP_STATUS_404, "{\"error\": \"User not found\"}\n");
-            } else {
-                send_json_response_plain(client_fd, HTTP_STATUS_404, "{\"error\": \"User not found\"}\n");
-            }
-#else
-            send_json_response_plain(client_fd, HTTP_STATUS_404, "{\"error\": \"User not found\"}\n");
-#endif
-            update_metrics(0);
+        if (parse_user_json(req->body, req->content_length, name, sizeof(name), email,
+                            sizeof(email), error, sizeof(error)) != 0) {
+            send_json_response(client_fd, ssl, HTTP_STATUS_400, error);
+            return 0;
+        }
+        int result = user_store_update(user_id, name[0] ? name : NULL, email[0] ? email : NULL);
+        if (result == 0) {
+            send_json_response(client_fd, ssl, HTTP_STATUS_200, "{\"message\": \"User updated successfully\"}\n");
+        } else if (result == USER_STORE_CONFLICT) {
+            send_json_response(client_fd, ssl, HTTP_STATUS_409, "{\"error\": \"Email already in use\"}\n");
+        } else if (result == USER_STORE_IO_ERROR) {
+            send_json_response(client_fd, ssl, HTTP_STATUS_500, USER_NOT_SAVED);
+        } else if (result == USER_STORE_NO_MEMORY) {
+            send_json_response(client_fd, ssl, HTTP_STATUS_500, "{\"error\": \"Out of memory\"}\n");
+        } else {
+            send_json_response(client_fd, ssl, HTTP_STATUS_404, "{\"error\": \"User not found\"}\n");
         }
         return 0;
     } else if (strcmp(method, "DELETE") == 0 && strncmp(path, "/api/users/", 11) == 0) {
         // Delete user
         int user_id = atoi(path + 11);
-        if (delete_user(user_id) == 0) {
-#ifdef USE_SSL
-            if (ssl) {
-                send_json_response(client_fd, ssl, HTTP_STATUS_204, "\n");
-            } else {
-                send_json_response_plain(client_fd, HTTP_STATUS_204, "\n");
-            }
-#else
-            send_json_response_plain(client_fd, HTTP_STATUS_204, "\n");
-#endif
-            update_metrics(1);
+        int result = user_store_delete(user_id);
+        if (result == 0) {
+            send_json_response(client_fd, ssl, HTTP_STATUS_204, "");
+        } else if (result == USER_STORE_IO_ERROR) {
+            send_json_response(client_fd, ssl, HTTP_STATUS_500, USER_NOT_SAVED);
         } else {
-#ifdef USE_SSL
-            if (ssl) {
-                send_json_response(client_fd, ssl, HTTP_STATUS_404, "{\"error\": \"User not found\"}\n");
-            } else {
-                send_json_response_plain(client_fd, HTTP_STATUS_404, "{\"error\": \"User not found\"}\n");
-            }
-#else
-            send_json_response_plain(client_fd, HTTP_STATUS_404, "{\"error\": \"User not found\"}\n");
-#endif
-            update_metrics(0);
+            send_json_response(client_fd, ssl, HTTP_STATUS_404, "{\"error\": \"User not found\"}\n");
         }
         return 0;
     }
     
     return -1; // Not handled
-} 
\ No newline at end of file
+}
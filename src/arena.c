@@ -0,0 +1,112 @@
+#include "utils/arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Standard-size blocks released by this thread, reused before malloc
+static __thread arena_block_t *free_blocks = NULL;
+static __thread int free_count = 0;
+
+static arena_block_t *block_get(size_t size) {
+    if (size == ARENA_BLOCK_SIZE && free_blocks) {
+        arena_block_t *block = free_blocks;
+        free_blocks = block->next;
+        free_count--;
+        return block;
+    }
+
+    arena_block_t *block = malloc(sizeof(arena_block_t) + size);
+    if (block) {
+        block->size = size;
+    }
+    return block;
+}
+
+// Connections often close on a different thread than the one that opened
+// them, so each list is capped rather than left to grow without bound
+static void block_put(arena_block_t *block) {
+    if (block->size == ARENA_BLOCK_SIZE && free_count < ARENA_FREE_LIST_MAX) {
+        block->next = free_blocks;
+        free_blocks = block;
+        free_count++;
+    } else {
+        free(block);
+    }
+}
+
+int arena_init(arena_t *arena) {
+    arena->block = block_get(ARENA_BLOCK_SIZE);
+    if (!arena->block) {
+        return -1;
+    }
+    arena->bottom = ARENA_INITIAL_BUFFER;
+    arena->top = ARENA_BLOCK_SIZE;
+    arena->spill = NULL;
+    return 0;
+}
+
+void arena_destroy(arena_t *arena) {
+    arena_reset(arena);
+    if (arena->block) {
+        block_put(arena->block);
+        arena->block = NULL;
+    }
+}
+
+// Give the receive buffer at least min_size bytes, keeping the first used
+// bytes. Only valid while no views are allocated. The block is replaced by
+// a larger one when the buffer would run into the top.
+int arena_grow_buffer(arena_t *arena, size_t used, size_t min_size) {
+    if (min_size <= arena->top) {
+        if (min_size > arena->bottom) {
+            arena->bottom = min_size;
+        }
+        return 0;
+    }
+
+    // Leave the same headroom for views above the larger buffer
+    size_t size = arena->block->size;
+    while (size < min_size + ARENA_BLOCK_SIZE - ARENA_INITIAL_BUFFER) {
+        size *= 2;
+    }
+    arena_block_t *block = block_get(size);
+    if (!block) {
+        return -1;
+    }
+    memcpy(block->data, arena->block->data, used);
+    block_put(arena->block);
+
+    arena->block = block;
+    arena->bottom = min_size;
+    arena->top = size;
+    return 0;
+}
+
+// Allocate pointer-aligned memory for request views; valid until reset
+void *arena_alloc(arena_t *arena, size_t size) {
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    if (arena->top - arena->bottom >= size) {
+        arena->top -= size;
+        return arena->block->data + arena->top;
+    }
+
+    arena_block_t *block = malloc(sizeof(arena_block_t) + size);
+    if (!block) {
+        return NULL;
+    }
+    block->size = size;
+    block->next = arena->spill;
+    arena->spill = block;
+    return block->data;
+}
+
+// Drop every view; the receive buffer is untouched
+void arena_reset(arena_t *arena) {
+    if (arena->block) {
+        arena->top = arena->block->size;
+    }
+    while (arena->spill) {
+        arena_block_t *next = arena->spill->next;
+        free(arena->spill);
+        arena->spill = next;
+    }
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include "utils/server.h"
@@ -7,126 +8,160 @@
 #include <string.h>
 #include "utils/parse_req.h"
 #include <unistd.h>
+#include <errno.h>
 #include <sys/stat.h>
 #include <pthread.h>
+#include <time.h>
 #include "utils/client.h"
 #include "utils/http.h"
+#include "utils/transport.h"
+#include "utils/access_log.h"
+#include "utils/metrics.h"
 
 #ifdef USE_SSL
 #include "utils/ssl.h"
 SSL_CTX *global_ssl_ctx = NULL;  // Global SSL context
 #endif
 
-int create_client(int server_fd)
+// Accept one pending connection as a non-blocking socket, storing the
+// peer's address; returns -1 with errno == EAGAIN once the backlog is drained
+int create_client(int server_fd, struct sockaddr_storage *client_addr)
 {
-    struct sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
+    socklen_t client_len = sizeof(*client_addr);
 
-    int client_fd = accept(server_fd, (struct sockaddr*)&client_addr, &client_len);
+    int client_fd = accept4(server_fd, (struct sockaddr*)client_addr, &client_len,
+                            SOCK_NONBLOCK | SOCK_CLOEXEC);
 
     if(client_fd < 0)
     {
-        perror("client failure");
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            perror("client failure");
+        }
         return -1;
     }
+
+    // Every response is one gathered write (or corked), so Nagle only adds latency
+    transport_set_nodelay(client_fd);
     return client_fd;
 }
-void handle_client_request(int client_fd, void *ssl)
+
+#define NS_PER_MS 1000000ULL
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Count the request just answered, close its phase timing and queue its
+// access log record
+static void record_request(connection_t *conn, const http_request_t *req,
+                           metrics_route_t route, uint64_t start_ns)
 {
-    char buffer[4096];
-    memset(buffer, 0, sizeof(buffer));
+    int status;
+    size_t bytes;
+    response_stats_get(&status, &bytes);
+    uint64_t now = monotonic_ns();
+    // Pooled requests count from the hand-off, inline ones from here
+    uint64_t since = conn->enqueued_ns ? conn->enqueued_ns : start_ns;
+    uint64_t latency = now - since;
     
-    ssize_t bytes_read;
+    // The handler phase started once the request views were built
+    request_trace_t *trace = &conn->trace;
+    uint64_t write_ns = response_stats_write_ns();
+    uint64_t handled = now - (trace->mark_ns ? trace->mark_ns : start_ns);
+    trace->phase_ns[PHASE_WRITE] = write_ns;
+    trace->phase_ns[PHASE_HANDLER] = handled > write_ns ? handled - write_ns : 0;
+    uint64_t total = now - (trace->start_ns ? trace->start_ns : since);
+    TRACE_PROBE4(request_done, conn->fd, status, total, route);
     
-#ifdef USE_SSL
-    // If SSL context is available, try to detect if this is an HTTPS request
-    if (ssl == NULL && global_ssl_ctx != NULL) {
-        // Peek at the first few bytes to detect SSL handshake
-        char peek_buffer[10];
-        ssize_t peek_bytes = recv(client_fd, peek_buffer, sizeof(peek_buffer), MSG_PEEK);
-        
-        if (peek_bytes > 0) {
-            // Check if this looks like an SSL handshake (starts with 0x16 for SSL/TLS)
-            if (peek_buffer[0] == 0x16) {
-                printf("Detected SSL handshake, attempting SSL connection...\n");
-                ssl = create_ssl_connection(global_ssl_ctx, client_fd);
-                if (ssl) {
-                    printf("HTTPS connection established\n");
-                } else {
-                    printf("SSL connection failed, falling back to HTTP\n");
-                }
-            } else {
-                printf("Detected HTTP request\n");
-            }
-        }
+    size_t bytes_in = conn->request_len ? conn->request_len : conn->buffer_len;
+    metrics_record_request(route, status, bytes_in, bytes, latency);
+    metrics_record_phases(trace);
+    trace_slow_request(trace, total, &conn->peer, req ? req->method : NULL,
+                       req ? req->path : NULL, status);
+    if (access_log_enabled()) {
+        access_log_record(&conn->peer, req ? req->method : NULL, req ? req->path : NULL,
+                          status, bytes, latency);
     }
-    
-    if (ssl) {
-        bytes_read = ssl_read((SSL*)ssl, buffer, sizeof(buffer)-1);
+}
+
+// Give the connection back to its reactor, which sends whatever the socket
+// has not taken yet and then waits for the next request, or closes when
+// the response asked for that. With nothing left to send, a connection
+// that is not kept alive is closed right here.
+static void release_connection(connection_t *conn)
+{
+    response_set_backlog(NULL);
+    conn->close_after_write = !get_response_keep_alive();
+    if (conn->close_after_write && !conn->backlog.head) {
+        close_connection(conn);
     } else {
-        bytes_read = read(client_fd, buffer, sizeof(buffer)-1);
-    }
-#else
-    bytes_read = read(client_fd, buffer, sizeof(buffer)-1);
-#endif
-    
-    if(bytes_read < 0)
-    {
-        perror("read error");
-#ifdef USE_SSL
-        if (ssl) {
-            close_ssl_connection((SSL*)ssl);
-        } else {
-            close(client_fd);
-        }
-#else
-        close(client_fd);
-#endif
-        return;
+        resume_connection(conn);
     }
+}
+
+// Record the request and release the connection. Handlers clear the
+// keep-alive flag when a response could not be sent whole. The request's
+// views are gone once the reactor has the connection back, so it is
+// recorded first.
+static void finish_request(connection_t *conn, const http_request_t *req,
+                           metrics_route_t route, uint64_t start_ns)
+{
+    record_request(conn, req, route, start_ns);
+    release_connection(conn);
+}
+
+// Run the handlers for a fully buffered request, then either keep the
+// connection open for the next request or close it
+void handle_client_request(connection_t *conn)
+{
+    int client_fd = conn->fd;
+    void *ssl = conn->ssl;
+    (void)ssl;
+    uint64_t start_ns = monotonic_ns();
+    metrics_route_t route = ROUTE_OTHER;
+    response_stats_reset();
+    response_set_backlog(&conn->backlog);
     
-    // Parse full HTTP request
+    // The reactor already parsed the request; build the handler's views
     http_request_t req;
-    if(!parse_full_request(buffer, &req)){
-        printf("Could not parse request\n");
+    int parsed = fill_request(&conn->parser, conn->buffer, conn->buffer_len, &conn->arena, &req);
+    conn->trace.mark_ns = monotonic_ns();
+    conn->trace.phase_ns[PHASE_PARSE] += conn->trace.mark_ns - start_ns;
+    TRACE_PROBE1(handler_start, client_fd);
+    
+    conn->requests_served++;
+    int keep_alive = parsed && req.keep_alive &&
+                     conn->requests_served < KEEPALIVE_MAX_REQUESTS;
+    set_response_keep_alive(keep_alive);
+    
+    if(!parsed){
+        DEBUG_LOG("Could not parse request\n");
 #ifdef USE_SSL
         if (ssl) {
             send_error_response_ssl(ssl, HTTP_STATUS_400, "Invalid request format");
         } else {
             send_error_response(client_fd, HTTP_STATUS_400, "Invalid request format");
         }
-        if (ssl) {
-            close_ssl_connection(ssl);
-        } else {
-            close(client_fd);
-        }
 #else
         send_error_response(client_fd, HTTP_STATUS_400, "Invalid request format");
-        close(client_fd);
 #endif
+        record_request(conn, NULL, ROUTE_OTHER, start_ns);
+        release_connection(conn);
         return;
     }
     
-    printf("Method: %s\n", req.method);
-    printf("Path: %s\n", req.path);
-    if (req.query_string[0] != '\0') {
-        printf("Query: %s\n", req.query_string);
+    DEBUG_LOG("Method: %s\n", req.method);
+    DEBUG_LOG("Path: %s\n", req.path);
+    if (req.query_len > 0) {
+        DEBUG_LOG("Query: %s\n", req.query_string);
     }
     
     // Handle OPTIONS requests for CORS
     if (strcmp(req.method, "OPTIONS") == 0) {
-#ifdef USE_SSL
-        if (ssl) {
-            // TODO: Implement SSL CORS headers
-            close_ssl_connection(ssl);
-        } else {
-            send_cors_headers(client_fd);
-            close(client_fd);
-        }
-#else
-        send_cors_headers(client_fd);
-        close(client_fd);
-#endif
+        send_cors_headers(client_fd, ssl);
+        finish_request(conn, &req, route, start_ns);
         return;
     }
     
@@ -138,15 +173,10 @@ void handle_client_request(int client_fd, void *ssl)
         } else {
             send_error_response(client_fd, HTTP_STATUS_405, "Method not allowed");
         }
-        if (ssl) {
-            close_ssl_connection(ssl);
-        } else {
-            close(client_fd);
-        }
 #else
         send_error_response(client_fd, HTTP_STATUS_405, "Method not allowed");
-        close(client_fd);
 #endif
+        finish_request(conn, &req, route, start_ns);
         return;
     }
     
@@ -155,6 +185,7 @@ void handle_client_request(int client_fd, void *ssl)
     
     // Health check endpoint
     if (strcmp(req.path, "/health") == 0) {
+        route = ROUTE_HEALTH;
 #ifdef USE_SSL
         if (ssl) {
             result = handle_api_health(client_fd, ssl);
@@ -167,18 +198,32 @@ void handle_client_request(int client_fd, void *ssl)
     }
     // Metrics endpoint
     else if (strcmp(req.path, "/metrics") == 0) {
+        route = ROUTE_METRICS;
 #ifdef USE_SSL
         if (ssl) {
-            result = handle_api_metrics(client_fd, ssl);
+            result = handle_api_metrics(client_fd, ssl, &req);
         } else {
-            result = handle_api_metrics(client_fd, NULL);
+            result = handle_api_metrics(client_fd, NULL, &req);
         }
 #else
-        result = handle_api_metrics(client_fd, NULL);
+        result = handle_api_metrics(client_fd, NULL, &req);
+#endif
+    }
+    // Slowest recent requests with their phase breakdown
+    else if (strcmp(req.path, "/debug/slow") == 0) {
+#ifdef USE_SSL
+        if (ssl) {
+            result = handle_api_debug_slow(client_fd, ssl, &req);
+        } else {
+            result = handle_api_debug_slow(client_fd, NULL, &req);
+        }
+#else
+        result = handle_api_debug_slow(client_fd, NULL, &req);
 #endif
     }
     // Users API
     else if (strncmp(req.path, "/api/users", 10) == 0) {
+        route = ROUTE_USERS;
 #ifdef USE_SSL
         if (ssl) {
             result = handle_api_users(client_fd, ssl, req.method, req.path, &req);
@@ -191,14 +236,15 @@ void handle_client_request(int client_fd, void *ssl)
     }
     // Fall back to static file serving for GET requests
     else if (strcmp(req.method, HTTP_METHOD_GET) == 0) {
+        route = ROUTE_STATIC;
 #ifdef USE_SSL
         if (ssl) {
-            result = handle_get_request(client_fd, ssl, req.path);
+            result = handle_get_request(client_fd, ssl, req.path, &req);
         } else {
-            result = handle_get_request(client_fd, NULL, req.path);
+            result = handle_get_request(client_fd, NULL, req.path, &req);
         }
 #else
-        result = handle_get_request(client_fd, NULL, req.path);
+        result = handle_get_request(client_fd, NULL, req.path, &req);
 #endif
     } else if (strcmp(req.method, HTTP_METHOD_POST) == 0) {
 #ifdef USE_SSL
@@ -233,7 +279,7 @@ void handle_client_request(int client_fd, void *ssl)
     }
     
     if (result != 0) {
-        printf("Error handling request: %s %s\n", req.method, req.path);
+        DEBUG_LOG("Error handling request: %s %s\n", req.method, req.path);
 #ifdef USE_SSL
         if (ssl) {
             send_error_response_ssl(ssl, HTTP_STATUS_404, "Not found");
@@ -245,186 +291,326 @@ void handle_client_request(int client_fd, void *ssl)
 #endif
     }
     
-#ifdef USE_SSL
-    if (ssl) {
-        close_ssl_connection(ssl);
-    } else {
-        close(client_fd);
-    }
-#else
-    close(client_fd);
-#endif
+    finish_request(conn, &req, route, start_ns);
 }        
 
+// Answer an overloaded request with 503 and drop the connection
+static void send_overload(connection_t *conn) {
+    set_response_keep_alive(0);
+    response_stats_reset();
+    response_set_backlog(&conn->backlog);
+    conn->trace.mark_ns = monotonic_ns();
+    send_retry_later_response(conn->fd, conn->ssl, HTTP_STATUS_503, "Server busy",
+                              RETRY_AFTER_SECONDS);
+    record_request(conn, NULL, ROUTE_OTHER, conn->trace.mark_ns);
+    release_connection(conn);
+}
+
+// Integer square root, for the CoDel drop spacing
+static uint64_t isqrt(uint64_t n) {
+    uint64_t x = n, y = (n + 1) / 2;
+    while (y < x) {
+        x = y;
+        y = (x + n / x) / 2;
+    }
+    return x;
+}
+
+// Next drop time: interval / sqrt(count) after the given time
+static uint64_t codel_next_drop(uint64_t from, unsigned count) {
+    return from + CODEL_INTERVAL_MS * NS_PER_MS * 1024 / isqrt((uint64_t)count << 20);
+}
+
+// CoDel (RFC 8289) verdict for a request that waited sojourn_ns in the queue
+static int codel_should_drop(thread_pool_t *pool, uint64_t sojourn_ns, uint64_t now) {
+    if (sojourn_ns < CODEL_TARGET_MS * NS_PER_MS) {
+        // Below target: leave the dropping state without taking the lock
+        if (atomic_load_explicit(&pool->codel_first_above_ns, memory_order_relaxed)) {
+            atomic_store(&pool->codel_first_above_ns, 0);
+        }
+        if (atomic_load_explicit(&pool->codel_dropping, memory_order_relaxed)) {
+            atomic_store(&pool->codel_dropping, 0);
+        }
+        return 0;
+    }
+
+    pthread_mutex_lock(&pool->codel_mutex);
+    int drop = 0;
+    int ok_to_drop = 0;
+    uint64_t first_above = atomic_load(&pool->codel_first_above_ns);
+    if (first_above == 0) {
+        atomic_store(&pool->codel_first_above_ns, now + CODEL_INTERVAL_MS * NS_PER_MS);
+    } else if (now >= first_above) {
+        ok_to_drop = 1;
+    }
+
+    if (atomic_load(&pool->codel_dropping)) {
+        if (!ok_to_drop) {
+            atomic_store(&pool->codel_dropping, 0);
+        } else if (now >= pool->codel_drop_next_ns) {
+            drop = 1;
+            pool->codel_count++;
+            pool->codel_drop_next_ns = codel_next_drop(pool->codel_drop_next_ns, pool->codel_count);
+        }
+    } else if (ok_to_drop) {
+        drop = 1;
+        atomic_store(&pool->codel_dropping, 1);
+        // Resume near the previous rate if the last episode ended recently
+        if (pool->codel_count > 2 &&
+            now - pool->codel_drop_next_ns < 16 * CODEL_INTERVAL_MS * NS_PER_MS) {
+            pool->codel_count -= 2;
+        } else {
+            pool->codel_count = 1;
+        }
+        pool->codel_drop_next_ns = codel_next_drop(now, pool->codel_count);
+    }
+    pthread_mutex_unlock(&pool->codel_mutex);
+    return drop;
+}
+
+// Start the worker for deque slot index, making it the last active one
+static int start_worker(thread_pool_t *pool, int index) {
+    worker_slot_t *slot = &pool->slots[index];
+    // A retired worker may still be finishing its last request
+    if (slot->running) {
+        if (pthread_tryjoin_np(pool->threads[index], NULL) != 0) {
+            return -1;
+        }
+        slot->running = 0;
+    }
+
+    work_queue_set_active(&pool->queue, index + 1);
+    if (pthread_create(&pool->threads[index], NULL, worker_thread, slot) != 0) {
+        perror("Failed to create worker thread");
+        work_queue_set_active(&pool->queue, index);
+        return -1;
+    }
+    slot->running = 1;
+    atomic_store(&pool->thread_count, index + 1);
+    return 0;
+}
+
+// Join retired workers that have finished
+static void reap_workers(thread_pool_t *pool) {
+    for (int i = atomic_load(&pool->thread_count); i < pool->max_threads; i++) {
+        if (pool->slots[i].running && pthread_tryjoin_np(pool->threads[i], NULL) == 0) {
+            pool->slots[i].running = 0;
+        }
+    }
+}
+
+// Resize the pool from the last interval's utilization and queue wait
+static void *pool_controller(void *arg) {
+    thread_pool_t *pool = (thread_pool_t *)arg;
+    const uint64_t interval_ns = POOL_ADJUST_INTERVAL_MS * NS_PER_MS;
+    struct timespec tick = {0, (long)interval_ns};
+    int idle_ticks = 0;
+    uint64_t last_shed_full = 0;
+
+    while (!atomic_load(&pool->shutdown)) {
+        nanosleep(&tick, NULL);
+        reap_workers(pool);
+
+        int active = atomic_load(&pool->thread_count);
+        uint64_t busy = atomic_exchange(&pool->busy_ns, 0);
+        uint64_t wait = atomic_exchange(&pool->wait_ns, 0);
+        uint64_t dequeued = atomic_exchange(&pool->dequeued, 0);
+
+        uint64_t utilization = busy * 100 / (interval_ns * active);
+        if (utilization > 100) utilization = 100;
+        uint64_t wait_us = dequeued ? wait / dequeued / 1000 : 0;
+        // Requests turned away because every deque was full
+        uint64_t shed_full = atomic_load(&pool->shed_full);
+        int overflowed = shed_full != last_shed_full;
+        last_shed_full = shed_full;
+
+        pool_decision_t decision = POOL_HOLD;
+        if ((utilization >= POOL_GROW_UTILIZATION || wait_us > CODEL_TARGET_MS * 1000 ||
+             overflowed) && active < pool->max_threads) {
+            idle_ticks = 0;
+            if (start_worker(pool, active) == 0) {
+                decision = POOL_GROW;
+                atomic_fetch_add(&pool->grown, 1);
+            }
+        } else if (utilization <= POOL_SHRINK_UTILIZATION &&
+                   wait_us < CODEL_TARGET_MS * 1000 / 4) {
+            if (++idle_ticks >= POOL_SHRINK_AFTER_TICKS && active > pool->min_threads) {
+                // The highest slot drains its deque and exits; reaped later
+                idle_ticks = 0;
+                atomic_store(&pool->thread_count, active - 1);
+                work_queue_set_active(&pool->queue, active - 1);
+                decision = POOL_SHRINK;
+                atomic_fetch_add(&pool->shrunk, 1);
+            }
+        } else {
+            idle_ticks = 0;
+        }
+
+        atomic_store(&pool->last_utilization, (int)utilization);
+        atomic_store(&pool->last_wait_us, wait_us);
+        atomic_store(&pool->last_decision, decision);
+    }
+    return NULL;
+}
+
 // Thread pool implementation
-thread_pool_t *create_thread_pool(int thread_count, int queue_size, void *ssl_ctx) {
-    thread_pool_t *pool = malloc(sizeof(thread_pool_t));
+thread_pool_t *create_thread_pool(int min_threads, int max_threads, int queue_size, void *ssl_ctx) {
+    if (min_threads < 1) min_threads = 1;
+    if (max_threads < min_threads) max_threads = min_threads;
+
+    thread_pool_t *pool = calloc(1, sizeof(thread_pool_t));
     if (!pool) {
         perror("Failed to allocate thread pool");
         return NULL;
     }
     
-    pool->thread_count = thread_count;
+    pool->min_threads = min_threads;
+    pool->max_threads = max_threads;
     pool->queue_size = queue_size;
-    pool->queue_front = 0;
-    pool->queue_rear = 0;
-    pool->queue_count = 0;
-    pool->shutdown = 0;
+    pthread_mutex_init(&pool->codel_mutex, NULL);
 #ifdef USE_SSL
     pool->ssl_ctx = (SSL_CTX*)ssl_ctx;
 #else
     (void)ssl_ctx; // Suppress unused parameter warning
 #endif
     
-    // Allocate thread array
-    pool->threads = malloc(thread_count * sizeof(pthread_t));
-    if (!pool->threads) {
+    // Room for the largest pool; slots above the active count stay idle
+    pool->threads = calloc(max_threads, sizeof(pthread_t));
+    pool->slots = calloc(max_threads, sizeof(worker_slot_t));
+    if (!pool->threads || !pool->slots) {
         perror("Failed to allocate threads");
-        free(pool);
-        return NULL;
-    }
-    
-    // Allocate client queue
-    pool->client_queue = malloc(queue_size * sizeof(int));
-    if (!pool->client_queue) {
-        perror("Failed to allocate client queue");
-        free(pool->threads);
-        free(pool);
-        return NULL;
-    }
-    
-#ifdef USE_SSL
-    // Allocate SSL queue
-    pool->ssl_queue = malloc(queue_size * sizeof(SSL*));
-    if (!pool->ssl_queue) {
-        perror("Failed to allocate SSL queue");
-        free(pool->client_queue);
         free(pool->threads);
+        free(pool->slots);
         free(pool);
         return NULL;
     }
-#endif
-    
-    // Initialize mutex and condition variable
-    if (pthread_mutex_init(&pool->queue_mutex, NULL) != 0) {
-        perror("Failed to initialize mutex");
-        free(pool->client_queue);
-        free(pool->threads);
-        free(pool);
-        return NULL;
+    for (int i = 0; i < max_threads; i++) {
+        pool->slots[i].pool = pool;
+        pool->slots[i].index = i;
     }
     
-    if (pthread_cond_init(&pool->queue_cond, NULL) != 0) {
-        perror("Failed to initialize condition variable");
-        pthread_mutex_destroy(&pool->queue_mutex);
-        free(pool->client_queue);
+    // One deque per worker slot
+    if (work_queue_init(&pool->queue, max_threads, queue_size) != 0) {
+        perror("Failed to allocate work queues");
         free(pool->threads);
+        free(pool->slots);
         free(pool);
         return NULL;
     }
+    work_queue_set_active(&pool->queue, 0);
     
-    // Create worker threads
-    for (int i = 0; i < thread_count; i++) {
-        if (pthread_create(&pool->threads[i], NULL, worker_thread, pool) != 0) {
-            perror("Failed to create worker thread");
+    // Create the minimum number of workers; the controller adds the rest
+    for (int i = 0; i < min_threads; i++) {
+        if (start_worker(pool, i) != 0) {
             destroy_thread_pool(pool);
             return NULL;
         }
     }
+    if (pthread_create(&pool->controller, NULL, pool_controller, pool) != 0) {
+        perror("Failed to create pool controller");
+        destroy_thread_pool(pool);
+        return NULL;
+    }
+    pool->controller_started = 1;
     
-    printf("Thread pool created with %d threads\n", thread_count);
+    printf("Thread pool created with %d threads (up to %d)\n", min_threads, max_threads);
     return pool;
 }
 
 void destroy_thread_pool(thread_pool_t *pool) {
     if (!pool) return;
     
-    // Signal shutdown
-    pthread_mutex_lock(&pool->queue_mutex);
-    pool->shutdown = 1;
-    pthread_cond_broadcast(&pool->queue_cond);
-    pthread_mutex_unlock(&pool->queue_mutex);
+    // Stop resizing, then signal shutdown and unpark every worker
+    atomic_store(&pool->shutdown, 1);
+    if (pool->controller_started) {
+        pthread_join(pool->controller, NULL);
+    }
+    work_queue_shutdown(&pool->queue);
     
-    // Wait for all threads to finish
-    for (int i = 0; i < pool->thread_count; i++) {
-        pthread_join(pool->threads[i], NULL);
+    // Wait for all threads to finish, including retired ones
+    for (int i = 0; i < pool->max_threads; i++) {
+        if (pool->slots[i].running) {
+            pthread_join(pool->threads[i], NULL);
+        }
     }
     
     // Cleanup
-    pthread_mutex_destroy(&pool->queue_mutex);
-    pthread_cond_destroy(&pool->queue_cond);
-    free(pool->client_queue);
-#ifdef USE_SSL
-    free(pool->ssl_queue);
-#endif
+    work_queue_destroy(&pool->queue);
+    pthread_mutex_destroy(&pool->codel_mutex);
     free(pool->threads);
+    free(pool->slots);
     free(pool);
     printf("Thread pool destroyed\n");
 }
 
-int add_client_to_pool(thread_pool_t *pool, int client_fd, void *ssl) {
+int add_client_to_pool(thread_pool_t *pool, connection_t *conn) {
     if (!pool) return -1;
     
-    pthread_mutex_lock(&pool->queue_mutex);
-    
-    // Check if queue is full
-    if (pool->queue_count >= pool->queue_size) {
-        pthread_mutex_unlock(&pool->queue_mutex);
-        printf("Thread pool queue is full, rejecting client\n");
+    conn->enqueued_ns = monotonic_ns();
+    TRACE_PROBE1(request_enqueue, conn->fd);
+    if (work_queue_push(&pool->queue, conn) != 0) {
+        DEBUG_LOG("Thread pool queue is full, rejecting client\n");
         return -1;
     }
-    
-    // Add client to queue
-    pool->client_queue[pool->queue_rear] = client_fd;
-#ifdef USE_SSL
-    pool->ssl_queue[pool->queue_rear] = (SSL*)ssl;
-#else
-    (void)ssl; // Suppress unused parameter warning
-#endif
-    pool->queue_rear = (pool->queue_rear + 1) % pool->queue_size;
-    pool->queue_count++;
-    
-    // Signal worker thread
-    pthread_cond_signal(&pool->queue_cond);
-    pthread_mutex_unlock(&pool->queue_mutex);
-    
     return 0;
 }
 
+// Refuse a connection the pool could not queue: 503 rather than a reset
+void shed_connection(thread_pool_t *pool, connection_t *conn) {
+    if (pool) {
+        atomic_fetch_add(&pool->shed_full, 1);
+    }
+    send_overload(conn);
+}
+
+void get_thread_pool_stats(thread_pool_t *pool, thread_pool_stats_t *stats) {
+    static const char *decisions[] = {"hold", "grow", "shrink"};
+
+    stats->threads = atomic_load(&pool->thread_count);
+    stats->min_threads = pool->min_threads;
+    stats->max_threads = pool->max_threads;
+    stats->utilization = atomic_load(&pool->last_utilization);
+    stats->queue_wait_us = atomic_load(&pool->last_wait_us);
+    stats->decision = decisions[atomic_load(&pool->last_decision)];
+    stats->shedding = atomic_load(&pool->codel_dropping);
+    stats->grown = atomic_load(&pool->grown);
+    stats->shrunk = atomic_load(&pool->shrunk);
+    stats->shed_codel = atomic_load(&pool->shed_codel);
+    stats->shed_full = atomic_load(&pool->shed_full);
+}
+
 void *worker_thread(void *arg) {
-    thread_pool_t *pool = (thread_pool_t *)arg;
+    worker_slot_t *slot = (worker_slot_t *)arg;
+    thread_pool_t *pool = slot->pool;
     
     while (1) {
-        int client_fd = -1;
-        void *ssl = NULL;
-        
-        pthread_mutex_lock(&pool->queue_mutex);
-        
-        // Wait for client or shutdown signal
-        while (pool->queue_count == 0 && !pool->shutdown) {
-            pthread_cond_wait(&pool->queue_cond, &pool->queue_mutex);
-        }
-        
-        // Check for shutdown
-        if (pool->shutdown) {
-            pthread_mutex_unlock(&pool->queue_mutex);
+        // Own deque, then steal; parks until work arrives, shutdown, or
+        // the controller retires this slot
+        connection_t *conn = work_queue_pop(&pool->queue, slot->index);
+        if (!conn) {
             pthread_exit(NULL);
         }
         
-        // Get client from queue
-        client_fd = pool->client_queue[pool->queue_front];
-#ifdef USE_SSL
-        ssl = pool->ssl_queue[pool->queue_front];
-#endif
-        pool->queue_front = (pool->queue_front + 1) % pool->queue_size;
-        pool->queue_count--;
+        uint64_t start = monotonic_ns();
+        uint64_t sojourn = start > conn->enqueued_ns ? start - conn->enqueued_ns : 0;
+        conn->trace.phase_ns[PHASE_QUEUE] = sojourn;
+        TRACE_PROBE2(request_dequeue, conn->fd, sojourn);
+        atomic_fetch_add_explicit(&pool->wait_ns, sojourn, memory_order_relaxed);
+        atomic_fetch_add_explicit(&pool->dequeued, 1, memory_order_relaxed);
         
-        pthread_mutex_unlock(&pool->queue_mutex);
+        // Shed only once the pool cannot grow any further
+        if (atomic_load(&pool->thread_count) >= pool->max_threads &&
+            codel_should_drop(pool, sojourn, start)) {
+            atomic_fetch_add(&pool->shed_codel, 1);
+            send_overload(conn);
+            continue;
+        }
         
         // Handle client request
-        printf("Thread %lu handling client %d\n", pthread_self(), client_fd);
-        handle_client_request(client_fd, ssl);
+        DEBUG_LOG("Thread %lu handling client %d\n", pthread_self(), conn->fd);
+        handle_client_request(conn);
+        atomic_fetch_add_explicit(&pool->busy_ns, monotonic_ns() - start, memory_order_relaxed);
     }
     
     return NULL;
-}        
+}
@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "utils/epoch.h"
+
+#define EPOCH_INACTIVE 0
+
+// A reader thread's announcement. Records outlive their threads and are
+// adopted by new threads once released.
+typedef struct epoch_thread {
+    _Atomic uint64_t active;   // epoch entered, or EPOCH_INACTIVE
+    int nesting;               // owner only
+    _Atomic int released;
+    struct epoch_thread *next;
+} __attribute__((aligned(64))) epoch_thread_t;
+
+static _Atomic uint64_t global_epoch = 1;
+static _Atomic(epoch_thread_t *) threads = NULL;
+static pthread_mutex_t threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_key;
+static __thread epoch_thread_t *thread_record = NULL;
+
+static void release_record(void *arg) {
+    atomic_store(&((epoch_thread_t *)arg)->released, 1);
+}
+
+static void create_thread_key(void) {
+    pthread_key_create(&thread_key, release_record);
+}
+
+static epoch_thread_t *get_thread_record(void) {
+    if (thread_record) {
+        return thread_record;
+    }
+    pthread_once(&thread_key_once, create_thread_key);
+
+    pthread_mutex_lock(&threads_mutex);
+    epoch_thread_t *record;
+    for (record = atomic_load(&threads); record; record = record->next) {
+        int released = 1;
+        if (atomic_compare_exchange_strong(&record->released, &released, 0)) {
+            break;
+        }
+    }
+    if (!record) {
+        record = aligned_alloc(64, sizeof(epoch_thread_t));
+        if (record) {
+            atomic_init(&record->active, EPOCH_INACTIVE);
+            atomic_init(&record->released, 0);
+            record->next = atomic_load(&threads);
+            atomic_store(&threads, record);
+        }
+    }
+    pthread_mutex_unlock(&threads_mutex);
+
+    if (record) {
+        record->nesting = 0;
+        pthread_setspecific(thread_key, record);
+        thread_record = record;
+    }
+    return record;
+}
+
+// Start a read-side section: memory reachable from here on is not
+// reclaimed until epoch_exit. Sections nest. Returns -1 if this thread
+// could not be registered (out of memory); the caller must then exclude
+// writers some other way.
+int epoch_enter(void) {
+    epoch_thread_t *record = get_thread_record();
+    if (!record) {
+        return -1;
+    }
+    if (record->nesting++ == 0) {
+        atomic_store_explicit(&record->active, atomic_load(&global_epoch), memory_order_relaxed);
+        // The announcement must be visible before any shared pointer is read
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+    return 0;
+}
+
+void epoch_exit(void) {
+    epoch_thread_t *record = thread_record;
+    if (record && --record->nesting == 0) {
+        atomic_store_explicit(&record->active, EPOCH_INACTIVE, memory_order_release);
+    }
+}
+
+// Move the global epoch on if every active reader has seen the current
+// one. Returns the epoch now in force.
+static uint64_t try_advance(void) {
+    uint64_t epoch = atomic_load(&global_epoch);
+    atomic_thread_fence(memory_order_seq_cst);
+    for (epoch_thread_t *record = atomic_load(&threads); record; record = record->next) {
+        uint64_t active = atomic_load(&record->active);
+        if (active != EPOCH_INACTIVE && active != epoch) {
+            return epoch;
+        }
+    }
+    if (atomic_compare_exchange_strong(&global_epoch, &epoch, epoch + 1)) {
+        return epoch + 1;
+    }
+    return epoch;
+}
+
+// Wait until every reader active now has left. Must not be called from
+// inside a read-side section.
+void epoch_synchronize(void) {
+    uint64_t target = atomic_load(&global_epoch) + 2;
+    while (try_advance() < target) {
+        sched_yield();
+    }
+}
+
+// Hand unlinked memory to the limbo list. If no node can be allocated,
+// wait for readers and reclaim it right away.
+void epoch_retire(epoch_limbo_t *limbo, void *ptr, void (*reclaim)(void *ptr)) {
+    epoch_garbage_t *garbage = malloc(sizeof(epoch_garbage_t));
+    if (!garbage) {
+        epoch_synchronize();
+        reclaim(ptr);
+        return;
+    }
+    garbage->next = NULL;
+    garbage->epoch = atomic_load(&global_epoch);
+    garbage->ptr = ptr;
+    garbage->reclaim = reclaim;
+    if (limbo->tail) {
+        limbo->tail->next = garbage;
+    } else {
+        limbo->head = garbage;
+    }
+    limbo->tail = garbage;
+    limbo->pending++;
+}
+
+// Reclaim whatever no reader can still reach: memory retired at least two
+// epochs ago. Returns how much was reclaimed.
+size_t epoch_collect(epoch_limbo_t *limbo) {
+    if (!limbo->head) {
+        return 0;
+    }
+    uint64_t epoch = try_advance();
+    size_t reclaimed = 0;
+    while (limbo->head && limbo->head->epoch + 2 <= epoch) {
+        epoch_garbage_t *garbage = limbo->head;
+        limbo->head = garbage->next;
+        garbage->reclaim(garbage->ptr);
+        free(garbage);
+        reclaimed++;
+    }
+    if (!limbo->head) {
+        limbo->tail = NULL;
+    }
+    limbo->pending -= reclaimed;
+    return reclaimed;
+}
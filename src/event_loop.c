@@ -0,0 +1,681 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "utils/event_loop.h"
+#include "utils/client.h"
+#include "utils/parse_req.h"
+#include "utils/http.h"
+#include "utils/metrics.h"
+
+#ifdef USE_SSL
+#include "utils/ssl.h"
+#endif
+
+#define MAX_EVENTS 256
+
+// Mark the listening socket and the wakeup eventfd in epoll event data
+static int listener_tag;
+static int wake_tag;
+
+static reactor_t *reactors = NULL;
+// The reactor running on this thread, if any
+static __thread reactor_t *current_reactor = NULL;
+static int reactor_total = 0;
+// Set once, by stop_event_loops (possibly from a signal handler)
+static volatile sig_atomic_t loops_stopping = 0;
+
+static time_t monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+static void idle_unlink(reactor_t *reactor, connection_t *conn) {
+    if (!conn->prev && reactor->idle_head != conn) {
+        return;
+    }
+    if (conn->prev) conn->prev->next = conn->next;
+    else reactor->idle_head = conn->next;
+    if (conn->next) conn->next->prev = conn->prev;
+    else reactor->idle_tail = conn->prev;
+    conn->prev = conn->next = NULL;
+}
+
+// Append to the idle list, which therefore stays ordered by last activity
+static void idle_push(reactor_t *reactor, connection_t *conn) {
+    conn->last_active = monotonic_seconds();
+    conn->prev = reactor->idle_tail;
+    conn->next = NULL;
+    if (reactor->idle_tail) reactor->idle_tail->next = conn;
+    else reactor->idle_head = conn;
+    reactor->idle_tail = conn;
+}
+
+// Close the socket (and TLS session) and release the connection. Connections
+// owned by a reactor are unlinked from its idle list first.
+void close_connection(connection_t *conn) {
+    if (!conn) return;
+
+    if (conn->state != CONN_DISPATCHED) {
+        idle_unlink(conn->reactor, conn);
+    }
+
+#ifdef USE_SSL
+    if (conn->ssl) {
+        close_ssl_connection((SSL*)conn->ssl);
+    }
+#endif
+    close(conn->fd);
+    transport_queue_clear(&conn->backlog);
+    arena_destroy(&conn->arena);
+    free(conn);
+    metrics_connection_closed();
+}
+
+// Re-enable a oneshot registration for the given readiness
+static int rearm_connection(connection_t *conn, uint32_t events) {
+    struct epoll_event ev;
+    ev.events = events | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+    ev.data.ptr = conn;
+    return epoll_ctl(conn->reactor->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+// Make room for at least one more read, growing up to MAX_REQUEST_SIZE
+static int reserve_buffer(connection_t *conn) {
+    if (conn->buffer_cap - conn->buffer_len > 1) {
+        return 0;
+    }
+    if (conn->buffer_cap >= MAX_REQUEST_SIZE) {
+        return -1;
+    }
+
+    size_t new_cap = conn->buffer_cap * 2;
+    if (new_cap > MAX_REQUEST_SIZE) {
+        new_cap = MAX_REQUEST_SIZE;
+    }
+
+    if (arena_grow_buffer(&conn->arena, conn->buffer_len + 1, new_cap) != 0) {
+        return -1;
+    }
+    conn->buffer = conn->arena.block->data;
+    conn->buffer_cap = conn->arena.bottom;
+    return 0;
+}
+
+static void requeue_connection(reactor_t *reactor, connection_t *conn);
+
+// Send the rest of a response as the socket drains. The connection sits on
+// the idle list meanwhile, so a peer that stops reading is closed by the
+// keep-alive sweep instead of holding a thread.
+static void write_backlog(reactor_t *reactor, connection_t *conn) {
+    int ret = transport_flush(conn->fd, conn->ssl, &conn->backlog);
+    if (ret < 0) {
+        close_connection(conn);
+        return;
+    }
+    if (ret > 0) {
+        if (rearm_connection(conn, EPOLLOUT) != 0) {
+            close_connection(conn);
+        }
+        return;
+    }
+    idle_unlink(reactor, conn);
+    requeue_connection(reactor, conn);
+}
+
+// Access log entry for a request refused before it reached a handler
+static void log_rejection(connection_t *conn) {
+    int status;
+    size_t bytes;
+    response_stats_get(&status, &bytes);
+    metrics_record_request(ROUTE_OTHER, status, conn->buffer_len, bytes, 0);
+    access_log_record(&conn->peer, NULL, NULL, status, bytes, 0);
+}
+
+// Reply with a static error and drop the connection from the reactor thread.
+// Refusals get one non-blocking write and no backlog: a peer that is not
+// reading loses the reply rather than holding on to the connection.
+static void reject_connection(connection_t *conn, const char *status, const char *message) {
+    response_stats_reset();
+    response_set_backlog(NULL);
+#ifdef USE_SSL
+    if (conn->ssl) {
+        send_error_response_ssl(conn->ssl, status, message);
+    } else {
+        send_error_response(conn->fd, status, message);
+    }
+#else
+    send_error_response(conn->fd, status, message);
+#endif
+    log_rejection(conn);
+    close_connection(conn);
+}
+
+// Over the rate limit: 429 from the reactor, without involving a worker
+static void reject_limited(connection_t *conn, int retry_after) {
+    set_response_keep_alive(0);
+    response_stats_reset();
+    response_set_backlog(NULL);
+    send_retry_later_response(conn->fd, conn->ssl, HTTP_STATUS_429, "Too many requests",
+                              retry_after);
+    log_rejection(conn);
+    close_connection(conn);
+}
+
+// Hand the connection to the thread pool if a complete request is buffered.
+// Returns 1 when the connection left the reactor, 0 when more data is needed.
+static int try_dispatch(reactor_t *reactor, connection_t *conn) {
+    if (conn->buffer_len == 0) {
+        return 0;
+    }
+    request_trace_t *trace = &conn->trace;
+    if (trace->read_start_ns == 0) {
+        trace->read_start_ns = trace_now_ns();
+        if (trace->start_ns == 0) {
+            trace->start_ns = trace->read_start_ns;
+        }
+        TRACE_PROBE1(request_start, conn->fd);
+    }
+
+    // Charge each request to the client's buckets as its first bytes
+    // arrive, before any parsing; over the limit is answered right here
+    if (!conn->rate_charged && rate_limit_enabled()) {
+        conn->rate_charged = 1;
+        int retry_after = 1;
+        if (!rate_limit_allow(&conn->rate_key, &retry_after)) {
+            reject_limited(conn, retry_after);
+            return 1;
+        }
+    }
+
+    uint64_t parse_start = trace_now_ns();
+    int result = http_parser_execute(&conn->parser, conn->buffer, conn->buffer_len);
+    uint64_t parsed = trace_now_ns();
+    trace->phase_ns[PHASE_PARSE] += parsed - parse_start;
+    if (result == PARSE_INCOMPLETE) {
+        return 0;
+    }
+    if (result == PARSE_TOO_LARGE) {
+        reject_connection(conn, HTTP_STATUS_413, "Request too large");
+        return 1;
+    }
+    if (result == PARSE_FAILED) {
+        reject_connection(conn, HTTP_STATUS_400, "Invalid request format");
+        return 1;
+    }
+    conn->request_len = conn->parser.request_len;
+    trace->phase_ns[PHASE_READ] = parsed - trace->read_start_ns - trace->phase_ns[PHASE_PARSE];
+    TRACE_PROBE2(request_parsed, conn->fd, conn->request_len);
+
+    idle_unlink(reactor, conn);
+    conn->state = CONN_DISPATCHED;
+    if (reactor->inline_handlers) {
+        // Serve right here; the connection comes back through resume_connection,
+        // and whatever the socket does not take is sent on EPOLLOUT, so a
+        // slow reader never holds up the other connections on this core
+        handle_client_request(conn);
+        return 1;
+    }
+    if (add_client_to_pool((thread_pool_t*)reactor->pool, conn) != 0) {
+        shed_connection((thread_pool_t*)reactor->pool, conn);
+    }
+    // The worker owns the connection from here on
+    return 1;
+}
+
+// Drain the socket into the receive buffer until EAGAIN; hand the connection
+// to the thread pool once a complete request has been buffered
+static void read_request(reactor_t *reactor, connection_t *conn) {
+    // Pipelined bytes left over from the previous request
+    if (try_dispatch(reactor, conn)) {
+        return;
+    }
+
+    while (1) {
+        if (reserve_buffer(conn) != 0) {
+            reject_connection(conn, HTTP_STATUS_413, "Request too large");
+            return;
+        }
+
+        size_t space = conn->buffer_cap - conn->buffer_len - 1;
+        ssize_t bytes_read;
+#ifdef USE_SSL
+        if (conn->ssl) {
+            bytes_read = ssl_read((SSL*)conn->ssl, conn->buffer + conn->buffer_len, (int)space);
+        } else {
+            bytes_read = read(conn->fd, conn->buffer + conn->buffer_len, space);
+        }
+#else
+        bytes_read = read(conn->fd, conn->buffer + conn->buffer_len, space);
+#endif
+
+        if (bytes_read > 0) {
+            conn->buffer_len += bytes_read;
+            conn->buffer[conn->buffer_len] = '\0';
+
+            if (try_dispatch(reactor, conn)) {
+                return;
+            }
+            continue;
+        }
+
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (rearm_connection(conn, EPOLLIN) != 0) {
+                close_connection(conn);
+            }
+            return;
+        }
+
+        // Peer closed or read error
+        close_connection(conn);
+        return;
+    }
+}
+
+#ifdef USE_SSL
+// Step the TLS handshake; continue with the request once it completes
+static void continue_handshake(reactor_t *reactor, connection_t *conn) {
+    switch (ssl_handshake((SSL*)conn->ssl)) {
+        case SSL_HANDSHAKE_DONE:
+            conn->trace.phase_ns[PHASE_HANDSHAKE] = trace_now_ns() - conn->trace.mark_ns;
+            TRACE_PROBE2(tls_handshake, conn->fd, conn->trace.phase_ns[PHASE_HANDSHAKE]);
+            conn->state = CONN_READING;
+            read_request(reactor, conn);
+            break;
+        case SSL_HANDSHAKE_WANT_READ:
+            if (rearm_connection(conn, EPOLLIN) != 0) close_connection(conn);
+            break;
+        case SSL_HANDSHAKE_WANT_WRITE:
+            if (rearm_connection(conn, EPOLLOUT) != 0) close_connection(conn);
+            break;
+        default:
+            close_connection(conn);
+            break;
+    }
+}
+#endif
+
+// Peek at the first byte to tell a TLS ClientHello (0x16) from plain HTTP
+static void detect_protocol(reactor_t *reactor, connection_t *conn) {
+#ifdef USE_SSL
+    unsigned char first;
+    ssize_t peeked = recv(conn->fd, &first, 1, MSG_PEEK);
+
+    if (peeked < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        if (rearm_connection(conn, EPOLLIN) != 0) close_connection(conn);
+        return;
+    }
+    if (peeked <= 0) {
+        close_connection(conn);
+        return;
+    }
+
+    if (first == 0x16) {
+        conn->trace.mark_ns = trace_now_ns();
+        conn->ssl = create_ssl_connection(global_ssl_ctx, conn->fd);
+        if (!conn->ssl) {
+            close_connection(conn);
+            return;
+        }
+        conn->state = CONN_TLS_HANDSHAKE;
+        continue_handshake(reactor, conn);
+        return;
+    }
+#endif
+    conn->state = CONN_READING;
+    read_request(reactor, conn);
+}
+
+static void handle_connection_event(reactor_t *reactor, connection_t *conn, uint32_t events) {
+    if (events & EPOLLERR) {
+        close_connection(conn);
+        return;
+    }
+
+    // Any activity moves the connection to the back of the idle list
+    idle_unlink(reactor, conn);
+    idle_push(reactor, conn);
+
+    switch (conn->state) {
+        case CONN_DETECT:
+            detect_protocol(reactor, conn);
+            break;
+#ifdef USE_SSL
+        case CONN_TLS_HANDSHAKE:
+            continue_handshake(reactor, conn);
+            break;
+#endif
+        case CONN_READING:
+            read_request(reactor, conn);
+            break;
+        case CONN_WRITING:
+            write_backlog(reactor, conn);
+            break;
+        default:
+            break;
+    }
+}
+
+// Accept until the backlog is empty and register each socket with this reactor
+static void accept_connections(reactor_t *reactor) {
+    // Connections accepted later in a burst waited on the reactor meanwhile
+    uint64_t ready_ns = trace_now_ns();
+    while (1) {
+        struct sockaddr_storage peer;
+        int client_fd = create_client(reactor->listen_fd, &peer);
+        if (client_fd < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+
+        connection_t *conn = calloc(1, sizeof(connection_t));
+        if (!conn || arena_init(&conn->arena) != 0) {
+            free(conn);
+            close(client_fd);
+            continue;
+        }
+        conn->buffer = conn->arena.block->data;
+        conn->buffer_cap = conn->arena.bottom;
+        conn->buffer[0] = '\0';
+        conn->fd = client_fd;
+        conn->reactor = reactor;
+        conn->trace.start_ns = ready_ns;
+        conn->trace.phase_ns[PHASE_ACCEPT] = trace_now_ns() - ready_ns;
+        TRACE_PROBE2(conn_accept, client_fd, conn->trace.phase_ns[PHASE_ACCEPT]);
+        peer_addr_from((struct sockaddr *)&peer, &conn->peer);
+        rate_limit_key((struct sockaddr *)&peer, &conn->rate_key);
+        http_parser_init(&conn->parser);
+#ifdef USE_SSL
+        conn->state = global_ssl_ctx ? CONN_DETECT : CONN_READING;
+#else
+        conn->state = CONN_READING;
+#endif
+
+        idle_push(reactor, conn);
+        metrics_connection_opened();
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+        ev.data.ptr = conn;
+        if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) != 0) {
+            perror("epoll_ctl");
+            close_connection(conn);
+        }
+    }
+}
+
+// Called by a worker once a response is written or queued: give the
+// connection back to its reactor to send the rest of the response and
+// then wait for the next request (or close)
+void resume_connection(connection_t *conn) {
+    reactor_t *reactor = conn->reactor;
+
+    // Handlers run inline hand back to their own reactor without locking;
+    // it picks the connection up after the current event
+    if (reactor == current_reactor) {
+        conn->next = reactor->local_resume;
+        reactor->local_resume = conn;
+        return;
+    }
+
+    pthread_mutex_lock(&reactor->resume_mutex);
+    conn->next = reactor->resume_head;
+    reactor->resume_head = conn;
+    pthread_mutex_unlock(&reactor->resume_mutex);
+
+    uint64_t one = 1;
+    if (write(reactor->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        perror("eventfd write");
+    }
+}
+
+// Start reading the next request on a connection whose response is done.
+// What the socket has not taken yet goes out first, and the next request
+// waits until it has.
+static void requeue_connection(reactor_t *reactor, connection_t *conn) {
+    if (conn->backlog.head) {
+        conn->state = CONN_WRITING;
+        idle_push(reactor, conn);
+        write_backlog(reactor, conn);
+        return;
+    }
+    if (conn->close_after_write) {
+        close_connection(conn);
+        return;
+    }
+
+    // Drop the served request's views, keeping any pipelined bytes that
+    // followed it
+    arena_reset(&conn->arena);
+    size_t remaining = conn->buffer_len - conn->request_len;
+    memmove(conn->buffer, conn->buffer + conn->request_len, remaining);
+    conn->buffer_len = remaining;
+    conn->buffer[remaining] = '\0';
+    conn->request_len = 0;
+    conn->rate_charged = 0;
+    memset(&conn->trace, 0, sizeof(conn->trace));
+    http_parser_init(&conn->parser);
+
+    conn->state = CONN_READING;
+    idle_push(reactor, conn);
+
+    // TLS may already hold decrypted bytes that epoll cannot see, so try
+    // reading straight away instead of waiting for readiness
+    read_request(reactor, conn);
+}
+
+// Take back connections released by workers
+static void drain_resumed(reactor_t *reactor) {
+    uint64_t count;
+    while (read(reactor->wake_fd, &count, sizeof(count)) > 0) {
+    }
+
+    pthread_mutex_lock(&reactor->resume_mutex);
+    connection_t *conn = reactor->resume_head;
+    reactor->resume_head = NULL;
+    pthread_mutex_unlock(&reactor->resume_mutex);
+
+    while (conn) {
+        connection_t *next = conn->next;
+        requeue_connection(reactor, conn);
+        conn = next;
+    }
+}
+
+// Take back connections served inline. Serving a pipelined request may
+// release the connection again, so loop until the list stays empty.
+static void drain_local(reactor_t *reactor) {
+    while (reactor->local_resume) {
+        connection_t *conn = reactor->local_resume;
+        reactor->local_resume = NULL;
+        while (conn) {
+            connection_t *next = conn->next;
+            requeue_connection(reactor, conn);
+            conn = next;
+        }
+    }
+}
+
+// Close connections idle for longer than the keep-alive timeout
+static void sweep_idle(reactor_t *reactor) {
+    time_t now = monotonic_seconds();
+    if (now == reactor->last_sweep) {
+        return;
+    }
+    reactor->last_sweep = now;
+
+    while (reactor->idle_head &&
+           now - reactor->idle_head->last_active >= KEEPALIVE_TIMEOUT_SEC) {
+        close_connection(reactor->idle_head);
+    }
+}
+
+static void *reactor_thread(void *arg) {
+    reactor_t *reactor = (reactor_t *)arg;
+    struct epoll_event events[MAX_EVENTS];
+    current_reactor = reactor;
+
+    while (!loops_stopping) {
+        int n = epoll_wait(reactor->epoll_fd, events, MAX_EVENTS, 1000);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == &listener_tag) {
+                accept_connections(reactor);
+            } else if (events[i].data.ptr == &wake_tag) {
+                drain_resumed(reactor);
+            } else {
+                handle_connection_event(reactor, events[i].data.ptr, events[i].events);
+            }
+            drain_local(reactor);
+        }
+
+        sweep_idle(reactor);
+    }
+
+    return NULL;
+}
+
+// Start one reactor per core. By default every reactor accepts on the
+// shared listener; in SO_REUSEPORT mode listen_fd is the first of a group
+// and each further reactor binds its own, so the kernel spreads incoming
+// connections without any shared accept queue.
+int start_event_loops(int listen_fd, const event_loop_config_t *config, void *pool) {
+    int reactor_count = config->reactor_count;
+    if (reactor_count <= 0) {
+        reactor_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (reactor_count <= 0) reactor_count = 1;
+    }
+
+    reactors = calloc(reactor_count, sizeof(reactor_t));
+    if (!reactors) {
+        perror("Failed to allocate reactors");
+        return -1;
+    }
+
+    // Bind the whole group first: the steering program indexes listeners in
+    // bind order and must only see complete groups
+    for (int i = 0; i < reactor_count; i++) {
+        int fd = listen_fd;
+        if (config->reuseport && i > 0) {
+            fd = create_listener(config->reuseport);
+            if (fd < 0) {
+                return -1;
+            }
+        }
+        int flags = fcntl(fd, F_GETFL, 0);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+            perror("fcntl");
+            return -1;
+        }
+        reactors[i].listen_fd = fd;
+    }
+    if (config->reuseport && config->cpu_steering &&
+        attach_cpu_steering(listen_fd, reactor_count) != 0) {
+        printf("CPU steering unavailable; the kernel will hash connections instead\n");
+    }
+
+    for (int i = 0; i < reactor_count; i++) {
+        reactor_t *reactor = &reactors[i];
+        reactor->index = i;
+        reactor->pool = pool;
+        reactor->inline_handlers = config->inline_handlers;
+
+        reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (reactor->epoll_fd < 0) {
+            perror("epoll_create1");
+            return -1;
+        }
+
+        // A shared listener uses EPOLLEXCLUSIVE to wake a single reactor per
+        // incoming connection; a private one has only this reactor to wake
+        struct epoll_event ev;
+        ev.events = config->reuseport ? EPOLLIN : EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.ptr = &listener_tag;
+        if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->listen_fd, &ev) != 0) {
+            perror("epoll_ctl listener");
+            return -1;
+        }
+
+        reactor->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (reactor->wake_fd < 0) {
+            perror("eventfd");
+            return -1;
+        }
+        pthread_mutex_init(&reactor->resume_mutex, NULL);
+        ev.events = EPOLLIN;
+        ev.data.ptr = &wake_tag;
+        if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->wake_fd, &ev) != 0) {
+            perror("epoll_ctl eventfd");
+            return -1;
+        }
+
+        if (pthread_create(&reactor->thread, NULL, reactor_thread, reactor) != 0) {
+            perror("Failed to create reactor thread");
+            return -1;
+        }
+        reactor_total++;
+
+        // Pin each reactor to its own core
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(i % CPU_SETSIZE, &cpus);
+        pthread_setaffinity_np(reactor->thread, sizeof(cpus), &cpus);
+    }
+
+    printf("Started %d event loop(s)%s%s\n", reactor_total,
+           config->reuseport ? ", one SO_REUSEPORT listener each" : " on a shared listener",
+           config->inline_handlers ? ", serving inline" : "");
+    return 0;
+}
+
+// Ask every reactor to return; safe to call from a signal handler
+void stop_event_loops(void) {
+    loops_stopping = 1;
+    uint64_t one = 1;
+    for (int i = 0; i < reactor_total; i++) {
+        if (write(reactors[i].wake_fd, &one, sizeof(one)) < 0) {
+            // Full or closed: the reactor still sees the flag within a second
+        }
+    }
+}
+
+// Wait for the reactors to return. Their connections stay allocated and
+// workers may still hand some back, so nothing is freed until
+// close_event_loops.
+void wait_event_loops(void) {
+    for (int i = 0; i < reactor_total; i++) {
+        pthread_join(reactors[i].thread, NULL);
+    }
+}
+
+void close_event_loops(void) {
+    for (int i = 0; i < reactor_total; i++) {
+        close(reactors[i].epoll_fd);
+        close(reactors[i].wake_fd);
+        if (i > 0 && reactors[i].listen_fd != reactors[0].listen_fd) {
+            close(reactors[i].listen_fd);
+        }
+        pthread_mutex_destroy(&reactors[i].resume_mutex);
+    }
+    free(reactors);
+    reactors = NULL;
+    reactor_total = 0;
+}
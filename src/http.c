@@ -1,83 +1,110 @@
+#define _GNU_SOURCE
 #include "utils/http.h"
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <limits.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/random.h>
+#include "utils/static_cache.h"
+#include "utils/parse_req.h"
+#include <strings.h>
 
 #ifdef USE_SSL
 #include "utils/ssl.h"
 #endif
 
+// Connection handling for responses written by the current thread
+static __thread int response_keep_alive = 0;
+
+void set_response_keep_alive(int keep_alive) {
+    response_keep_alive = keep_alive;
+}
+
+int get_response_keep_alive(void) {
+    return response_keep_alive;
+}
+
+#define STRINGIFY(x) #x
+#define TO_STRING(x) STRINGIFY(x)
+
+// Connection (and Keep-Alive) header lines for the current response
+const char* connection_header(void) {
+    return response_keep_alive
+        ? "Connection: keep-alive\r\nKeep-Alive: timeout=" TO_STRING(KEEPALIVE_TIMEOUT_SEC) "\r\n"
+        : "Connection: close\r\n";
+}
+
 void send_http_response(int client_fd, const char *status, const char *content_type, const char *body) {
-    size_t body_len = body ? strlen(body) : 0;
-    
-    char response[4096] = {0};
-    snprintf(response, sizeof(response),
-             "%s\r\n"
-             "Content-Type: %s\r\n"
-             "Content-Length: %zu\r\n"
-             "\r\n",
-             status, content_type, body_len);
-    
-    // Send headers
-    write(client_fd, response, strlen(response));
-    
-    // Send body if present
-    if (body && body_len > 0) {
-        write(client_fd, body, body_len);
+    http_response_t resp;
+    response_init(&resp, status);
+    add_response_header(&resp, "Content-Type", content_type);
+    if (body) {
+        response_append_ref(&resp, body, strlen(body));
     }
+    
+    send_full_response(client_fd, NULL, &resp);
+    response_free(&resp);
 }
 
 void send_http_response_ssl(void *ssl, const char *status, const char *content_type, const char *body) {
-    size_t body_len = body ? strlen(body) : 0;
-    
-    char response[4096] = {0};
-    snprintf(response, sizeof(response),
-             "%s\r\n"
-             "Content-Type: %s\r\n"
-             "Content-Length: %zu\r\n"
-             "\r\n",
-             status, content_type, body_len);
-    
 #ifdef USE_SSL
-    // Send headers
-    ssl_write(ssl, response, strlen(response));
-    
-    // Send body if present
-    if (body && body_len > 0) {
-        ssl_write(ssl, body, body_len);
+    http_response_t resp;
+    response_init(&resp, status);
+    add_response_header(&resp, "Content-Type", content_type);
+    if (body) {
+        response_append_ref(&resp, body, strlen(body));
     }
+    
+    send_full_response(-1, ssl, &resp);
+    response_free(&resp);
 #else
     (void)ssl; // Suppress unused parameter warning
     (void)status;
     (void)content_type;
     (void)body;
-    (void)body_len;
-    (void)response;
 #endif
 }
 
+// Build an HTML error page for the given connection
+static void send_error_page(int client_fd, void *ssl, const char *status, const char *message) {
+    http_response_t resp;
+    response_init(&resp, status);
+    add_response_header(&resp, "Content-Type", CONTENT_TYPE_HTML);
+    response_appendf(&resp, "<html><body><h1>Error</h1><p>%s</p></body></html>",
+                     message ? message : "An error occurred");
+    
+    send_full_response(client_fd, ssl, &resp);
+    response_free(&resp);
+}
+
 void send_error_response(int client_fd, const char *status, const char *message) {
-    char error_body[512];
-    snprintf(error_body, sizeof(error_body), 
-             "<html><body><h1>Error</h1><p>%s</p></body></html>", 
-             message ? message : "An error occurred");
+    send_error_page(client_fd, NULL, status, message);
+}
+
+// Overload answers (429, 503): an error page plus when to retry
+void send_retry_later_response(int client_fd, void *ssl, const char *status,
+                               const char *message, int retry_after) {
+    http_response_t resp;
+    response_init(&resp, status);
+    add_response_header(&resp, "Content-Type", CONTENT_TYPE_HTML);
+    char value[16];
+    snprintf(value, sizeof(value), "%d", retry_after);
+    add_response_header(&resp, "Retry-After", value);
+    response_appendf(&resp, "<html><body><h1>Error</h1><p>%s</p></body></html>", message);
     
-    send_http_response(client_fd, status, CONTENT_TYPE_HTML, error_body);
+    send_full_response(client_fd, ssl, &resp);
+    response_free(&resp);
 }
 
 void send_error_response_ssl(void *ssl, const char *status, const char *message) {
-    char error_body[512];
-    snprintf(error_body, sizeof(error_body), 
-             "<html><body><h1>Error</h1><p>%s</p></body></html>", 
-             message ? message : "An error occurred");
-    
 #ifdef USE_SSL
-    send_http_response_ssl(ssl, status, CONTENT_TYPE_HTML, error_body);
+    send_error_page(-1, ssl, status, message);
 #else
     (void)ssl;
     (void)status;
     (void)message;
-    (void)error_body;
 #endif
 }
 
@@ -95,6 +122,148 @@ const char* get_content_type(const char *filename) {
     return CONTENT_TYPE_PLAIN;
 }
 
+// RFC 7231 IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+void format_http_date(time_t when, char *out, size_t size) {
+    struct tm tm;
+    gmtime_r(&when, &tm);
+    strftime(out, size, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+// Strong validator derived from inode, size and modification time
+void format_etag(const struct stat *st, char *out, size_t size) {
+    snprintf(out, size, "\"%lx-%lx-%lx.%lx\"",
+             (unsigned long)st->st_ino, (unsigned long)st->st_size,
+             (unsigned long)st->st_mtim.tv_sec, (unsigned long)st->st_mtim.tv_nsec);
+}
+
+// Does If-None-Match list this entity tag? Uses weak comparison (RFC 7232)
+static int etag_matches(const char *list, const char *etag) {
+    size_t etag_len = strlen(etag);
+    const char *p = list;
+    
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') p++;
+        if (*p == '*') return 1;
+        if (strncmp(p, "W/", 2) == 0) p += 2;
+        if (strncmp(p, etag, etag_len) == 0 &&
+            (p[etag_len] == '\0' || p[etag_len] == ',' || p[etag_len] == ' ')) {
+            return 1;
+        }
+        while (*p && *p != ',') p++;
+    }
+    return 0;
+}
+
+// Evaluate If-None-Match, falling back to If-Modified-Since when absent
+int request_not_modified(const http_request_t *req, const char *etag, time_t mtime) {
+    if (!req) return 0;
+    
+    const char *value = find_request_header(req, "If-None-Match");
+    if (value) {
+        return etag_matches(value, etag);
+    }
+    
+    value = find_request_header(req, "If-Modified-Since");
+    if (value) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char *end = strptime(value, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        if (end && *end == '\0') {
+            return mtime <= timegm(&tm);
+        }
+    }
+    return 0;
+}
+
+// Parse a decimal byte position; -1 on syntax error or overflow
+static off_t parse_byte_pos(const char **p) {
+    const char *s = *p;
+    off_t value = 0;
+    
+    if (*s < '0' || *s > '9') return -1;
+    while (*s >= '0' && *s <= '9') {
+        if (value > (LLONG_MAX - 9) / 10) return -1;
+        value = value * 10 + (*s - '0');
+        s++;
+    }
+    *p = s;
+    return value;
+}
+
+// Parse "bytes=first-last, first-, -suffix" against an entity of the given
+// size. Returns the number of satisfiable ranges stored (0: respond 416),
+// or -1 when the header must be ignored and the whole entity sent.
+int parse_range_header(const char *value, off_t size, byte_range_t *ranges, int max_ranges) {
+    if (strncasecmp(value, "bytes=", 6) != 0) return -1;
+    
+    const char *p = value + 6;
+    int specs = 0;
+    int count = 0;
+    off_t total = 0;
+    
+    for (;;) {
+        while (*p == ' ' || *p == '\t') p++;
+        
+        off_t first;
+        off_t last;
+        if (*p == '-') {
+            // Suffix range: the final N bytes
+            p++;
+            off_t suffix = parse_byte_pos(&p);
+            if (suffix < 0) return -1;
+            first = suffix >= size ? 0 : size - suffix;
+            last = suffix == 0 ? -1 : size - 1;
+        } else {
+            first = parse_byte_pos(&p);
+            if (first < 0 || *p++ != '-') return -1;
+            if (*p >= '0' && *p <= '9') {
+                last = parse_byte_pos(&p);
+                if (last < first) return -1;
+                if (last >= size) last = size - 1;
+            } else {
+                last = size - 1;
+            }
+        }
+        
+        if (++specs > max_ranges) return -1;
+        if (first < size && first <= last) {
+            ranges[count].first = first;
+            ranges[count].last = last;
+            total += last - first + 1;
+            count++;
+        }
+        
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '\0') break;
+        if (*p++ != ',') return -1;
+    }
+    
+    // Overlapping ranges would make us send more than the entity itself
+    if (count > 1 && total > size) return -1;
+    return count;
+}
+
+// Evaluate If-Range: a Range is only honored while the validator still
+// matches. Entity tags use strong comparison.
+int request_range_applies(const http_request_t *req, const char *etag, time_t mtime) {
+    const char *value = find_request_header(req, "If-Range");
+    if (!value) {
+        return 1;
+    }
+    
+    if (value[0] == '"') {
+        return strcmp(value, etag) == 0;
+    }
+    if (strncmp(value, "W/", 2) == 0) {
+        return 0;
+    }
+    
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(value, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return end && *end == '\0' && timegm(&tm) == mtime;
+}
+
 int is_supported_method(const char *method) {
     if (!method) return 0;
     
@@ -104,156 +273,242 @@ int is_supported_method(const char *method) {
             strcmp(method, HTTP_METHOD_DELETE) == 0);
 }
 
-// Handle GET request - serve static files
-int handle_get_request(int client_fd, void *ssl, const char *path) {
-    char full_path[512];
-    snprintf(full_path, sizeof(full_path), "src/static%s", path);
-    
-    // If root path, serve index.html
-    if (strcmp(path, "/") == 0) {
-        snprintf(full_path, sizeof(full_path), "src/static/index.html");
-    }
-
-    // Sanitize the file path to prevent directory traversal
-    char resolved_path[PATH_MAX];
-    if (realpath(full_path, resolved_path) == NULL) {
+static void send_static_error(int client_fd, void *ssl, const char *status, const char *message) {
 #ifdef USE_SSL
-        if (ssl) {
-            send_error_response_ssl(ssl, HTTP_STATUS_404, "File not found");
-        } else {
-            send_error_response(client_fd, HTTP_STATUS_404, "File not found");
-        }
+    if (ssl) {
+        send_error_response_ssl(ssl, status, message);
+    } else {
+        send_error_response(client_fd, status, message);
+    }
 #else
-        send_error_response(client_fd, HTTP_STATUS_404, "File not found");
+    (void)ssl;
+    send_error_response(client_fd, status, message);
 #endif
-        return -1;
+}
+
+// Serve a cached asset: pre-rendered headers plus body in one vectored write
+static void send_cached_asset(int client_fd, void *ssl, const static_asset_t *asset) {
+    http_response_t resp;
+    response_init(&resp, HTTP_STATUS_200);
+    response_add_headers(&resp, asset->headers, asset->headers_len);
+    response_append_ref(&resp, asset->data, asset->size);
+    
+    send_full_response(client_fd, ssl, &resp);
+    response_free(&resp);
+}
+
+// Answer a successful conditional GET: validators only, no body
+static void send_not_modified(int client_fd, void *ssl, const char *validators, size_t validators_len) {
+    http_response_t resp;
+    response_init(&resp, HTTP_STATUS_304);
+    response_add_headers(&resp, validators, validators_len);
+    
+    send_full_response(client_fd, ssl, &resp);
+    response_free(&resp);
+}
+
+// Where a static body comes from: cached bytes or an open file
+typedef struct {
+    const char *data;    // NULL when serving from file_fd
+    int file_fd;
+} body_source_t;
+
+// Queue bytes [offset, offset + len) of a static body without copying
+static void append_body_range(http_response_t *resp, const body_source_t *src, off_t offset, size_t len) {
+    if (src->data) {
+        response_append_ref(resp, src->data + offset, len);
+    } else {
+        response_append_file(resp, src->file_fd, offset, len);
     }
+}
 
-    // Verify the resolved path is within the static directory
-    char static_dir_abs[PATH_MAX];
-    if (realpath("src/static", static_dir_abs) == NULL) {
-#ifdef USE_SSL
-        if (ssl) {
-            send_error_response_ssl(ssl, HTTP_STATUS_500, "Internal server error");
-        } else {
-            send_error_response(client_fd, HTTP_STATUS_500, "Internal server error");
-        }
-#else
-        send_error_response(client_fd, HTTP_STATUS_500, "Internal server error");
-#endif
+// Pick the ranges to serve. Returns -1 to send the whole entity, 0 when
+// none is satisfiable, otherwise the number of ranges.
+static int select_ranges(const http_request_t *req, const char *etag, time_t mtime, off_t size, byte_range_t *ranges) {
+    const char *value = find_request_header(req, "Range");
+    if (!value) {
         return -1;
     }
-
-    if (strncmp(resolved_path, static_dir_abs, strlen(static_dir_abs)) != 0) {
-#ifdef USE_SSL
-        if (ssl) {
-            send_error_response_ssl(ssl, HTTP_STATUS_403, "Forbidden");
-        } else {
-            send_error_response(client_fd, HTTP_STATUS_403, "Forbidden");
-        }
-#else
-        send_error_response(client_fd, HTTP_STATUS_403, "Forbidden");
-#endif
+    if (!request_range_applies(req, etag, mtime)) {
         return -1;
     }
+    return parse_range_header(value, size, ranges, MAX_BYTE_RANGES);
+}
+
+static void send_range_not_satisfiable(int client_fd, void *ssl, off_t size) {
+    char content_range[64];
+    snprintf(content_range, sizeof(content_range), "bytes */%lld", (long long)size);
     
-    FILE *file = fopen(resolved_path, "rb");
-    if (!file) {
-#ifdef USE_SSL
-        if (ssl) {
-            send_error_response_ssl(ssl, HTTP_STATUS_404, "File not found");
-        } else {
-            send_error_response(client_fd, HTTP_STATUS_404, "File not found");
+    http_response_t resp;
+    response_init(&resp, HTTP_STATUS_416);
+    add_response_header(&resp, "Content-Range", content_range);
+    
+    send_full_response(client_fd, ssl, &resp);
+    response_free(&resp);
+}
+
+// Fresh multipart/byteranges boundary (32 hex digits) from the kernel's
+// random pool, so a file's contents can't be made to contain it. Should
+// the pool be unavailable, a process-wide counter and the clock keep
+// boundaries distinct at least.
+static void make_boundary(char *boundary, size_t size) {
+    static _Atomic uint64_t boundary_count = 0;
+    uint64_t bits[2];
+    if (getrandom(bits, sizeof(bits), GRND_NONBLOCK) != (ssize_t)sizeof(bits)) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        bits[0] = atomic_fetch_add_explicit(&boundary_count, 1, memory_order_relaxed);
+        bits[1] = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    }
+    snprintf(boundary, size, "%016llx%016llx", (unsigned long long)bits[0], (unsigned long long)bits[1]);
+}
+
+// Answer a Range request with 206: a single part directly, several as
+// multipart/byteranges. Cached bytes are referenced in place and file
+// ranges are sent from their offsets, so only the requested bytes move.
+static void send_ranges(int client_fd, void *ssl, const body_source_t *src, const byte_range_t *ranges, int count,
+                        off_t size, const char *content_type, const char *validators, size_t validators_len) {
+    char value[128];
+    http_response_t resp;
+    response_init(&resp, HTTP_STATUS_206);
+    
+    if (count == 1) {
+        add_response_header(&resp, "Content-Type", content_type);
+        snprintf(value, sizeof(value), "bytes %lld-%lld/%lld",
+                 (long long)ranges[0].first, (long long)ranges[0].last, (long long)size);
+        add_response_header(&resp, "Content-Range", value);
+        response_add_headers(&resp, validators, validators_len);
+        append_body_range(&resp, src, ranges[0].first, ranges[0].last - ranges[0].first + 1);
+    } else {
+        char boundary[40];
+        make_boundary(boundary, sizeof(boundary));
+        snprintf(value, sizeof(value), "multipart/byteranges; boundary=%s", boundary);
+        add_response_header(&resp, "Content-Type", value);
+        response_add_headers(&resp, validators, validators_len);
+        
+        for (int i = 0; i < count; i++) {
+            response_appendf(&resp,
+                             "\r\n--%s\r\n"
+                             "Content-Type: %s\r\n"
+                             "Content-Range: bytes %lld-%lld/%lld\r\n"
+                             "\r\n",
+                             boundary, content_type,
+                             (long long)ranges[i].first, (long long)ranges[i].last, (long long)size);
+            append_body_range(&resp, src, ranges[i].first, ranges[i].last - ranges[i].first + 1);
         }
-#else
-        send_error_response(client_fd, HTTP_STATUS_404, "File not found");
-#endif
-        return -1;
+        response_appendf(&resp, "\r\n--%s--\r\n", boundary);
+    }
+    
+    send_full_response(client_fd, ssl, &resp);
+    response_free(&resp);
+}
+
+// Serve a file too large for the cache straight from disk
+static void send_file(int client_fd, void *ssl, const static_asset_t *asset, const http_request_t *req) {
+    int file_fd = open(asset->resolved_path, O_RDONLY | O_CLOEXEC);
+    if (file_fd < 0) {
+        send_static_error(client_fd, ssl, HTTP_STATUS_404, "File not found");
+        return;
     }
     
     // Get file size
     struct stat st;
-    if (stat(resolved_path, &st) != 0) {
-        fclose(file);
-#ifdef USE_SSL
-        if (ssl) {
-            send_error_response_ssl(ssl, HTTP_STATUS_500, "Failed to get file info");
-        } else {
-            send_error_response(client_fd, HTTP_STATUS_500, "Failed to get file info");
-        }
-#else
-        send_error_response(client_fd, HTTP_STATUS_500, "Failed to get file info");
-#endif
-        return -1;
+    if (fstat(file_fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(file_fd);
+        send_static_error(client_fd, ssl, HTTP_STATUS_404, "File not found");
+        return;
     }
     
-    size_t file_size = st.st_size;
-    char *body = malloc(file_size);
-    if (!body) {
-        fclose(file);
-#ifdef USE_SSL
-        if (ssl) {
-            send_error_response_ssl(ssl, HTTP_STATUS_500, "Memory allocation failed");
-        } else {
-            send_error_response(client_fd, HTTP_STATUS_500, "Memory allocation failed");
-        }
-#else
-        send_error_response(client_fd, HTTP_STATUS_500, "Memory allocation failed");
-#endif
-        return -1;
-    }
+    // Validators come from the fresh fstat, not the cached metadata
+    char etag[64];
+    char last_modified[64];
+    char validators[256];
+    format_etag(&st, etag, sizeof(etag));
+    format_http_date(st.st_mtime, last_modified, sizeof(last_modified));
+    int validators_len = snprintf(validators, sizeof(validators),
+                                  "ETag: %s\r\nLast-Modified: %s\r\nCache-Control: %s\r\nAccept-Ranges: bytes\r\n",
+                                  etag, last_modified, asset->cache_control);
     
-    // Read file content
-    size_t bytes_read = fread(body, 1, file_size, file);
-    fclose(file);
+    body_source_t src = { NULL, file_fd };
+    byte_range_t ranges[MAX_BYTE_RANGES];
+    int count;
+    if (request_not_modified(req, etag, st.st_mtime)) {
+        send_not_modified(client_fd, ssl, validators, validators_len);
+    } else if ((count = select_ranges(req, etag, st.st_mtime, st.st_size, ranges)) == 0) {
+        send_range_not_satisfiable(client_fd, ssl, st.st_size);
+    } else if (count > 0) {
+        send_ranges(client_fd, ssl, &src, ranges, count, st.st_size, asset->content_type,
+                    validators, validators_len);
+    } else {
+        // The body length is the real file size, so binary bodies are not
+        // cut at a NUL
+        http_response_t resp;
+        response_init(&resp, HTTP_STATUS_200);
+        add_response_header(&resp, "Content-Type", asset->content_type);
+        response_add_headers(&resp, validators, validators_len);
+        response_append_file(&resp, file_fd, 0, st.st_size);
+        send_full_response(client_fd, ssl, &resp);
+        response_free(&resp);
+    }
+    close(file_fd);
+}
+
+// Handle GET request - serve static files from the asset cache, honoring
+// conditional and Range requests. Returns 0 once a response (including an error
+// response) has been sent.
+int handle_get_request(int client_fd, void *ssl, const char *path, const http_request_t *req) {
+    asset_status_t status;
+    static_asset_t *asset = static_cache_get(path, &status);
     
-    if (bytes_read != file_size) {
-        free(body);
-#ifdef USE_SSL
-        if (ssl) {
-            send_error_response_ssl(ssl, HTTP_STATUS_500, "Failed to read file");
+    if (!asset) {
+        if (status == ASSET_NOT_FOUND) {
+            send_static_error(client_fd, ssl, HTTP_STATUS_404, "File not found");
+        } else if (status == ASSET_FORBIDDEN) {
+            send_static_error(client_fd, ssl, HTTP_STATUS_403, "Forbidden");
         } else {
-            send_error_response(client_fd, HTTP_STATUS_500, "Failed to read file");
+            send_static_error(client_fd, ssl, HTTP_STATUS_500, "Internal server error");
         }
-#else
-        send_error_response(client_fd, HTTP_STATUS_500, "Failed to read file");
-#endif
-        return -1;
+        return 0;
     }
     
-    // Send response
-    const char *content_type = get_content_type(resolved_path);
-#ifdef USE_SSL
-    if (ssl) {
-        send_http_response_ssl(ssl, HTTP_STATUS_200, content_type, body);
+    if (status == ASSET_CACHED) {
+        byte_range_t ranges[MAX_BYTE_RANGES];
+        int count;
+        if (request_not_modified(req, asset->etag, asset->mtime)) {
+            send_not_modified(client_fd, ssl, asset->validators, asset->validators_len);
+        } else if ((count = select_ranges(req, asset->etag, asset->mtime, asset->size, ranges)) == 0) {
+            send_range_not_satisfiable(client_fd, ssl, asset->size);
+        } else if (count > 0) {
+            body_source_t src = { asset->data, -1 };
+            send_ranges(client_fd, ssl, &src, ranges, count, asset->size,
+                        asset->content_type, asset->validators, asset->validators_len);
+        } else {
+            send_cached_asset(client_fd, ssl, asset);
+        }
     } else {
-        send_http_response(client_fd, HTTP_STATUS_200, content_type, body);
+        send_file(client_fd, ssl, asset, req);
     }
-#else
-    send_http_response(client_fd, HTTP_STATUS_200, content_type, body);
-#endif
-    free(body);
+    static_cache_release(asset);
     
     return 0;
 }
 
+// JSON acknowledgement for the generic resource handlers
+static void send_resource_message(int client_fd, void *ssl, const char *status, const char *action, const char *path) {
+    http_response_t resp;
+    response_init(&resp, status);
+    add_response_header(&resp, "Content-Type", CONTENT_TYPE_JSON);
+    response_appendf(&resp, "{\"message\": \"Resource %s successfully\", \"path\": \"%s\"}", action, path);
+    
+    send_full_response(client_fd, ssl, &resp);
+    response_free(&resp);
+}
+
 // Handle POST request - create new resource
 int handle_post_request(int client_fd, void *ssl, const char *path) {
     // For now, just return a success response
     // In a real implementation, you'd parse the request body and create a resource
-    const char *response_body = "{\"message\": \"Resource created successfully\", \"path\": \"";
-    char full_response[1024];
-    snprintf(full_response, sizeof(full_response), "%s%s\"}", response_body, path);
-    
-#ifdef USE_SSL
-    if (ssl) {
-        send_http_response_ssl(ssl, HTTP_STATUS_201, CONTENT_TYPE_JSON, full_response);
-    } else {
-        send_http_response(client_fd, HTTP_STATUS_201, CONTENT_TYPE_JSON, full_response);
-    }
-#else
-    send_http_response(client_fd, HTTP_STATUS_201, CONTENT_TYPE_JSON, full_response);
-#endif
+    send_resource_message(client_fd, ssl, HTTP_STATUS_201, "created", path);
     return 0;
 }
 
@@ -261,20 +516,7 @@ int handle_post_request(int client_fd, void *ssl, const char *path) {
 int handle_put_request(int client_fd, void *ssl, const char *path) {
     // For now, just return a success response
     // In a real implementation, you'd parse the request body and update the resource
-    const char *response_body = "{\"message\": \"Resource updated successfully\", \"path\": \"";
-    char full_response[1024];
-    snprintf(full_response, sizeof(full_response), "%s%s\"}", response_body, path);
-    
-#ifdef USE_SSL
-    if (ssl) {
-        send_http_response_ssl(ssl, HTTP_STATUS_200, CONTENT_TYPE_JSON, full_response);
-    }
-    else {
-        send_http_response(client_fd, HTTP_STATUS_200, CONTENT_TYPE_JSON, full_response);
-    }
-#else
-    send_http_response(client_fd, HTTP_STATUS_200, CONTENT_TYPE_JSON, full_response);
-#endif
+    send_resource_message(client_fd, ssl, HTTP_STATUS_200, "updated", path);
     return 0;
 }
 
@@ -282,18 +524,12 @@ int handle_put_request(int client_fd, void *ssl, const char *path) {
 int handle_delete_request(int client_fd, void *ssl, const char *path) {
     // For now, just return a success response
     // In a real implementation, you'd actually delete the resource
-    const char *response_body = "{\"message\": \"Resource deleted successfully\", \"path\": \"";
-    char full_response[1024];
-    snprintf(full_response, sizeof(full_response), "%s%s\"}", response_body, path);
+    (void)path;
+    http_response_t resp;
+    response_init(&resp, HTTP_STATUS_204);
+    add_response_header(&resp, "Content-Type", CONTENT_TYPE_JSON);
     
-#ifdef USE_SSL
-    if (ssl) {
-        send_http_response_ssl(ssl, HTTP_STATUS_204, CONTENT_TYPE_JSON, NULL);
-    } else {
-        send_http_response(client_fd, HTTP_STATUS_204, CONTENT_TYPE_JSON, NULL);
-    }
-#else
-    send_http_response(client_fd, HTTP_STATUS_204, CONTENT_TYPE_JSON, NULL);
-#endif
+    send_full_response(client_fd, ssl, &resp);
+    response_free(&resp);
     return 0;
-} 
\ No newline at end of file
+}
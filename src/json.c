@@ -0,0 +1,615 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "utils/json.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Find the first byte in [p, end) a string scan has to stop at: a quote,
+// a backslash, a control character or a non-ASCII byte (which starts a
+// UTF-8 sequence to validate); returns end if none
+typedef const char *(*string_scan_fn)(const char *p, const char *end);
+
+static inline int is_string_stop(unsigned char c) {
+    return c == '"' || c == '\\' || c < 0x20 || c >= 0x80;
+}
+
+static const char *string_scan_scalar(const char *p, const char *end) {
+    while (p < end && !is_string_stop((unsigned char)*p)) p++;
+    return p;
+}
+
+// The vector scanners compare signed bytes, so "below 0x20" takes in
+// 0x80-0xFF as well: one compare for control and non-ASCII bytes
+#ifdef __SSE2__
+static const char *string_scan_sse2(const char *p, const char *end) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i space = _mm_set1_epi8(0x20);
+
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                                 _mm_cmpeq_epi8(chunk, backslash)),
+                                    _mm_cmplt_epi8(chunk, space));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return string_scan_scalar(p, end);
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static const char *string_scan_avx2(const char *p, const char *end) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i space = _mm256_set1_epi8(0x20);
+
+    while (end - p >= 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+        __m256i hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote),
+                                                       _mm256_cmpeq_epi8(chunk, backslash)),
+                                       _mm256_cmpgt_epi8(space, chunk));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(hits);
+        if (mask) return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    // Most keys and values are shorter than a vector; take a half step
+    // before going byte by byte
+    if (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm256_castsi256_si128(quote)),
+                                                 _mm_cmpeq_epi8(chunk, _mm256_castsi256_si128(backslash))),
+                                    _mm_cmplt_epi8(chunk, _mm256_castsi256_si128(space)));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return string_scan_scalar(p, end);
+}
+#endif
+
+// The same for output: the first byte json_escape has to rewrite, a
+// quote, a backslash or a control character. UTF-8 passes through.
+static inline int is_escape_stop(unsigned char c) {
+    return c == '"' || c == '\\' || c < 0x20;
+}
+
+static const char *escape_scan_scalar(const char *p, const char *end) {
+    while (p < end && !is_escape_stop((unsigned char)*p)) p++;
+    return p;
+}
+
+// Unsigned "at most 0x1F": the byte is unchanged by min(byte, 0x1F)
+#ifdef __SSE2__
+static const char *escape_scan_sse2(const char *p, const char *end) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                                 _mm_cmpeq_epi8(chunk, backslash)),
+                                    _mm_cmpeq_epi8(_mm_min_epu8(chunk, control), chunk));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return escape_scan_scalar(p, end);
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static const char *escape_scan_avx2(const char *p, const char *end) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1F);
+
+    while (end - p >= 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+        __m256i hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote),
+                                                       _mm256_cmpeq_epi8(chunk, backslash)),
+                                       _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, control), chunk));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(hits);
+        if (mask) return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    if (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm256_castsi256_si128(quote)),
+                                                 _mm_cmpeq_epi8(chunk, _mm256_castsi256_si128(backslash))),
+                                    _mm_cmpeq_epi8(_mm_min_epu8(chunk, _mm256_castsi256_si128(control)),
+                                                   chunk));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return escape_scan_scalar(p, end);
+}
+#endif
+
+static string_scan_fn string_scan = string_scan_scalar;
+static string_scan_fn escape_scan = escape_scan_scalar;
+
+// Pick the widest scanners the CPU supports
+__attribute__((constructor))
+static void select_scanners(void) {
+#ifdef __SSE2__
+    string_scan = string_scan_sse2;
+    escape_scan = escape_scan_sse2;
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        string_scan = string_scan_avx2;
+        escape_scan = escape_scan_avx2;
+    }
+#endif
+}
+
+static inline const char *skip_space(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) p++;
+    return p;
+}
+
+static inline int is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Length of the well-formed UTF-8 sequence at p, or 0 (overlong forms,
+// surrogates and code points past U+10FFFF are not well-formed)
+static int utf8_sequence(const unsigned char *p, const unsigned char *end) {
+    unsigned char c = p[0];
+    int len;
+    uint32_t cp;
+    if (c >= 0xC2 && c <= 0xDF) {
+        len = 2;
+        cp = c & 0x1F;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        len = 3;
+        cp = c & 0x0F;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        len = 4;
+        cp = c & 0x07;
+    } else {
+        return 0;
+    }
+    if (end - p < len) {
+        return 0;
+    }
+    for (int i = 1; i < len; i++) {
+        if ((p[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+        cp = cp << 6 | (p[i] & 0x3F);
+    }
+    if ((len == 3 && cp < 0x800) || (len == 4 && (cp < 0x10000 || cp > 0x10FFFF)) ||
+        (cp >= 0xD800 && cp <= 0xDFFF)) {
+        return 0;
+    }
+    return len;
+}
+
+// The four hex digits at p as a number, or -1
+static int hex4(const char *p, const char *end) {
+    if (end - p < 4) {
+        return -1;
+    }
+    int value = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        int digit;
+        if (c >= '0' && c <= '9') digit = c - '0';
+        else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+        else return -1;
+        value = value << 4 | digit;
+    }
+    return value;
+}
+
+// The code point of the \u escape at p (surrogate pairs taken together),
+// or -1; *len is set to the bytes it spans
+static long unicode_escape(const char *p, const char *end, int *len) {
+    int unit = hex4(p + 2, end);
+    if (unit < 0 || (unit >= 0xDC00 && unit <= 0xDFFF)) {
+        return -1;
+    }
+    *len = 6;
+    if (unit < 0xD800 || unit > 0xDBFF) {
+        return unit;
+    }
+    int low = end - p >= 12 && p[6] == '\\' && p[7] == 'u' ? hex4(p + 8, end) : -1;
+    if (low < 0xDC00 || low > 0xDFFF) {
+        return -1;
+    }
+    *len = 12;
+    return 0x10000 + ((long)(unit - 0xD800) << 10) + (low - 0xDC00);
+}
+
+static const char *fail(json_doc_t *doc, const char *at, const char *error) {
+    doc->error = error;
+    doc->error_offset = at - doc->json;
+    return NULL;
+}
+
+static int new_token(json_doc_t *doc, json_type_t type, const char *at) {
+    if (doc->count == doc->cap) {
+        return -1;
+    }
+    json_token_t *token = &doc->tape[doc->count];
+    token->offset = at - doc->json;
+    token->len = 0;
+    token->next = 0;
+    token->type = type;
+    token->escaped = 0;
+    return doc->count++;
+}
+
+// p is just past the opening quote; returns just past the closing one.
+// Runs of plain ASCII go by a vector at a time.
+static const char *parse_string(json_doc_t *doc, const char *p, const char *end, int *escaped) {
+    *escaped = 0;
+    for (;;) {
+        p = string_scan(p, end);
+        if (p == end) {
+            return fail(doc, p, "unterminated string");
+        }
+        unsigned char c = *p;
+        if (c == '"') {
+            return p + 1;
+        }
+        if (c == '\\') {
+            *escaped = 1;
+            char kind = end - p > 1 ? p[1] : '\0';
+            if (kind == 'u') {
+                int len;
+                if (unicode_escape(p, end, &len) < 0) {
+                    return fail(doc, p, "bad unicode escape");
+                }
+                p += len;
+            } else if (kind && strchr("\"\\/bfnrt", kind)) {
+                p += 2;
+            } else {
+                return fail(doc, p, "bad escape");
+            }
+            continue;
+        }
+        if (c < 0x20) {
+            return fail(doc, p, "control character in string");
+        }
+        int len = utf8_sequence((const unsigned char *)p, (const unsigned char *)end);
+        if (!len) {
+            return fail(doc, p, "invalid UTF-8");
+        }
+        p += len;
+    }
+}
+
+static const char *parse_number(json_doc_t *doc, const char *p, const char *end) {
+    const char *start = p;
+    if (p < end && *p == '-') p++;
+    if (p < end && *p == '0') {
+        p++;
+    } else if (p < end && is_digit(*p)) {
+        while (p < end && is_digit(*p)) p++;
+    } else {
+        return fail(doc, start, "bad number");
+    }
+    if (p < end && *p == '.') {
+        const char *digits = ++p;
+        while (p < end && is_digit(*p)) p++;
+        if (p == digits) {
+            return fail(doc, start, "bad number");
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) p++;
+        const char *digits = p;
+        while (p < end && is_digit(*p)) p++;
+        if (p == digits) {
+            return fail(doc, start, "bad number");
+        }
+    }
+    return p;
+}
+
+static const char *parse_value(json_doc_t *doc, const char *p, const char *end, int depth);
+
+// p is at the opening bracket; the container's token is already on the tape
+static const char *parse_container(json_doc_t *doc, const char *p, const char *end, int depth,
+                                   int token) {
+    int is_object = *p == '{';
+    char close = is_object ? '}' : ']';
+    const char *open = p;
+    if (depth >= JSON_MAX_DEPTH) {
+        return fail(doc, p, "nested too deeply");
+    }
+    p = skip_space(p + 1, end);
+    if (p < end && *p == close) {
+        p++;
+    } else {
+        for (;;) {
+            if (is_object) {
+                if (p == end || *p != '"') {
+                    return fail(doc, p, "expected a key");
+                }
+                if (!(p = parse_value(doc, p, end, depth + 1))) {
+                    return NULL;
+                }
+                p = skip_space(p, end);
+                if (p == end || *p != ':') {
+                    return fail(doc, p, "expected ':'");
+                }
+                p++;
+            }
+            if (!(p = parse_value(doc, p, end, depth + 1))) {
+                return NULL;
+            }
+            p = skip_space(p, end);
+            if (p < end && *p == ',') {
+                p = skip_space(p + 1, end);
+            } else if (p < end && *p == close) {
+                p++;
+                break;
+            } else {
+                return fail(doc, p, is_object ? "expected ',' or '}'" : "expected ',' or ']'");
+            }
+        }
+    }
+    doc->tape[token].len = p - open;
+    return p;
+}
+
+// Put the value at p (after any whitespace) on the tape; returns just past it
+static const char *parse_value(json_doc_t *doc, const char *p, const char *end, int depth) {
+    p = skip_space(p, end);
+    if (p == end) {
+        return fail(doc, p, "unexpected end of input");
+    }
+    json_type_t type;
+    switch (*p) {
+    case '{': type = JSON_OBJECT; break;
+    case '[': type = JSON_ARRAY; break;
+    case '"': type = JSON_STRING; break;
+    case 't': type = JSON_TRUE; break;
+    case 'f': type = JSON_FALSE; break;
+    case 'n': type = JSON_NULL; break;
+    default:
+        if (*p != '-' && !is_digit(*p)) {
+            return fail(doc, p, "unexpected character");
+        }
+        type = JSON_NUMBER;
+        break;
+    }
+    int token = new_token(doc, type, p);
+    if (token < 0) {
+        return fail(doc, p, "too many values");
+    }
+    const char *after;
+    if (type == JSON_OBJECT || type == JSON_ARRAY) {
+        after = parse_container(doc, p, end, depth, token);
+    } else if (type == JSON_STRING) {
+        int escaped;
+        after = parse_string(doc, p + 1, end, &escaped);
+        if (after) {
+            doc->tape[token].offset++;
+            doc->tape[token].len = after - p - 2;
+            doc->tape[token].escaped = escaped;
+        }
+    } else if (type == JSON_NUMBER) {
+        after = parse_number(doc, p, end);
+    } else {
+        const char *literal = type == JSON_TRUE ? "true" : type == JSON_FALSE ? "false" : "null";
+        size_t len = strlen(literal);
+        after = (size_t)(end - p) >= len && memcmp(p, literal, len) == 0 ? p + len
+                                                                        : fail(doc, p, "bad literal");
+    }
+    if (after && type != JSON_OBJECT && type != JSON_ARRAY && type != JSON_STRING) {
+        doc->tape[token].len = after - p;
+    }
+    doc->tape[token].next = doc->count;
+    return after;
+}
+
+// Parse one JSON value (with surrounding whitespace) into the tape.
+// Returns 0, or -1 with doc->error set.
+int json_parse(json_doc_t *doc, const char *json, size_t len, json_token_t *tape, int tape_cap) {
+    doc->json = json;
+    doc->tape = tape;
+    doc->count = 0;
+    doc->cap = tape_cap;
+    doc->error = NULL;
+    doc->error_offset = 0;
+    const char *end = json + len;
+    if (len > UINT32_MAX) {
+        fail(doc, json, "document too large");
+        return -1;
+    }
+    const char *p = parse_value(doc, json, end, 0);
+    if (!p) {
+        return -1;
+    }
+    p = skip_space(p, end);
+    if (p != end) {
+        fail(doc, p, "trailing characters");
+        return -1;
+    }
+    return 0;
+}
+
+// Decode a string token's contents into out, NUL-terminated. Returns the
+// length, or -1 if it does not fit or holds a NUL (\u0000).
+static int decode_string(const json_doc_t *doc, const json_token_t *token, char *out,
+                         size_t out_size) {
+    const char *p = doc->json + token->offset;
+    const char *end = p + token->len;
+    if (!token->escaped) {
+        if (token->len >= out_size) {
+            return -1;
+        }
+        memcpy(out, p, token->len);
+        out[token->len] = '\0';
+        return token->len;
+    }
+    size_t n = 0;
+    while (p < end) {
+        char c = *p;
+        if (c != '\\') {
+            if (n + 1 >= out_size) return -1;
+            out[n++] = c;
+            p++;
+            continue;
+        }
+        if (p[1] != 'u') {
+            if (n + 1 >= out_size) return -1;
+            switch (p[1]) {
+            case 'b': out[n++] = '\b'; break;
+            case 'f': out[n++] = '\f'; break;
+            case 'n': out[n++] = '\n'; break;
+            case 'r': out[n++] = '\r'; break;
+            case 't': out[n++] = '\t'; break;
+            default: out[n++] = p[1]; break;   // " \ /
+            }
+            p += 2;
+            continue;
+        }
+        // The tokenizer validated the escape
+        int len;
+        long cp = unicode_escape(p, end, &len);
+        p += len;
+        if (cp == 0) {
+            return -1;
+        }
+        int bytes = cp < 0x80 ? 1 : cp < 0x800 ? 2 : cp < 0x10000 ? 3 : 4;
+        if (n + bytes >= out_size) return -1;
+        if (bytes == 1) {
+            out[n++] = (char)cp;
+        } else if (bytes == 2) {
+            out[n++] = (char)(0xC0 | cp >> 6);
+            out[n++] = (char)(0x80 | (cp & 0x3F));
+        } else if (bytes == 3) {
+            out[n++] = (char)(0xE0 | cp >> 12);
+            out[n++] = (char)(0x80 | (cp >> 6 & 0x3F));
+            out[n++] = (char)(0x80 | (cp & 0x3F));
+        } else {
+            out[n++] = (char)(0xF0 | cp >> 18);
+            out[n++] = (char)(0x80 | (cp >> 12 & 0x3F));
+            out[n++] = (char)(0x80 | (cp >> 6 & 0x3F));
+            out[n++] = (char)(0x80 | (cp & 0x3F));
+        }
+    }
+    out[n] = '\0';
+    return (int)n;
+}
+
+static int key_equals(const json_doc_t *doc, const json_token_t *token, const char *key,
+                      size_t key_len) {
+    if (!token->escaped) {
+        return token->len == key_len && memcmp(doc->json + token->offset, key, key_len) == 0;
+    }
+    char decoded[64];
+    int len = decode_string(doc, token, decoded, sizeof(decoded));
+    return len >= 0 && (size_t)len == key_len && memcmp(decoded, key, key_len) == 0;
+}
+
+// Tape index of the value under key in an object token, or -1. Walks the
+// object's keys only, skipping nested values whole; the first of
+// duplicate keys wins.
+int json_object_get(const json_doc_t *doc, int object, const char *key) {
+    if (object < 0 || object >= doc->count || doc->tape[object].type != JSON_OBJECT) {
+        return -1;
+    }
+    size_t key_len = strlen(key);
+    int end = doc->tape[object].next;
+    for (int k = object + 1; k < end; k = doc->tape[k + 1].next) {
+        if (key_equals(doc, &doc->tape[k], key, key_len)) {
+            return k + 1;
+        }
+    }
+    return -1;
+}
+
+// Copy out a string value, unescaped. Returns its length, or -1 if the
+// token is not a string or does not fit in out_size (with the NUL).
+int json_get_string(const json_doc_t *doc, int token, char *out, size_t out_size) {
+    if (token < 0 || token >= doc->count || doc->tape[token].type != JSON_STRING) {
+        return -1;
+    }
+    return decode_string(doc, &doc->tape[token], out, out_size);
+}
+
+// A number that is a whole long; 0, or -1 if the token is anything else
+int json_get_int(const json_doc_t *doc, int token, long *out) {
+    if (token < 0 || token >= doc->count || doc->tape[token].type != JSON_NUMBER) {
+        return -1;
+    }
+    const json_token_t *t = &doc->tape[token];
+    char digits[32];
+    if (t->len >= sizeof(digits)) {
+        return -1;
+    }
+    memcpy(digits, doc->json + t->offset, t->len);
+    digits[t->len] = '\0';
+    char *end;
+    errno = 0;
+    long value = strtol(digits, &end, 10);
+    if (errno != 0 || *end != '\0') {
+        return -1;
+    }
+    *out = value;
+    return 0;
+}
+
+int json_get_bool(const json_doc_t *doc, int token, int *out) {
+    if (token < 0 || token >= doc->count ||
+        (doc->tape[token].type != JSON_TRUE && doc->tape[token].type != JSON_FALSE)) {
+        return -1;
+    }
+    *out = doc->tape[token].type == JSON_TRUE;
+    return 0;
+}
+
+// Write in as the contents of a JSON string (no quotes) to out, which has
+// room for JSON_ESCAPED_MAX(len) bytes. Returns the bytes written. Runs
+// that need no escaping are found a vector at a time and copied whole.
+size_t json_escape(const char *in, size_t len, char *out) {
+    static const char hex[] = "0123456789abcdef";
+    const char *p = in;
+    const char *end = in + len;
+    char *o = out;
+    while (p < end) {
+        const char *stop = escape_scan(p, end);
+        memcpy(o, p, stop - p);
+        o += stop - p;
+        if (stop == end) {
+            break;
+        }
+        unsigned char c = *stop;
+        p = stop + 1;
+        *o++ = '\\';
+        switch (c) {
+        case '"': *o++ = '"'; break;
+        case '\\': *o++ = '\\'; break;
+        case '\b': *o++ = 'b'; break;
+        case '\f': *o++ = 'f'; break;
+        case '\n': *o++ = 'n'; break;
+        case '\r': *o++ = 'r'; break;
+        case '\t': *o++ = 't'; break;
+        default:
+            memcpy(o, "u00", 3);
+            o[3] = hex[c >> 4];
+            o[4] = hex[c & 0xF];
+            o += 5;
+            break;
+        }
+    }
+    return o - out;
+}
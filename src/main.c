@@ -10,6 +10,11 @@
 #include "utils/client.h"
 #include <signal.h>
 #include "utils/ssl.h"
+#include "utils/event_loop.h"
+#include "utils/static_cache.h"
+#include "utils/rate_limit.h"
+#include "utils/access_log.h"
+#include "utils/user_store.h"
 
 // Forward declaration
 void init_metrics(void);
@@ -18,29 +23,69 @@ void init_metrics(void);
 thread_pool_t *global_pool = NULL;
 ssl_config_t ssl_config = {0};
 
-// Signal handler for graceful shutdown
+// Integer setting from the environment, or fallback when unset
+static int env_int(const char *name, int fallback) {
+   const char *value = getenv(name);
+   if (!value || !*value) {
+       return fallback;
+   }
+   return atoi(value);
+}
+
+// Signal that asked for shutdown, 0 while running
+static volatile sig_atomic_t shutdown_signal = 0;
+
+// Signal handler for graceful shutdown: only async-signal-safe work here.
+// It stops the event loops, and main tears the rest down once they have
+// returned. A second signal terminates at once.
 void signal_handler(int sig) {
-    printf("\nReceived signal %d, shutting down gracefully...\n", sig);
-    if (global_pool) {
-        destroy_thread_pool(global_pool);
-    }
-#ifdef USE_SSL
-    if (ssl_config.ssl_enabled) {
-        cleanup_ssl(&ssl_config);
-    }
-#endif
-    exit(0);
+    shutdown_signal = sig;
+    signal(sig, SIG_DFL);
+    stop_event_loops();
 }
 
 int main()
 {
    setvbuf(stdout, NULL, _IONBF, 0);
    
-   // Set up signal handler for graceful shutdown
+   // Set up signal handler for graceful shutdown; a peer that resets a
+   // connection mid-write shows up as EPIPE rather than a signal
    signal(SIGINT, signal_handler);
    signal(SIGTERM, signal_handler);
+   signal(SIGPIPE, SIG_IGN);
    
-   int server_fd = init_server(3000);
+   // Listener and reactor layout:
+   //   SERVER_REACTORS      event loops to run (default: one per CPU)
+   //   SERVER_BACKLOG       listen() backlog (default: SOMAXCONN)
+   //   SERVER_REUSEPORT     1 = one SO_REUSEPORT listener per event loop,
+   //                        cpu = the same, steered to the receiving CPU
+   //   SERVER_DEFER_ACCEPT  seconds to wait for the first request bytes
+   //   SERVER_FASTOPEN      TCP Fast Open queue length
+   //   SERVER_INLINE        1 = serve requests on the event loops
+   listen_options_t listen_opts = {0};
+   listen_opts.port = 3000;
+   listen_opts.backlog = env_int("SERVER_BACKLOG", 0);
+   listen_opts.defer_accept = env_int("SERVER_DEFER_ACCEPT", 0);
+   listen_opts.fastopen = env_int("SERVER_FASTOPEN", 0);
+
+   event_loop_config_t loop_config = {0};
+   loop_config.reactor_count = env_int("SERVER_REACTORS", 0);
+   loop_config.inline_handlers = env_int("SERVER_INLINE", 0);
+   const char *reuseport = getenv("SERVER_REUSEPORT");
+   if (reuseport && strcmp(reuseport, "cpu") == 0) {
+       loop_config.cpu_steering = 1;
+       listen_opts.reuseport = 1;
+   } else if (reuseport && atoi(reuseport) > 0) {
+       listen_opts.reuseport = 1;
+   }
+   if (listen_opts.reuseport) {
+       loop_config.reuseport = &listen_opts;
+   }
+
+   int server_fd = create_listener(&listen_opts);
+   if (server_fd < 0) {
+       return 1;
+   }
    printf("Server started on port 3000\n");
    
    // Initialize SSL if certificate files exist
@@ -67,11 +112,16 @@ int main()
    ssl_config.ssl_enabled = 0;
 #endif
    
-   // Create thread pool (4 threads, queue size of 20)
+   // Create thread pool; it grows from SERVER_POOL_MIN up to SERVER_POOL_MAX
+   // workers under load, each with a deque of SERVER_QUEUE_SIZE requests
+   int pool_min = env_int("SERVER_POOL_MIN", 4);
+   int pool_max = env_int("SERVER_POOL_MAX", pool_min * 4);
+   int queue_size = env_int("SERVER_QUEUE_SIZE", 20);
 #ifdef USE_SSL
-   global_pool = create_thread_pool(4, 20, ssl_config.ssl_enabled ? ssl_config.ctx : NULL);
+   global_pool = create_thread_pool(pool_min, pool_max, queue_size,
+                                    ssl_config.ssl_enabled ? ssl_config.ctx : NULL);
 #else
-   global_pool = create_thread_pool(4, 20, NULL);
+   global_pool = create_thread_pool(pool_min, pool_max, queue_size, NULL);
 #endif
    if (!global_pool) {
        perror("Failed to create thread pool");
@@ -82,50 +132,119 @@ int main()
    // Initialize server metrics
    init_metrics();
 
+   // User store behind /api/users, in memory unless SERVER_DATA_DIR is set:
+   //   SERVER_DATA_DIR            directory for the WAL and snapshots
+   //   SERVER_WAL_SYNC            always (default): a write returns once it
+   //                              is on disk, with concurrent writers sharing
+   //                              one fdatasync; interval: synced every flush
+   //                              interval; none: never synced
+   //   SERVER_WAL_FLUSH_MS        flush interval for interval and none
+   //   SERVER_SNAPSHOT_WAL_MB     snapshot once the WAL grows past this
+   //   SERVER_SNAPSHOT_INTERVAL   ...or this many seconds after the last one
+   user_store_persist_t persist = {0};
+   persist.dir = getenv("SERVER_DATA_DIR");
+   const char *wal_sync = getenv("SERVER_WAL_SYNC");
+   if (wal_sync && wal_parse_sync(wal_sync, &persist.wal.sync) != 0) {
+       printf("Ignoring invalid SERVER_WAL_SYNC\n");
+   }
+   persist.wal.flush_interval_ms = env_int("SERVER_WAL_FLUSH_MS", WAL_FLUSH_INTERVAL_MS);
+   persist.snapshot_bytes = (size_t)env_int("SERVER_SNAPSHOT_WAL_MB", 0) * 1024 * 1024;
+   persist.snapshot_interval_sec = env_int("SERVER_SNAPSHOT_INTERVAL", USER_SNAPSHOT_INTERVAL_SEC);
+   if (user_store_open(&persist) != 0) {
+       fprintf(stderr, "Failed to open user store\n");
+       close(server_fd);
+       return 1;
+   }
+   if (persist.dir) {
+       user_store_persist_stats_t persist_stats;
+       user_store_get_persist_stats(&persist_stats);
+       printf("User store: %llu users recovered from %s in %llu ms (%llu WAL records), sync %s\n",
+              (unsigned long long)persist_stats.recovered_users, persist.dir,
+              (unsigned long long)persist_stats.recovery_ms,
+              (unsigned long long)persist_stats.replayed_records,
+              wal_sync_name(persist_stats.sync));
+   }
+
+   // Access log, written in batches by a background thread:
+   //   SERVER_ACCESS_LOG         file to append to, "-" for stdout, "off"
+   //   SERVER_ACCESS_LOG_SAMPLE  log 1 in N successful requests
+   //   SERVER_DEBUG              1 = per-request debug output as well
+   debug_logging = env_int("SERVER_DEBUG", 0);
+   const char *access_log_path = getenv("SERVER_ACCESS_LOG");
+   if (!access_log_path || strcmp(access_log_path, "off") != 0) {
+       access_log_config_t log_config = {0};
+       log_config.path = access_log_path;
+       log_config.sample_every = (unsigned)env_int("SERVER_ACCESS_LOG_SAMPLE", 1);
+       if (access_log_start(&log_config) != 0) {
+           printf("Access log unavailable\n");
+       }
+   }
+
+   // Per-client token buckets, checked on the event loops before parsing:
+   //   SERVER_RATE_LIMIT          "rate[:burst]" requests/s per address
+   //   SERVER_RATE_LIMIT_PREFIX   the same per IPv4 /24 or IPv6 /64
+   //   SERVER_RATE_LIMIT_ENTRIES  buckets tracked before recycling
+   rate_limit_config_t rate_config = {0};
+   const char *host_rule = getenv("SERVER_RATE_LIMIT");
+   const char *prefix_rule = getenv("SERVER_RATE_LIMIT_PREFIX");
+   if (host_rule && rate_limit_parse_rule(host_rule, &rate_config.host) != 0) {
+       printf("Ignoring invalid SERVER_RATE_LIMIT\n");
+   }
+   if (prefix_rule && rate_limit_parse_rule(prefix_rule, &rate_config.prefix) != 0) {
+       printf("Ignoring invalid SERVER_RATE_LIMIT_PREFIX\n");
+   }
+   rate_config.max_entries = env_int("SERVER_RATE_LIMIT_ENTRIES", RATE_LIMIT_DEFAULT_ENTRIES);
+   if (rate_limit_init(&rate_config) != 0) {
+       printf("Rate limiting unavailable\n");
+   }
+
+   // Static assets are cached in memory and invalidated on change;
+   // STATIC_CACHE_CONTROL overrides Cache-Control, e.g. ".html=no-store"
+   const char *cache_control = getenv("STATIC_CACHE_CONTROL");
+   if (cache_control && static_cache_parse_cache_control(cache_control) != 0) {
+       printf("Ignoring invalid STATIC_CACHE_CONTROL\n");
+   }
+   if (static_cache_init("src/static", STATIC_CACHE_BUDGET) != 0) {
+       printf("Static file cache unavailable\n");
+   }
+
    printf("Multi-threaded HTTP server ready to accept connections...\n");
    printf("Available endpoints:\n");
    printf("  GET  /                    - Serve static files\n");
    printf("  GET  /health              - Health check\n");
    printf("  GET  /metrics             - Server metrics\n");
-   printf("  GET  /api/users           - List all users\n");
+   printf("  GET  /debug/slow          - Slowest recent requests by phase\n");
+   printf("  GET  /api/users           - List all users (?limit=&after= for pages)\n");
    printf("  GET  /api/users/{id}      - Get specific user\n");
    printf("  POST /api/users           - Create new user\n");
    printf("  PUT  /api/users/{id}      - Update user\n");
    printf("  DELETE /api/users/{id}    - Delete user\n");
 
-   while(1)
-   {
-       //create client socket and accept
-       int client_fd = create_client(server_fd);
-
-       if (client_fd < 0)
-       {
-          perror("accept");
-          continue;
-       }
-       
-       // Don't create SSL connection here - let the client handler detect HTTP vs HTTPS
-       void *ssl = NULL;
-       
-       // Add client to thread pool instead of handling directly
-       if (add_client_to_pool(global_pool, client_fd, ssl) != 0) {
-           printf("Failed to add client to thread pool, closing connection\n");
-#ifdef USE_SSL
-           if (ssl) {
-               close_ssl_connection((SSL*)ssl);
-           } else {
-               close(client_fd);
-           }
-#else
-           close(client_fd);
-#endif
-       }
+   // Reactors own accept/read readiness; workers only see complete requests
+   if (start_event_loops(server_fd, &loop_config, global_pool) != 0) {
+       fprintf(stderr, "Failed to start event loops\n");
+       destroy_thread_pool(global_pool);
+       close(server_fd);
+       return 1;
+   }
+   wait_event_loops();
+   if (shutdown_signal) {
+       printf("\nReceived signal %d, shutting down gracefully...\n", (int)shutdown_signal);
    }
 
-   // Cleanup (this won't be reached in normal operation due to signal handler)
-   if (global_pool) {
-       destroy_thread_pool(global_pool);
+   // Workers finish the requests they hold and may still hand connections
+   // back, so the reactors' state is freed only after the pool is gone;
+   // the store closes once nothing can write to it
+   destroy_thread_pool(global_pool);
+   global_pool = NULL;
+   close_event_loops();
+   access_log_stop();
+   user_store_close();
+#ifdef USE_SSL
+   if (ssl_config.ssl_enabled) {
+       cleanup_ssl(&ssl_config);
    }
+#endif
    close(server_fd);
    
    return 0;
@@ -0,0 +1,208 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "utils/metrics.h"
+
+// One thread's counters. Only the owner writes them, with plain relaxed
+// stores (no locked instructions); readers sum all shards. Each shard
+// starts on its own cache line so writers never share one.
+typedef struct metrics_shard {
+    _Atomic uint64_t requests[ROUTE_COUNT][STATUS_CLASS_COUNT];
+    _Atomic uint64_t bytes_in;
+    _Atomic uint64_t bytes_out;
+    _Atomic uint64_t connections_opened;
+    _Atomic uint64_t connections_closed;
+    _Atomic uint64_t latency_sum_us[ROUTE_COUNT][STATUS_CLASS_COUNT];
+    _Atomic uint64_t latency[ROUTE_COUNT][STATUS_CLASS_COUNT][METRICS_BUCKETS];
+    _Atomic uint64_t phase_sum_us[PHASE_COUNT];
+    _Atomic uint64_t phases[PHASE_COUNT][METRICS_BUCKETS];
+    _Atomic int released;
+    struct metrics_shard *next;
+} __attribute__((aligned(64))) metrics_shard_t;
+
+static _Atomic(metrics_shard_t *) shards = NULL;
+static pthread_mutex_t shards_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t shard_key;
+static __thread metrics_shard_t *thread_shard = NULL;
+
+static const char *route_names[ROUTE_COUNT] = {
+    "health", "metrics", "users", "static", "other"
+};
+
+// Thread exit: the counts stay in the totals and a later thread continues
+// from them
+static void release_shard(void *arg) {
+    atomic_store(&((metrics_shard_t *)arg)->released, 1);
+}
+
+static void create_shard_key(void) {
+    pthread_key_create(&shard_key, release_shard);
+}
+
+static metrics_shard_t *get_thread_shard(void) {
+    if (thread_shard) {
+        return thread_shard;
+    }
+    pthread_once(&shard_key_once, create_shard_key);
+
+    pthread_mutex_lock(&shards_mutex);
+    metrics_shard_t *shard;
+    for (shard = atomic_load(&shards); shard; shard = shard->next) {
+        int released = 1;
+        if (atomic_compare_exchange_strong(&shard->released, &released, 0)) {
+            break;
+        }
+    }
+    if (!shard) {
+        shard = aligned_alloc(64, sizeof(metrics_shard_t));
+        if (shard) {
+            memset(shard, 0, sizeof(*shard));
+            shard->next = atomic_load(&shards);
+            atomic_store(&shards, shard);
+        }
+    }
+    pthread_mutex_unlock(&shards_mutex);
+
+    if (shard) {
+        pthread_setspecific(shard_key, shard);
+        thread_shard = shard;
+    }
+    return shard;
+}
+
+static inline void shard_add(_Atomic uint64_t *counter, uint64_t n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+static int bucket_index(uint64_t value) {
+    if (value < METRICS_SUB_BUCKETS) {
+        return (int)value;
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    if (exponent > METRICS_MAX_EXPONENT) {
+        return METRICS_BUCKETS - 1;
+    }
+    int sub = (int)(value >> (exponent - METRICS_SUB_BITS)) & (METRICS_SUB_BUCKETS - 1);
+    return (exponent - METRICS_SUB_BITS + 1) * METRICS_SUB_BUCKETS + sub;
+}
+
+// Largest value that falls in a bucket
+static uint64_t bucket_upper(int index) {
+    if (index < METRICS_SUB_BUCKETS) {
+        return (uint64_t)index;
+    }
+    int exponent = index / METRICS_SUB_BUCKETS + METRICS_SUB_BITS - 1;
+    uint64_t sub = (uint64_t)(index % METRICS_SUB_BUCKETS);
+    uint64_t width = 1ULL << (exponent - METRICS_SUB_BITS);
+    return ((METRICS_SUB_BUCKETS + sub) << (exponent - METRICS_SUB_BITS)) + width - 1;
+}
+
+static int status_class(int status) {
+    int class = status / 100 - 1;
+    if (class < 0 || class >= STATUS_CLASS_COUNT) {
+        class = 4;   // no status written counts as a server error
+    }
+    return class;
+}
+
+void metrics_record_request(metrics_route_t route, int status, size_t bytes_in,
+                            size_t bytes_out, uint64_t latency_ns) {
+    metrics_shard_t *shard = get_thread_shard();
+    if (!shard) return;
+
+    int class = status_class(status);
+    uint64_t latency_us = latency_ns / 1000;
+    shard_add(&shard->requests[route][class], 1);
+    shard_add(&shard->bytes_in, bytes_in);
+    shard_add(&shard->bytes_out, bytes_out);
+    shard_add(&shard->latency_sum_us[route][class], latency_us);
+    shard_add(&shard->latency[route][class][bucket_index(latency_us)], 1);
+}
+
+// Time spent in each phase of a request; phases that did not apply to it
+// (no handshake, served inline, ...) are zero and left out
+void metrics_record_phases(const request_trace_t *trace) {
+    metrics_shard_t *shard = get_thread_shard();
+    if (!shard) return;
+
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        if (trace->phase_ns[p] == 0) continue;
+        uint64_t us = trace->phase_ns[p] / 1000;
+        shard_add(&shard->phase_sum_us[p], us);
+        shard_add(&shard->phases[p][bucket_index(us)], 1);
+    }
+}
+
+void metrics_connection_opened(void) {
+    metrics_shard_t *shard = get_thread_shard();
+    if (shard) shard_add(&shard->connections_opened, 1);
+}
+
+void metrics_connection_closed(void) {
+    metrics_shard_t *shard = get_thread_shard();
+    if (shard) shard_add(&shard->connections_closed, 1);
+}
+
+void metrics_get_totals(metrics_totals_t *totals) {
+    memset(totals, 0, sizeof(*totals));
+    for (metrics_shard_t *shard = atomic_load(&shards); shard; shard = shard->next) {
+        for (int r = 0; r < ROUTE_COUNT; r++) {
+            for (int c = 0; c < STATUS_CLASS_COUNT; c++) {
+                totals->requests[r][c] += atomic_load_explicit(&shard->requests[r][c], memory_order_relaxed);
+            }
+        }
+        totals->bytes_in += atomic_load_explicit(&shard->bytes_in, memory_order_relaxed);
+        totals->bytes_out += atomic_load_explicit(&shard->bytes_out, memory_order_relaxed);
+        totals->connections_opened += atomic_load_explicit(&shard->connections_opened, memory_order_relaxed);
+        totals->connections_closed += atomic_load_explicit(&shard->connections_closed, memory_order_relaxed);
+    }
+}
+
+static void merge_histogram(latency_histogram_t *hist, _Atomic uint64_t *buckets,
+                            _Atomic uint64_t *sum_us) {
+    hist->sum_us += atomic_load_explicit(sum_us, memory_order_relaxed);
+    for (int i = 0; i < METRICS_BUCKETS; i++) {
+        uint64_t n = atomic_load_explicit(&buckets[i], memory_order_relaxed);
+        hist->buckets[i] += n;
+        hist->count += n;
+    }
+}
+
+void metrics_get_histogram(metrics_route_t route, int status_class, latency_histogram_t *hist) {
+    memset(hist, 0, sizeof(*hist));
+    for (metrics_shard_t *shard = atomic_load(&shards); shard; shard = shard->next) {
+        merge_histogram(hist, shard->latency[route][status_class],
+                        &shard->latency_sum_us[route][status_class]);
+    }
+}
+
+void metrics_get_phase_histogram(trace_phase_t phase, latency_histogram_t *hist) {
+    memset(hist, 0, sizeof(*hist));
+    for (metrics_shard_t *shard = atomic_load(&shards); shard; shard = shard->next) {
+        merge_histogram(hist, shard->phases[phase], &shard->phase_sum_us[phase]);
+    }
+}
+
+// Latency in microseconds at or below which the given share of requests fall
+uint64_t metrics_percentile(const latency_histogram_t *hist, double quantile) {
+    if (hist->count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(quantile * (double)hist->count + 0.5);
+    if (rank < 1) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < METRICS_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank) {
+            return bucket_upper(i);
+        }
+    }
+    return bucket_upper(METRICS_BUCKETS - 1);
+}
+
+const char *metrics_route_name(metrics_route_t route) {
+    return route_names[route];
+}
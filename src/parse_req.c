@@ -1,106 +1,465 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include "utils/parse_req.h"
+#include "utils/event_loop.h"
 
-int parse_request(const char *buffer, char *method, size_t msize, char *path, size_t psize)
-{   
-    char fmt[32];
-    snprintf(fmt, sizeof(fmt), "%%%zus %%%zus", msize-1, psize-1);
-    return sscanf(buffer, fmt, method, path) == 2;
-}
-
-int parse_full_request(const char *buffer, http_request_t *req) {
-    if (!buffer || !req) return 0;
-    
-    // Clear the request structure
-    memset(req, 0, sizeof(http_request_t));
-    
-    // Find the end of the first line (request line)
-    const char *end_of_line = strstr(buffer, "\r\n");
-    if (!end_of_line) return 0;
-    
-    // Parse request line: METHOD URI HTTP_VERSION
-    char uri[512];
-    char http_version[32];
-    
-    if (sscanf(buffer, "%15s %511s %31s", req->method, uri, http_version) != 3) {
-        return 0;
-    }
-    
-    // Extract path and query string from URI
-    if (!extract_path_and_query(uri, req->path, sizeof(req->path), 
-                               req->query_string, sizeof(req->query_string))) {
-        return 0;
-    }
-    
-    // Find headers section
-    const char *headers_start = end_of_line + 2;
-    const char *body_start = strstr(headers_start, "\r\n\r\n");
-    
-    if (body_start) {
-        // Parse headers
-        size_t headers_len = body_start - headers_start;
-        if (headers_len < sizeof(req->headers)) {
-            strncpy(req->headers, headers_start, headers_len);
-            req->headers[headers_len] = '\0';
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Find the first byte equal to a or b in [p, end); returns end if none
+typedef const char *(*scan_fn)(const char *p, const char *end, char a, char b);
+
+static const char *scan2_scalar(const char *p, const char *end, char a, char b) {
+    while (p < end && *p != a && *p != b) p++;
+    return p;
+}
+
+#ifdef __SSE2__
+static const char *scan2_sse2(const char *p, const char *end, char a, char b) {
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return scan2_scalar(p, end, a, b);
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static const char *scan2_avx2(const char *p, const char *end, char a, char b) {
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+
+    while (end - p >= 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+        __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, va), _mm256_cmpeq_epi8(chunk, vb));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(hits);
+        if (mask) return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return scan2_scalar(p, end, a, b);
+}
+#endif
+
+static scan_fn scan2 = scan2_scalar;
+
+// Pick the widest scanner the CPU supports
+__attribute__((constructor))
+static void select_scanner(void) {
+#ifdef __SSE2__
+    scan2 = scan2_sse2;
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        scan2 = scan2_avx2;
+    }
+#endif
+}
+
+// RFC 7230 token characters (method and header names)
+static int is_token_char(unsigned char c) {
+    if (c >= 'a' && c <= 'z') return 1;
+    if (c >= 'A' && c <= 'Z') return 1;
+    if (c >= '0' && c <= '9') return 1;
+    return c && strchr("!#$%&'*+-.^_`|~", c) != NULL;
+}
+
+static int span_equals(const char *buffer, span_t span, const char *literal) {
+    size_t len = strlen(literal);
+    return span.len == len && strncasecmp(buffer + span.offset, literal, len) == 0;
+}
+
+void http_parser_init(http_parser_t *parser) {
+    // Only the bookkeeping needs resetting; spans are written before use
+    parser->state = PARSE_METHOD;
+    parser->pos = 0;
+    parser->token_start = 0;
+    parser->query.offset = 0;
+    parser->query.len = 0;
+    parser->header_count = 0;
+    parser->content_length = 0;
+    parser->has_content_length = 0;
+    parser->request_len = 0;
+    parser->keep_alive = 0;
+}
+
+// Interpret the headers the server itself acts on: 0, PARSE_FAILED or
+// PARSE_TOO_LARGE
+static int apply_header(http_parser_t *parser, const char *buffer, const header_span_t *h) {
+    if (span_equals(buffer, h->name, "Content-Length")) {
+        size_t value = 0;
+        if (h->value.len == 0) return PARSE_FAILED;
+        for (size_t i = 0; i < h->value.len; i++) {
+            char c = buffer[h->value.offset + i];
+            if (c < '0' || c > '9') return PARSE_FAILED;
         }
-        
-        // Parse body
-        const char *body = body_start + 4;
-        size_t body_len = strlen(body);
-        if (body_len < sizeof(req->body)) {
-            strncpy(req->body, body, body_len);
-            req->content_length = body_len;
+        for (size_t i = 0; i < h->value.len; i++) {
+            value = value * 10 + (buffer[h->value.offset + i] - '0');
+            if (value > MAX_REQUEST_SIZE) return PARSE_TOO_LARGE;
         }
-    } else {
-        // No body, just headers
-        strncpy(req->headers, headers_start, sizeof(req->headers) - 1);
+        // Repeats must agree, or the body's end depends on who is reading
+        // (RFC 9112 6.3)
+        if (parser->has_content_length && parser->content_length != value) {
+            return PARSE_FAILED;
+        }
+        parser->content_length = value;
+        parser->has_content_length = 1;
+    } else if (span_equals(buffer, h->name, "Connection")) {
+        if (span_equals(buffer, h->value, "close")) {
+            parser->keep_alive = 0;
+        } else if (span_equals(buffer, h->value, "keep-alive")) {
+            parser->keep_alive = 1;
+        }
+    } else if (span_equals(buffer, h->name, "Transfer-Encoding")) {
+        // Chunked request bodies are not supported
+        return PARSE_FAILED;
     }
-    
-    return 1;
+    return 0;
+}
+
+// Feed the parser everything buffered so far. It resumes from where the
+// previous call stopped and looks at every byte at most once.
+int http_parser_execute(http_parser_t *parser, const char *buffer, size_t len) {
+    const char *end = buffer + len;
+    size_t pos = parser->pos;
+
+    while (pos < len) {
+        unsigned char c = buffer[pos];
+
+        switch (parser->state) {
+            case PARSE_METHOD:
+                if (c == ' ') {
+                    if (pos == parser->token_start) return PARSE_FAILED;
+                    parser->method.offset = parser->token_start;
+                    parser->method.len = pos - parser->token_start;
+                    parser->token_start = pos + 1;
+                    parser->path.offset = pos + 1;
+                    parser->path.len = 0;
+                    parser->state = PARSE_TARGET;
+                } else if (!is_token_char(c)) {
+                    return PARSE_FAILED;
+                }
+                pos++;
+                break;
+
+            case PARSE_TARGET: {
+                // The target is the longest token; scan it vectorized
+                const char *hit = scan2(buffer + pos, end, ' ', '?');
+                pos = hit - buffer;
+                if (pos == len) break;
+
+                if (*hit == '?') {
+                    // Only the first '?' separates path from query
+                    if (parser->query.offset == 0) {
+                        parser->path.len = pos - parser->path.offset;
+                        parser->query.offset = pos + 1;
+                    }
+                    pos++;
+                    break;
+                }
+
+                // Space ends the target
+                if (parser->query.offset) {
+                    parser->query.len = pos - parser->query.offset;
+                } else {
+                    parser->path.len = pos - parser->path.offset;
+                }
+                if (parser->path.len == 0 || buffer[parser->path.offset] != '/') {
+                    return PARSE_FAILED;
+                }
+                for (size_t i = parser->token_start; i < pos; i++) {
+                    if ((unsigned char)buffer[i] <= ' ' || buffer[i] == 0x7f) return PARSE_FAILED;
+                }
+                parser->token_start = pos + 1;
+                parser->state = PARSE_VERSION;
+                pos++;
+                break;
+            }
+
+            case PARSE_VERSION:
+                if (c == '\r' || c == '\n') {
+                    parser->version.offset = parser->token_start;
+                    parser->version.len = pos - parser->token_start;
+                    // HTTP/1.0 and HTTP/1.1 only
+                    if (parser->version.len != 8 ||
+                        strncmp(buffer + parser->version.offset, "HTTP/1.", 7) != 0 ||
+                        (buffer[parser->version.offset + 7] != '0' &&
+                         buffer[parser->version.offset + 7] != '1')) {
+                        return PARSE_FAILED;
+                    }
+                    // HTTP/1.1 connections persist unless the client asks otherwise
+                    parser->keep_alive = buffer[parser->version.offset + 7] == '1';
+                    parser->state = c == '\r' ? PARSE_REQUEST_LINE_LF : PARSE_HEADER_START;
+                    parser->header_block.offset = pos + (c == '\r' ? 2 : 1);
+                }
+                pos++;
+                break;
+
+            case PARSE_REQUEST_LINE_LF:
+            case PARSE_HEADER_LF:
+                if (c != '\n') return PARSE_FAILED;
+                parser->state = PARSE_HEADER_START;
+                pos++;
+                break;
+
+            case PARSE_HEADER_START:
+                if (c == '\r' || c == '\n') {
+                    parser->header_block.len = pos - parser->header_block.offset;
+                    if (parser->header_block.len >= 2) {
+                        parser->header_block.len -= buffer[pos - 2] == '\r' ? 2 : 1;
+                    }
+                    parser->state = PARSE_HEADERS_END_LF;
+                    if (c == '\n') continue;  // bare LF ends the headers too
+                    pos++;
+                    break;
+                }
+                if (!is_token_char(c)) return PARSE_FAILED;  // also rejects obs-fold
+                if (parser->header_count == MAX_REQUEST_HEADERS) return PARSE_FAILED;
+                parser->headers[parser->header_count].name.offset = pos;
+                parser->state = PARSE_HEADER_NAME;
+                pos++;
+                break;
+
+            case PARSE_HEADER_NAME:
+                if (c == ':') {
+                    header_span_t *h = &parser->headers[parser->header_count];
+                    h->name.len = pos - h->name.offset;
+                    parser->state = PARSE_HEADER_VALUE_START;
+                } else if (!is_token_char(c)) {
+                    return PARSE_FAILED;
+                }
+                pos++;
+                break;
+
+            case PARSE_HEADER_VALUE_START:
+                if (c == ' ' || c == '\t') {
+                    pos++;
+                    break;
+                }
+                parser->headers[parser->header_count].value.offset = pos;
+                parser->state = PARSE_HEADER_VALUE;
+                // fall through
+
+            case PARSE_HEADER_VALUE: {
+                const char *hit = scan2(buffer + pos, end, '\r', '\n');
+                pos = hit - buffer;
+                if (pos == len) break;
+
+                header_span_t *h = &parser->headers[parser->header_count];
+                size_t value_end = pos;
+                while (value_end > h->value.offset &&
+                       (buffer[value_end - 1] == ' ' || buffer[value_end - 1] == '\t')) {
+                    value_end--;
+                }
+                h->value.len = value_end - h->value.offset;
+                int applied = apply_header(parser, buffer, h);
+                if (applied != 0) return applied;
+                parser->header_count++;
+
+                parser->state = *hit == '\r' ? PARSE_HEADER_LF : PARSE_HEADER_START;
+                pos++;
+                break;
+            }
+
+            case PARSE_HEADERS_END_LF:
+                if (c != '\n') return PARSE_FAILED;
+                pos++;
+                parser->body.offset = pos;
+                parser->body.len = parser->content_length;
+                parser->state = PARSE_BODY;
+                break;
+
+            case PARSE_BODY:
+            case PARSE_DONE:
+                pos = len;
+                break;
+        }
+
+        if (parser->state == PARSE_BODY) break;
+    }
+
+    parser->pos = pos;
+
+    if (parser->state == PARSE_BODY &&
+        len - parser->body.offset >= parser->content_length) {
+        parser->state = PARSE_DONE;
+        parser->request_len = parser->body.offset + parser->content_length;
+        // Don't let the next call skip over pipelined bytes
+        parser->pos = parser->request_len;
+    }
+
+    return parser->state == PARSE_DONE ? PARSE_COMPLETE : PARSE_INCOMPLETE;
 }
 
-int extract_path_and_query(const char *uri, char *path, size_t path_size, char *query, size_t query_size) {
-    if (!uri || !path || !query) return 0;
-    
-    const char *query_start = strchr(uri, '?');
-    
-    if (query_start) {
-        // Has query string
-        size_t path_len = query_start - uri;
-        if (path_len >= path_size) return 0;
-        
-        strncpy(path, uri, path_len);
-        path[path_len] = '\0';
-        
-        const char *query_str = query_start + 1;
-        size_t query_len = strlen(query_str);
-        if (query_len >= query_size) return 0;
-        
-        strncpy(query, query_str, query_len);
-        query[query_len] = '\0';
+// NUL-terminate a span in place. The byte after every request-line and
+// header span is a delimiter the parser has already consumed.
+static const char *terminate_span(char *buffer, span_t span) {
+    buffer[span.offset + span.len] = '\0';
+    return buffer + span.offset;
+}
+
+// Fill the handler-facing request from a completed parse. Strings are views
+// into the receive buffer, terminated in place; only the header table and a
+// body followed by pipelined bytes are allocated, from the connection arena.
+int fill_request(const http_parser_t *parser, char *buffer, size_t buffer_len, arena_t *arena, http_request_t *req) {
+    if (!parser || !buffer || !req || parser->state != PARSE_DONE) return 0;
+
+    http_header_t *headers = NULL;
+    if (parser->header_count > 0) {
+        headers = arena_alloc(arena, parser->header_count * sizeof(http_header_t));
+        if (!headers) return 0;
+    }
+
+    // A body is followed by the next request's bytes when pipelined, so it
+    // can't be terminated in place; otherwise the buffer's own NUL ends it
+    if (parser->body.len == 0) {
+        req->body = "";
+    } else if (parser->request_len < buffer_len) {
+        char *body = arena_alloc(arena, parser->body.len + 1);
+        if (!body) return 0;
+        memcpy(body, buffer + parser->body.offset, parser->body.len);
+        body[parser->body.len] = '\0';
+        req->body = body;
     } else {
-        // No query string
-        size_t uri_len = strlen(uri);
-        if (uri_len >= path_size) return 0;
-        
-        strncpy(path, uri, uri_len);
-        path[uri_len] = '\0';
-        query[0] = '\0';
-    }
-    
+        req->body = buffer + parser->body.offset;
+    }
+    req->content_length = parser->body.len;
+
+    req->method = terminate_span(buffer, parser->method);
+    req->method_len = parser->method.len;
+    req->path = terminate_span(buffer, parser->path);
+    req->path_len = parser->path.len;
+    if (parser->query.len > 0) {
+        req->query_string = terminate_span(buffer, parser->query);
+    } else {
+        req->query_string = "";
+    }
+    req->query_len = parser->query.len;
+
+    for (int i = 0; i < parser->header_count; i++) {
+        const header_span_t *h = &parser->headers[i];
+        headers[i].name = terminate_span(buffer, h->name);
+        headers[i].name_len = h->name.len;
+        headers[i].value = terminate_span(buffer, h->value);
+        headers[i].value_len = h->value.len;
+    }
+    req->header_list = headers;
+    req->header_count = parser->header_count;
+
+    req->keep_alive = parser->keep_alive;
+    req->version_minor = buffer[parser->version.offset + 7] - '0';
     return 1;
 }
 
-int parse_headers(const char *header_section, char *headers, size_t header_size) {
-    if (!header_section || !headers) return 0;
-    
-    size_t len = strlen(header_section);
-    if (len >= header_size) return 0;
-    
-    strncpy(headers, header_section, len);
-    headers[len] = '\0';
-    
-    return 1;
+// Value of a header (case-insensitive name), or NULL when absent
+const char *find_request_header(const http_request_t *req, const char *name) {
+    if (!req || !name) return NULL;
+
+    size_t name_len = strlen(name);
+    for (int i = 0; i < req->header_count; i++) {
+        const http_header_t *h = &req->header_list[i];
+        if (h->name_len == name_len && strncasecmp(h->name, name, name_len) == 0) {
+            return h->value;
+        }
+    }
+    return NULL;
+}
+
+// Split "a=1&b=x%20y" into name/value views without copying or decoding.
+// A parameter with no '=' has an empty value; empty ones ("a=1&&b") are
+// skipped. Returns the number stored, at most max_params.
+int parse_query_string(const char *query, size_t len, query_param_t *params, int max_params) {
+    const char *p = query;
+    const char *end = query + len;
+    int count = 0;
+    while (p < end && count < max_params) {
+        const char *amp = memchr(p, '&', end - p);
+        const char *stop = amp ? amp : end;
+        if (stop > p) {
+            const char *eq = memchr(p, '=', stop - p);
+            query_param_t *param = &params[count++];
+            param->name = p;
+            param->name_len = (eq ? eq : stop) - p;
+            param->value = eq ? eq + 1 : stop;
+            param->value_len = stop - param->value;
+        }
+        p = stop + 1;
+    }
+    return count;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Next decoded byte of a query component: %XX escapes, '+' for space.
+// Returns -1 on a malformed escape.
+static int next_query_byte(const char **p, const char *end) {
+    char c = *(*p)++;
+    if (c == '+') {
+        return ' ';
+    }
+    if (c != '%') {
+        return (unsigned char)c;
+    }
+    if (end - *p < 2) {
+        return -1;
+    }
+    int high = hex_value((*p)[0]);
+    int low = hex_value((*p)[1]);
+    if (high < 0 || low < 0) {
+        return -1;
+    }
+    *p += 2;
+    return high << 4 | low;
+}
+
+// Percent-decode a query component into out, NUL-terminated. Returns the
+// decoded length, or -1 if an escape is malformed, decodes to NUL, or the
+// result does not fit.
+int query_decode(const char *src, size_t len, char *out, size_t out_size) {
+    const char *p = src;
+    const char *end = src + len;
+    size_t n = 0;
+    while (p < end) {
+        int c = next_query_byte(&p, end);
+        if (c <= 0 || n + 1 >= out_size) {
+            return -1;
+        }
+        out[n++] = (char)c;
+    }
+    if (out_size == 0) {
+        return -1;
+    }
+    out[n] = '\0';
+    return (int)n;
+}
+
+// First parameter whose name decodes to name, or NULL
+const query_param_t *find_query_param(const query_param_t *params, int count, const char *name) {
+    for (int i = 0; i < count; i++) {
+        const char *p = params[i].name;
+        const char *end = p + params[i].name_len;
+        const char *want = name;
+        while (p < end && *want && next_query_byte(&p, end) == (unsigned char)*want) {
+            want++;
+        }
+        if (p == end && *want == '\0') {
+            return &params[i];
+        }
+    }
+    return NULL;
 }
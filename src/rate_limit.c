@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <netinet/in.h>
+#include "utils/rate_limit.h"
+
+// Keys below 2 mark a free way and a way being recycled
+#define KEY_FREE 0
+#define KEY_EVICTING 1
+
+// Bucket state packs the last refill time (ms, high 40 bits) with the
+// tokens left in thousandths (low 24 bits); 0 means a fresh, full bucket
+#define TOKEN_BITS 24
+#define TOKEN_MASK ((1ULL << TOKEN_BITS) - 1)
+#define MILLI 1000ULL
+
+// A set-associative shard: a key can only live in its shard's ways, and a
+// CLOCK hand picks the victim when they are all taken. Keys share a cache
+// line so a lookup touches one line.
+typedef struct {
+    _Atomic uint64_t keys[RATE_LIMIT_WAYS];
+    _Atomic uint64_t state[RATE_LIMIT_WAYS];
+    _Atomic unsigned char referenced[RATE_LIMIT_WAYS];
+    _Atomic unsigned hand;
+} __attribute__((aligned(64))) rate_shard_t;
+
+static rate_shard_t *shards = NULL;
+static uint64_t shard_mask = 0;
+static rate_limit_config_t limits;
+static int limiter_enabled = 0;
+static uint64_t start_ms = 0;
+static _Atomic uint64_t limited_count = 0;
+static _Atomic uint64_t evicted_count = 0;
+
+static uint64_t clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+// Milliseconds since init, starting at 1 so a stored state is never 0
+static uint64_t now_ms(void) {
+    return clock_ms() - start_ms + 1;
+}
+
+static void clamp_rule(rate_limit_rule_t *rule) {
+    if (rule->burst > RATE_LIMIT_MAX_BURST) rule->burst = RATE_LIMIT_MAX_BURST;
+    if (rule->rate > 0 && rule->burst == 0) rule->burst = 1;
+}
+
+int rate_limit_init(const rate_limit_config_t *config) {
+    limits = *config;
+    clamp_rule(&limits.host);
+    clamp_rule(&limits.prefix);
+    if (limits.host.rate == 0 && limits.prefix.rate == 0) {
+        return 0;
+    }
+
+    unsigned entries = limits.max_entries ? limits.max_entries : RATE_LIMIT_DEFAULT_ENTRIES;
+    size_t count = 1;
+    while (count * RATE_LIMIT_WAYS < entries) {
+        count *= 2;
+    }
+    shards = aligned_alloc(64, count * sizeof(rate_shard_t));
+    if (!shards) {
+        return -1;
+    }
+    memset(shards, 0, count * sizeof(rate_shard_t));
+    shard_mask = count - 1;
+    limits.max_entries = (unsigned)(count * RATE_LIMIT_WAYS);
+    start_ms = clock_ms();
+    limiter_enabled = 1;
+    return 0;
+}
+
+int rate_limit_enabled(void) {
+    return limiter_enabled;
+}
+
+// Parse "rate" or "rate:burst" (requests per second); burst defaults to rate
+int rate_limit_parse_rule(const char *spec, rate_limit_rule_t *rule) {
+    char *end;
+    unsigned long rate = strtoul(spec, &end, 10);
+    unsigned long burst = rate;
+    if (end == spec) return -1;
+    if (*end == ':') {
+        const char *start = end + 1;
+        burst = strtoul(start, &end, 10);
+        if (end == start) return -1;
+    }
+    if (*end != '\0' || rate > 1000000 || burst > RATE_LIMIT_MAX_BURST) return -1;
+    rule->rate = (unsigned)rate;
+    rule->burst = (unsigned)burst;
+    return 0;
+}
+
+// Spread a key over the shards; kinds keep hosts and prefixes apart
+static uint64_t fingerprint(uint64_t kind, uint64_t value) {
+    uint64_t x = value ^ (kind * 0x9E3779B97F4A7C15ULL);
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x < 2 ? x + 2 : x;
+}
+
+void rate_limit_key(const struct sockaddr *addr, rate_limit_key_t *key) {
+    key->host = 0;
+    key->prefix = 0;
+
+    uint32_t v4;
+    if (addr->sa_family == AF_INET) {
+        v4 = ntohl(((const struct sockaddr_in *)addr)->sin_addr.s_addr);
+    } else if (addr->sa_family == AF_INET6) {
+        const struct in6_addr *a6 = &((const struct sockaddr_in6 *)addr)->sin6_addr;
+        if (!IN6_IS_ADDR_V4MAPPED(a6)) {
+            uint64_t high, low;
+            memcpy(&high, a6->s6_addr, 8);
+            memcpy(&low, a6->s6_addr + 8, 8);
+            key->host = fingerprint(3, high ^ fingerprint(5, low));
+            key->prefix = fingerprint(4, high);
+            return;
+        }
+        memcpy(&v4, a6->s6_addr + 12, 4);
+        v4 = ntohl(v4);
+    } else {
+        return;
+    }
+    key->host = fingerprint(1, v4);
+    key->prefix = fingerprint(2, v4 & 0xFFFFFF00u);
+}
+
+// Way holding the key's bucket, claiming one if needed; -1 if every way is
+// contended (the request is then let through)
+static int find_bucket(rate_shard_t *shard, uint64_t key) {
+    for (int i = 0; i < RATE_LIMIT_WAYS; i++) {
+        if (atomic_load_explicit(&shard->keys[i], memory_order_acquire) == key) {
+            if (!atomic_load_explicit(&shard->referenced[i], memory_order_relaxed)) {
+                atomic_store_explicit(&shard->referenced[i], 1, memory_order_relaxed);
+            }
+            return i;
+        }
+    }
+
+    for (int i = 0; i < RATE_LIMIT_WAYS; i++) {
+        uint64_t expected = KEY_FREE;
+        if (atomic_load_explicit(&shard->keys[i], memory_order_relaxed) == KEY_FREE &&
+            atomic_compare_exchange_strong(&shard->keys[i], &expected, key)) {
+            atomic_store_explicit(&shard->referenced[i], 1, memory_order_relaxed);
+            return i;
+        }
+    }
+
+    // CLOCK: clear reference bits until an unreferenced way comes round.
+    // The bucket is reset before the new key is published.
+    for (int tries = 0; tries < 2 * RATE_LIMIT_WAYS + 1; tries++) {
+        int i = atomic_fetch_add_explicit(&shard->hand, 1, memory_order_relaxed) % RATE_LIMIT_WAYS;
+        uint64_t victim = atomic_load_explicit(&shard->keys[i], memory_order_relaxed);
+        if (victim < 2) {
+            continue;
+        }
+        if (atomic_exchange_explicit(&shard->referenced[i], 0, memory_order_relaxed)) {
+            continue;
+        }
+        if (atomic_compare_exchange_strong(&shard->keys[i], &victim, KEY_EVICTING)) {
+            atomic_store(&shard->state[i], 0);
+            atomic_store_explicit(&shard->referenced[i], 1, memory_order_relaxed);
+            atomic_store_explicit(&shard->keys[i], key, memory_order_release);
+            atomic_fetch_add_explicit(&evicted_count, 1, memory_order_relaxed);
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Take one token, refilling lazily from the time elapsed since the last
+// refill. Returns 0 when granted, otherwise milliseconds until a token.
+// The way charged is left in taken (-1 when nothing was).
+static uint64_t take_token(const rate_limit_rule_t *rule, uint64_t key, uint64_t now, int *taken) {
+    rate_shard_t *shard = &shards[key & shard_mask];
+    int way = find_bucket(shard, key);
+    *taken = -1;
+    if (way < 0) {
+        return 0;
+    }
+
+    _Atomic uint64_t *state = &shard->state[way];
+    const uint64_t capacity = rule->burst * MILLI;
+    uint64_t old = atomic_load_explicit(state, memory_order_relaxed);
+    for (;;) {
+        uint64_t tokens = capacity;
+        uint64_t last = now;
+        if (old != 0) {
+            tokens = old & TOKEN_MASK;
+            last = old >> TOKEN_BITS;
+            if (now > last) {
+                // rate tokens/s is rate thousandths per ms
+                uint64_t elapsed = now - last;
+                if (elapsed > capacity / rule->rate + 1) {
+                    elapsed = capacity / rule->rate + 1;
+                }
+                tokens += elapsed * rule->rate;
+                if (tokens > capacity) tokens = capacity;
+                last = now;
+            }
+        }
+
+        uint64_t wait = 0;
+        if (tokens >= MILLI) {
+            tokens -= MILLI;
+        } else {
+            wait = (MILLI - tokens + rule->rate - 1) / rule->rate;
+        }
+
+        uint64_t next = (last << TOKEN_BITS) | tokens;
+        if (atomic_compare_exchange_weak_explicit(state, &old, next,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+            if (wait == 0) {
+                *taken = way;
+            }
+            return wait;
+        }
+    }
+}
+
+// Give back a token take_token granted, unless the way has been recycled
+// for another key since
+static void return_token(const rate_limit_rule_t *rule, uint64_t key, int way) {
+    rate_shard_t *shard = &shards[key & shard_mask];
+    if (way < 0 || atomic_load_explicit(&shard->keys[way], memory_order_acquire) != key) {
+        return;
+    }
+
+    _Atomic uint64_t *state = &shard->state[way];
+    const uint64_t capacity = rule->burst * MILLI;
+    uint64_t old = atomic_load_explicit(state, memory_order_relaxed);
+    for (;;) {
+        if (old == 0) {
+            // Reset to a full bucket meanwhile
+            return;
+        }
+        uint64_t tokens = (old & TOKEN_MASK) + MILLI;
+        if (tokens > capacity) tokens = capacity;
+        uint64_t next = (old & ~TOKEN_MASK) | tokens;
+        if (atomic_compare_exchange_weak_explicit(state, &old, next,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+            return;
+        }
+    }
+}
+
+// Charge one request to the client's address and prefix buckets, both or
+// neither: a request the prefix refuses gives its address token back, so
+// a client is not drained by requests it was never served. Returns 1 if
+// allowed; otherwise 0 with the seconds to wait in retry_after.
+int rate_limit_allow(const rate_limit_key_t *key, int *retry_after) {
+    if (!limiter_enabled || key->host == 0) {
+        return 1;
+    }
+
+    uint64_t now = now_ms();
+    uint64_t wait = 0;
+    int host_way = -1;
+    int prefix_way = -1;
+    if (limits.host.rate > 0) {
+        wait = take_token(&limits.host, key->host, now, &host_way);
+    }
+    if (wait == 0 && limits.prefix.rate > 0) {
+        wait = take_token(&limits.prefix, key->prefix, now, &prefix_way);
+        if (wait > 0) {
+            return_token(&limits.host, key->host, host_way);
+        }
+    }
+    if (wait == 0) {
+        return 1;
+    }
+
+    atomic_fetch_add_explicit(&limited_count, 1, memory_order_relaxed);
+    if (retry_after) {
+        *retry_after = (int)((wait + 999) / 1000);
+    }
+    return 0;
+}
+
+void rate_limit_get_stats(rate_limit_stats_t *stats) {
+    stats->limited = atomic_load(&limited_count);
+    stats->evicted = atomic_load(&evicted_count);
+    stats->entries = limiter_enabled ? limits.max_entries : 0;
+}
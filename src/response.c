@@ -0,0 +1,504 @@
+#include "utils/http.h"
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include "utils/transport.h"
+#include "utils/trace.h"
+
+// Writes are gathered in batches of this many buffers
+#define RESPONSE_IOV_BATCH 64
+
+// Status, bytes and socket write time of the responses written by this
+// thread since the last reset, for the access log and request tracing
+static __thread int stats_status = 0;
+static __thread size_t stats_bytes = 0;
+static __thread uint64_t stats_write_ns = 0;
+
+// Where this thread's responses queue what the socket does not take yet:
+// the backlog of the connection being served. Without one, a response
+// gets a single attempt and whatever is left is dropped.
+static __thread transport_queue_t *send_backlog = NULL;
+
+void response_set_backlog(transport_queue_t *backlog) {
+    send_backlog = backlog;
+}
+
+void response_stats_reset(void) {
+    stats_status = 0;
+    stats_bytes = 0;
+    stats_write_ns = 0;
+}
+
+uint64_t response_stats_write_ns(void) {
+    return stats_write_ns;
+}
+
+void response_stats_get(int *status, size_t *bytes) {
+    *status = stats_status;
+    *bytes = stats_bytes;
+}
+
+static void stats_note_status(const char *status) {
+    const char *code = strchr(status, ' ');
+    stats_status = code ? atoi(code + 1) : 0;
+}
+
+// Responses to 1xx, 204 and 304 never carry Content-Length (RFC 7230 3.3.2)
+static int status_has_length(const char *status) {
+    const char *code = strchr(status, ' ');
+    if (!code) return 1;
+    return !(code[1] == '1' || strncmp(code + 1, "204", 3) == 0 || strncmp(code + 1, "304", 3) == 0);
+}
+
+void response_init(http_response_t *resp, const char *status) {
+    resp->status = status;
+    resp->headers = NULL;
+    resp->headers_last = NULL;
+    resp->body = NULL;
+    resp->body_last = NULL;
+    resp->content_length = 0;
+    resp->send_length = status_has_length(status);
+    resp->has_file = 0;
+    resp->failed = 0;
+    resp->chunked = 0;
+    resp->stream_fd = -1;
+    resp->stream_ssl = NULL;
+    resp->stream_failed = 0;
+    resp->chunks = NULL;
+    resp->arena = resp->inline_buf;
+    resp->arena_used = 0;
+    resp->arena_cap = sizeof(resp->inline_buf);
+}
+
+void response_free(http_response_t *resp) {
+    response_chunk_t *chunk = resp->chunks;
+    while (chunk) {
+        response_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    resp->chunks = NULL;
+}
+
+// Make room for size bytes in the current region, starting a new chunk
+// when it is full. Earlier regions are never moved.
+static int response_reserve(http_response_t *resp, size_t size) {
+    if (resp->arena_cap - resp->arena_used >= size) {
+        return 0;
+    }
+
+    size_t cap = size > RESPONSE_CHUNK_SIZE ? size : RESPONSE_CHUNK_SIZE;
+    response_chunk_t *chunk = malloc(sizeof(response_chunk_t) + cap);
+    if (!chunk) {
+        resp->failed = 1;
+        return -1;
+    }
+    chunk->cap = cap;
+    chunk->next = resp->chunks;
+    resp->chunks = chunk;
+    resp->arena = chunk->data;
+    resp->arena_used = 0;
+    resp->arena_cap = cap;
+    return 0;
+}
+
+// Bump-allocate from the current region (reserve first)
+static void *response_take(http_response_t *resp, size_t size) {
+    void *ptr = resp->arena + resp->arena_used;
+    resp->arena_used += size;
+    return ptr;
+}
+
+// Bytes needed to bring the region's free space to pointer alignment
+static size_t align_pad(const http_response_t *resp) {
+    return (-(uintptr_t)(resp->arena + resp->arena_used)) & (sizeof(void *) - 1);
+}
+
+static response_segment_t *new_segment(http_response_t *resp, response_segment_t **head, response_segment_t **last) {
+    if (response_reserve(resp, align_pad(resp) + sizeof(response_segment_t)) != 0) {
+        return NULL;
+    }
+    // Recomputed: a fresh chunk starts aligned
+    resp->arena_used += align_pad(resp);
+
+    response_segment_t *seg = response_take(resp, sizeof(response_segment_t));
+    seg->next = NULL;
+    seg->data = NULL;
+    seg->len = 0;
+    seg->owned = 0;
+    seg->file_fd = -1;
+    seg->offset = 0;
+
+    if (*last) {
+        (*last)->next = seg;
+    } else {
+        *head = seg;
+    }
+    *last = seg;
+    return seg;
+}
+
+// Writable space at the end of the list: extends the last segment when it
+// ends exactly where the region's free space starts, else opens a new one
+static char *tail_space(http_response_t *resp, response_segment_t **head, response_segment_t **last, size_t need) {
+    response_segment_t *seg = *last;
+    if (seg && seg->owned && seg->data + seg->len == resp->arena + resp->arena_used &&
+        resp->arena_cap - resp->arena_used >= need) {
+        return resp->arena + resp->arena_used;
+    }
+
+    // Reserve the segment and its bytes together so they share a region
+    if (response_reserve(resp, sizeof(response_segment_t) + sizeof(void *) + need) != 0) {
+        return NULL;
+    }
+    seg = new_segment(resp, head, last);
+    if (!seg) {
+        return NULL;
+    }
+    seg->owned = 1;
+    seg->data = resp->arena + resp->arena_used;
+    return resp->arena + resp->arena_used;
+}
+
+static void commit_tail(http_response_t *resp, response_segment_t *last, size_t len) {
+    response_take(resp, len);
+    last->len += len;
+}
+
+// Copy bytes onto the end of a segment list
+static int append_copy(http_response_t *resp, response_segment_t **head, response_segment_t **last,
+                       const void *data, size_t len) {
+    if (len == 0) return 0;
+    char *dst = tail_space(resp, head, last, len);
+    if (!dst) return -1;
+    memcpy(dst, data, len);
+    commit_tail(resp, *last, len);
+    return 0;
+}
+
+// Add a "Name: value" header line (copied)
+void add_response_header(http_response_t *resp, const char *name, const char *value) {
+    size_t name_len = strlen(name);
+    size_t value_len = strlen(value);
+    char *dst = tail_space(resp, &resp->headers, &resp->headers_last, name_len + value_len + 4);
+    if (!dst) return;
+
+    memcpy(dst, name, name_len);
+    memcpy(dst + name_len, ": ", 2);
+    memcpy(dst + name_len + 2, value, value_len);
+    memcpy(dst + name_len + 2 + value_len, "\r\n", 2);
+    commit_tail(resp, resp->headers_last, name_len + value_len + 4);
+}
+
+// Add pre-rendered header lines (each ending in CRLF) without copying;
+// they must stay valid until the response is sent
+void response_add_headers(http_response_t *resp, const char *lines, size_t len) {
+    response_segment_t *seg = new_segment(resp, &resp->headers, &resp->headers_last);
+    if (!seg) return;
+    seg->data = lines;
+    seg->len = len;
+}
+
+// Append body bytes (copied)
+void response_append(http_response_t *resp, const void *data, size_t len) {
+    if (append_copy(resp, &resp->body, &resp->body_last, data, len) == 0) {
+        resp->content_length += len;
+    }
+}
+
+// Append body bytes without copying; they must stay valid until sent
+void response_append_ref(http_response_t *resp, const void *data, size_t len) {
+    if (len == 0) return;
+    response_segment_t *seg = new_segment(resp, &resp->body, &resp->body_last);
+    if (!seg) return;
+    seg->data = data;
+    seg->len = len;
+    resp->content_length += len;
+}
+
+// Append formatted body text, straight into the builder's storage
+void response_appendf(http_response_t *resp, const char *fmt, ...) {
+    va_list args;
+
+    // Format in place when the last segment can grow; measure otherwise
+    size_t avail = 0;
+    char *dst = NULL;
+    response_segment_t *seg = resp->body_last;
+    if (seg && seg->owned && seg->data + seg->len == resp->arena + resp->arena_used) {
+        dst = resp->arena + resp->arena_used;
+        avail = resp->arena_cap - resp->arena_used;
+    }
+
+    va_start(args, fmt);
+    int len = vsnprintf(dst, avail, fmt, args);
+    va_end(args);
+    if (len < 0) {
+        resp->failed = 1;
+        return;
+    }
+
+    if ((size_t)len >= avail) {
+        // One spare byte for the terminator vsnprintf always writes
+        dst = tail_space(resp, &resp->body, &resp->body_last, len + 1);
+        if (!dst) return;
+        va_start(args, fmt);
+        vsnprintf(dst, len + 1, fmt, args);
+        va_end(args);
+    }
+    commit_tail(resp, resp->body_last, len);
+    resp->content_length += len;
+}
+
+// Append a file range, sent with sendfile() on plain connections; the
+// descriptor must stay open until the response is sent
+void response_append_file(http_response_t *resp, int file_fd, off_t offset, size_t len) {
+    if (len == 0) return;
+    response_segment_t *seg = new_segment(resp, &resp->body, &resp->body_last);
+    if (!seg) return;
+    seg->file_fd = file_fd;
+    seg->offset = offset;
+    seg->len = len;
+    resp->content_length += len;
+    resp->has_file = 1;
+}
+
+// Buffers queued for one gathered write. After a failure every further
+// push is ignored and the failure is reported once at the end.
+typedef struct {
+    int client_fd;
+    void *ssl;
+    struct iovec iov[RESPONSE_IOV_BATCH];
+    int count;
+    int failed;
+    size_t bytes;
+} write_batch_t;
+
+static void batch_flush(write_batch_t *batch) {
+    if (!batch->failed && batch->count > 0) {
+        uint64_t start = trace_now_ns();
+        if (transport_writev(batch->client_fd, batch->ssl, batch->iov, batch->count,
+                             send_backlog) != 0) {
+            batch->failed = 1;
+        }
+        stats_write_ns += trace_now_ns() - start;
+    }
+    batch->count = 0;
+    if (!batch->failed) {
+        stats_bytes += batch->bytes;
+    }
+    batch->bytes = 0;
+}
+
+static void batch_push(write_batch_t *batch, const void *data, size_t len) {
+    if (batch->count == RESPONSE_IOV_BATCH) {
+        batch_flush(batch);
+    }
+    batch->iov[batch->count++] = (struct iovec){ (void *)data, len };
+    batch->bytes += len;
+}
+
+// Queue a segment list; file ranges flush what is queued and go out with
+// sendfile() (or the TLS read loop) directly
+static void batch_push_segments(write_batch_t *batch, const response_segment_t *seg) {
+    for (; seg && !batch->failed; seg = seg->next) {
+        if (seg->data) {
+            batch_push(batch, seg->data, seg->len);
+            continue;
+        }
+        batch_flush(batch);
+        if (batch->failed) {
+            break;
+        }
+        uint64_t start = trace_now_ns();
+        if (transport_send_file(batch->client_fd, batch->ssl, seg->file_fd, seg->offset, seg->len,
+                                send_backlog) != 0) {
+            batch->failed = 1;
+        } else {
+            stats_bytes += seg->len;
+        }
+        stats_write_ns += trace_now_ns() - start;
+    }
+}
+
+// Queue the status line and headers; framing holds the Content-Length or
+// Transfer-Encoding line (or nothing)
+static void batch_push_head(write_batch_t *batch, http_response_t *resp, char *trailer, size_t size, const char *framing) {
+    int len = snprintf(trailer, size, "%s%s\r\n", framing, connection_header());
+    batch_push(batch, resp->status, strlen(resp->status));
+    batch_push(batch, "\r\n", 2);
+    batch_push_segments(batch, resp->headers);
+    batch_push(batch, trailer, len);
+}
+
+// Send the status line, headers, Content-Length, Connection and body with
+// as few writes as possible: one writev (one TLS record when it fits)
+// unless a file range is involved, in which case the socket is corked
+// around the sequence. What the socket does not take right away is queued
+// on the connection's backlog for the reactor to send. Returns 0 when
+// everything was written or queued.
+int send_full_response(int client_fd, void *ssl, http_response_t *resp) {
+    if (resp->failed) {
+        // Nothing half-built goes out; the 500 has no body to allocate
+        response_free(resp);
+        response_init(resp, HTTP_STATUS_500);
+    }
+
+    char framing[48] = "";
+    if (resp->send_length) {
+        snprintf(framing, sizeof(framing), "Content-Length: %zu\r\n", resp->content_length);
+    }
+
+    write_batch_t batch = { .client_fd = client_fd, .ssl = ssl };
+    char trailer[160];
+    stats_note_status(resp->status);
+    batch_push_head(&batch, resp, trailer, sizeof(trailer), framing);
+
+    if (resp->has_file) {
+        transport_cork(client_fd, ssl, 1);
+    }
+    batch_push_segments(&batch, resp->body);
+    batch_flush(&batch);
+    if (resp->has_file) {
+        transport_cork(client_fd, ssl, 0);
+    }
+
+    // A short body leaves the connection out of sync; don't reuse it
+    if (batch.failed) {
+        set_response_keep_alive(0);
+        return -1;
+    }
+    return 0;
+}
+
+// Drop the body once it has been sent and reuse the current region for the
+// next batch; older chunks are freed
+static void response_reset_body(http_response_t *resp) {
+    response_chunk_t **link = &resp->chunks;
+    while (*link) {
+        response_chunk_t *chunk = *link;
+        if (chunk->data == resp->arena) {
+            link = &chunk->next;
+        } else {
+            *link = chunk->next;
+            free(chunk);
+        }
+    }
+    resp->arena_used = 0;
+    resp->headers = NULL;
+    resp->headers_last = NULL;
+    resp->body = NULL;
+    resp->body_last = NULL;
+    resp->content_length = 0;
+    resp->has_file = 0;
+}
+
+static int stream_abort(http_response_t *resp) {
+    resp->stream_failed = 1;
+    set_response_keep_alive(0);
+    return -1;
+}
+
+// Keep a stream from copying itself onto the backlog faster than the peer
+// reads: past RESPONSE_STREAM_BACKLOG, send from the backlog here until it
+// is back under. This is the one place a worker waits on a socket, and
+// only while the peer keeps taking bytes.
+static int stream_drain(http_response_t *resp) {
+    if (!send_backlog) {
+        return 0;
+    }
+    while (transport_queue_bytes(send_backlog) > RESPONSE_STREAM_BACKLOG) {
+        int ret = transport_flush(resp->stream_fd, resp->stream_ssl, send_backlog);
+        if (ret < 0) {
+            return -1;
+        }
+        if (ret == 0) {
+            break;
+        }
+        struct pollfd pfd = { .fd = resp->stream_fd, .events = POLLOUT };
+        int ready;
+        do {
+            ready = poll(&pfd, 1, RESPONSE_STREAM_STALL_MS);
+        } while (ready < 0 && errno == EINTR);
+        if (ready <= 0 || (pfd.revents & (POLLERR | POLLHUP))) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Send the status line and headers now and stream the body after them.
+// HTTP/1.1 clients get Transfer-Encoding: chunked; HTTP/1.0 has no
+// chunked coding, so its body is delimited by closing the connection.
+int response_stream_begin(int client_fd, void *ssl, http_response_t *resp, const http_request_t *req) {
+    resp->stream_fd = client_fd;
+    resp->stream_ssl = ssl;
+    resp->stream_failed = 0;
+    resp->chunked = req && req->version_minor >= 1;
+    if (!resp->chunked) {
+        set_response_keep_alive(0);
+    }
+    if (resp->failed) {
+        return stream_abort(resp);
+    }
+
+    write_batch_t batch = { .client_fd = client_fd, .ssl = ssl };
+    char trailer[160];
+    stats_note_status(resp->status);
+    batch_push_head(&batch, resp, trailer, sizeof(trailer),
+                    resp->chunked ? "Transfer-Encoding: chunked\r\n" : "");
+    batch_push_segments(&batch, resp->body);
+    batch_flush(&batch);
+    if (batch.failed) {
+        return stream_abort(resp);
+    }
+    response_reset_body(resp);
+    return 0;
+}
+
+// Send the pending body as one chunk, plus the terminating zero-length
+// chunk when last is set, in a single gathered write
+static int stream_send(http_response_t *resp, int last) {
+    write_batch_t batch = { .client_fd = resp->stream_fd, .ssl = resp->stream_ssl };
+    char size_line[24];
+    
+    if (resp->content_length > 0) {
+        if (resp->chunked) {
+            int len = snprintf(size_line, sizeof(size_line), "%zx\r\n", resp->content_length);
+            batch_push(&batch, size_line, len);
+        }
+        batch_push_segments(&batch, resp->body);
+        if (resp->chunked) {
+            batch_push(&batch, "\r\n", 2);
+        }
+    }
+    if (last && resp->chunked) {
+        batch_push(&batch, "0\r\n\r\n", 5);
+    }
+    batch_flush(&batch);
+    if (batch.failed || stream_drain(resp) != 0) {
+        return stream_abort(resp);
+    }
+    response_reset_body(resp);
+    return 0;
+}
+
+// Send the body appended since the last flush as one chunk once at least
+// RESPONSE_STREAM_FLUSH bytes are pending (or always when force is set)
+int response_stream_flush(http_response_t *resp, int force) {
+    if (resp->stream_failed) return -1;
+    if (resp->failed) return stream_abort(resp);
+    if (resp->content_length == 0 || (!force && resp->content_length < RESPONSE_STREAM_FLUSH)) {
+        return 0;
+    }
+    return stream_send(resp, 0);
+}
+
+// Flush the rest of the body and terminate the stream
+int response_stream_end(http_response_t *resp) {
+    if (resp->stream_failed) return -1;
+    if (resp->failed) return stream_abort(resp);
+    return stream_send(resp, 1);
+}
@@ -5,25 +5,40 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/filter.h>
+#include "utils/server.h"
 
-int init_server(int port)
+// Create, configure, bind and listen; returns the socket or -1
+int create_listener(const listen_options_t *opts)
 {  //declare struct and socket
    int server_file_desc;
    struct sockaddr_in address;
+   int on = 1;
    //Stream socket, IPv4, and TCP
-   server_file_desc = socket(AF_INET, SOCK_STREAM, 0);
+   server_file_desc = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
    //Catch error if socket fails to be made
    if(server_file_desc < 0)
    {
-       printf("error\n");
-       exit(EXIT_FAILURE);
+       perror("socket");
+       return -1;
+   }
+   //rebind straight after a restart, while old connections sit in TIME_WAIT
+   setsockopt(server_file_desc, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+   //every listener in a SO_REUSEPORT group needs the option before bind
+   if(opts->reuseport &&
+      setsockopt(server_file_desc, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+   {
+       perror("SO_REUSEPORT");
+       close(server_file_desc);
+       return -1;
    }
    //clear memory
    memset(&address, 0, sizeof(address));
    //configure struct
    address.sin_family = AF_INET;
    address.sin_addr.s_addr = INADDR_ANY;
-   address.sin_port = htons(port);
+   address.sin_port = htons(opts->port);
    //bind socket to address and port
 
    int bind_ = bind(server_file_desc, (struct sockaddr *)&address, sizeof(address));
@@ -32,17 +47,62 @@ int init_server(int port)
    {	   
       perror("bind");
       close(server_file_desc);
-      exit(EXIT_FAILURE);
+      return -1;
+   }
+   //optional TCP tuning; a kernel without them still serves, so only warn
+   if(opts->defer_accept > 0 &&
+      setsockopt(server_file_desc, IPPROTO_TCP, TCP_DEFER_ACCEPT, &opts->defer_accept, sizeof(opts->defer_accept)) < 0)
+   {
+       perror("TCP_DEFER_ACCEPT");
+   }
+   if(opts->fastopen > 0 &&
+      setsockopt(server_file_desc, IPPROTO_TCP, TCP_FASTOPEN, &opts->fastopen, sizeof(opts->fastopen)) < 0)
+   {
+       perror("TCP_FASTOPEN");
    }
    //now listen
-   int listen_ = listen(server_file_desc, 10);
+   int listen_ = listen(server_file_desc, opts->backlog > 0 ? opts->backlog : DEFAULT_LISTEN_BACKLOG);
    if(listen_ < 0)
    {
        perror("listen");
        close(server_file_desc);
-       exit(EXIT_FAILURE);
+       return -1;
    }
    //return the socket
    return server_file_desc;
+}
 
-}   
+int init_server(int port)
+{
+   listen_options_t opts = { .port = port, .backlog = DEFAULT_LISTEN_BACKLOG };
+   int server_file_desc = create_listener(&opts);
+   if(server_file_desc < 0)
+   {
+       exit(EXIT_FAILURE);
+   }
+   return server_file_desc;
+}
+
+// Steer each new connection to the listener whose index matches the CPU
+// that received it (modulo the group size). Listeners are indexed in bind
+// order, and reactor i is pinned to CPU i, so a connection is accepted and
+// served on the core that took its interrupt.
+int attach_cpu_steering(int listen_fd, int group_size)
+{
+   struct sock_filter code[] = {
+       //A = current CPU
+       { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+       //A = A % group_size
+       { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (unsigned int)group_size },
+       //return A as the socket index
+       { BPF_RET | BPF_A, 0, 0, 0 }
+   };
+   struct sock_fprog prog = { .len = sizeof(code) / sizeof(code[0]), .filter = code };
+
+   if(setsockopt(listen_fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0)
+   {
+       perror("SO_ATTACH_REUSEPORT_CBPF");
+       return -1;
+   }
+   return 0;
+}
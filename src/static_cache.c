@@ -0,0 +1,500 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "utils/static_cache.h"
+#include "utils/http.h"
+
+#define SHARD_BUCKETS 256
+#define MAX_WATCHES 64
+
+// Each shard has its own lock, hash chains, LRU list and slice of the budget
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t loaded;
+    static_asset_t *buckets[SHARD_BUCKETS];
+    static_asset_t *lru_head;  // most recently used
+    static_asset_t *lru_tail;
+    size_t bytes;
+} cache_shard_t;
+
+static cache_shard_t shards[STATIC_CACHE_SHARDS];
+static char static_root[PATH_MAX];
+static size_t static_root_len = 0;
+static size_t shard_budget = 0;
+static int cache_ready = 0;
+
+// Directories watched for changes, by inotify watch descriptor
+static int inotify_fd = -1;
+static struct {
+    int wd;
+    char path[PATH_MAX];
+} watches[MAX_WATCHES];
+static int watch_count = 0;
+static pthread_mutex_t watch_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Cache-Control by extension. HTML revalidates every time (cheap with
+// ETags); scripts, styles and images may be reused without asking.
+static struct {
+    char extension[16];
+    char value[128];
+} cache_control_rules[MAX_CACHE_CONTROL_RULES] = {
+    { ".html", "no-cache" },
+    { ".css", "public, max-age=3600" },
+    { ".js", "public, max-age=3600" },
+    { ".png", "public, max-age=86400" },
+    { ".jpg", "public, max-age=86400" },
+    { ".jpeg", "public, max-age=86400" },
+    { ".gif", "public, max-age=86400" },
+};
+static int cache_control_count = 7;
+static const char *default_cache_control = "public, max-age=300";
+
+int static_cache_set_cache_control(const char *extension, const char *value) {
+    if (!extension || !value || extension[0] != '.' ||
+        strlen(extension) >= sizeof(cache_control_rules[0].extension) ||
+        strlen(value) >= sizeof(cache_control_rules[0].value)) {
+        return -1;
+    }
+
+    int i;
+    for (i = 0; i < cache_control_count; i++) {
+        if (strcasecmp(cache_control_rules[i].extension, extension) == 0) break;
+    }
+    if (i == MAX_CACHE_CONTROL_RULES) return -1;
+    if (i == cache_control_count) cache_control_count++;
+
+    snprintf(cache_control_rules[i].extension, sizeof(cache_control_rules[i].extension), "%s", extension);
+    snprintf(cache_control_rules[i].value, sizeof(cache_control_rules[i].value), "%s", value);
+    return 0;
+}
+
+// Apply rules written as ".ext=value;.ext=value"
+int static_cache_parse_cache_control(const char *spec) {
+    char copy[1024];
+    if (!spec || strlen(spec) >= sizeof(copy)) return -1;
+    snprintf(copy, sizeof(copy), "%s", spec);
+
+    char *saveptr;
+    for (char *rule = strtok_r(copy, ";", &saveptr); rule; rule = strtok_r(NULL, ";", &saveptr)) {
+        char *eq = strchr(rule, '=');
+        if (!eq) return -1;
+        *eq = '\0';
+        while (*rule == ' ') rule++;
+        if (static_cache_set_cache_control(rule, eq + 1) != 0) return -1;
+    }
+    return 0;
+}
+
+const char *static_cache_control_for(const char *path) {
+    const char *extension = strrchr(path, '.');
+    if (extension && !strchr(extension, '/')) {
+        for (int i = 0; i < cache_control_count; i++) {
+            if (strcasecmp(cache_control_rules[i].extension, extension) == 0) {
+                return cache_control_rules[i].value;
+            }
+        }
+    }
+    return default_cache_control;
+}
+
+static unsigned long hash_key(const char *key) {
+    unsigned long hash = 14695981039346656037UL;  // FNV-1a
+    while (*key) {
+        hash ^= (unsigned char)*key++;
+        hash *= 1099511628211UL;
+    }
+    return hash;
+}
+
+static cache_shard_t *shard_for(unsigned long hash) {
+    return &shards[hash % STATIC_CACHE_SHARDS];
+}
+
+static size_t bucket_for(unsigned long hash) {
+    return (hash / STATIC_CACHE_SHARDS) % SHARD_BUCKETS;
+}
+
+static size_t asset_cost(const static_asset_t *asset) {
+    return sizeof(*asset) + asset->size + asset->headers_len;
+}
+
+static void free_asset(static_asset_t *asset) {
+    free(asset->key);
+    free(asset->resolved_path);
+    free(asset->headers);
+    free(asset->data);
+    free(asset);
+}
+
+static void lru_remove(cache_shard_t *shard, static_asset_t *asset) {
+    if (asset->lru_prev) asset->lru_prev->lru_next = asset->lru_next;
+    else shard->lru_head = asset->lru_next;
+    if (asset->lru_next) asset->lru_next->lru_prev = asset->lru_prev;
+    else shard->lru_tail = asset->lru_prev;
+    asset->lru_prev = asset->lru_next = NULL;
+}
+
+static void lru_push_front(cache_shard_t *shard, static_asset_t *asset) {
+    asset->lru_prev = NULL;
+    asset->lru_next = shard->lru_head;
+    if (shard->lru_head) shard->lru_head->lru_prev = asset;
+    else shard->lru_tail = asset;
+    shard->lru_head = asset;
+}
+
+// Drop an entry from the table; it is freed once the last reader releases it.
+// Called with the shard locked.
+static void unlink_asset(cache_shard_t *shard, static_asset_t *asset) {
+    if (!asset->linked) return;
+
+    static_asset_t **link = &shard->buckets[bucket_for(asset->hash)];
+    while (*link && *link != asset) link = &(*link)->hash_next;
+    if (*link) *link = asset->hash_next;
+    asset->hash_next = NULL;
+
+    if (asset->state == ENTRY_READY) {
+        lru_remove(shard, asset);
+        shard->bytes -= asset_cost(asset);
+    }
+    asset->linked = 0;
+
+    if (asset->refcount == 0) {
+        free_asset(asset);
+    }
+}
+
+// Watch the directory holding a cached file so edits invalidate it
+static int watch_directory(const char *resolved_path) {
+    if (inotify_fd < 0) return -1;
+
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", resolved_path);
+    char *dir_name = dirname(dir);
+
+    pthread_mutex_lock(&watch_mutex);
+    for (int i = 0; i < watch_count; i++) {
+        if (strcmp(watches[i].path, dir_name) == 0) {
+            pthread_mutex_unlock(&watch_mutex);
+            return 0;
+        }
+    }
+    if (watch_count == MAX_WATCHES) {
+        pthread_mutex_unlock(&watch_mutex);
+        return -1;
+    }
+
+    int wd = inotify_add_watch(inotify_fd, dir_name,
+                               IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE |
+                               IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+    if (wd < 0) {
+        pthread_mutex_unlock(&watch_mutex);
+        return -1;
+    }
+    watches[watch_count].wd = wd;
+    snprintf(watches[watch_count].path, sizeof(watches[watch_count].path), "%s", dir_name);
+    watch_count++;
+    pthread_mutex_unlock(&watch_mutex);
+    return 0;
+}
+
+// Resolve, validate and read a file into the entry. Runs without any lock
+// held; concurrent requests for the same key wait for it (single flight).
+static void load_asset(static_asset_t *asset) {
+    char full_path[PATH_MAX + 256];
+    int len;
+    if (strcmp(asset->key, "/") == 0) {
+        len = snprintf(full_path, sizeof(full_path), "%s/index.html", static_root);
+    } else {
+        len = snprintf(full_path, sizeof(full_path), "%s%s", static_root, asset->key);
+    }
+    // Request paths are no longer length-capped; never resolve a truncated one
+    if (len < 0 || (size_t)len >= sizeof(full_path)) {
+        asset->status = ASSET_NOT_FOUND;
+        return;
+    }
+
+    // Sanitize the file path to prevent directory traversal
+    char resolved_path[PATH_MAX];
+    if (realpath(full_path, resolved_path) == NULL) {
+        asset->status = ASSET_NOT_FOUND;
+        return;
+    }
+    if (strncmp(resolved_path, static_root, static_root_len) != 0 ||
+        (resolved_path[static_root_len] != '/' && resolved_path[static_root_len] != '\0')) {
+        asset->status = ASSET_FORBIDDEN;
+        return;
+    }
+
+    asset->resolved_path = strdup(resolved_path);
+    if (!asset->resolved_path) {
+        asset->status = ASSET_ERROR;
+        return;
+    }
+
+    // Start watching before reading so no change can slip in between
+    int watched = watch_directory(resolved_path) == 0;
+
+    int file_fd = open(resolved_path, O_RDONLY | O_CLOEXEC);
+    if (file_fd < 0) {
+        asset->status = ASSET_NOT_FOUND;
+        return;
+    }
+
+    struct stat st;
+    if (fstat(file_fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(file_fd);
+        asset->status = ASSET_NOT_FOUND;
+        return;
+    }
+
+    asset->inode = st.st_ino;
+    asset->mtime = st.st_mtime;
+    asset->content_type = get_content_type(resolved_path);
+    asset->cache_control = static_cache_control_for(resolved_path);
+    format_etag(&st, asset->etag, sizeof(asset->etag));
+
+    if (!watched || (size_t)st.st_size > STATIC_CACHE_MAX_ENTRY) {
+        close(file_fd);
+        asset->status = ASSET_UNCACHED;
+        return;
+    }
+
+    size_t size = st.st_size;
+    asset->data = malloc(size ? size : 1);
+    if (!asset->data) {
+        close(file_fd);
+        asset->status = ASSET_ERROR;
+        return;
+    }
+
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(file_fd, asset->data + done, size - done, done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+    close(file_fd);
+    if (done != size) {
+        asset->status = ASSET_ERROR;
+        return;
+    }
+    asset->size = size;
+
+    // Entity headers for every response built from this entry; the status
+    // line, Content-Length and Connection are added per request
+    char last_modified[64];
+    format_http_date(asset->mtime, last_modified, sizeof(last_modified));
+
+    char headers[768];
+    len = snprintf(headers, sizeof(headers),
+                       "Content-Type: %s\r\n"
+                       "ETag: %s\r\n"
+                       "Last-Modified: %s\r\n"
+                       "Cache-Control: %s\r\n"
+                       "Accept-Ranges: bytes\r\n",
+                       asset->content_type, asset->etag, last_modified, asset->cache_control);
+    asset->headers = strdup(headers);
+    if (!asset->headers) {
+        asset->status = ASSET_ERROR;
+        return;
+    }
+    asset->headers_len = len;
+    // 304 and range responses reuse the validators without Content-Type
+    asset->validators = strchr(asset->headers, '\n') + 1;
+    asset->validators_len = asset->headers_len - (asset->validators - asset->headers);
+    asset->status = ASSET_CACHED;
+}
+
+// Look up a request path, loading it on a miss. Returns a referenced entry
+// (release with static_cache_release) or NULL with the failure in *status.
+static_asset_t *static_cache_get(const char *path, asset_status_t *status) {
+    if (!cache_ready) {
+        *status = ASSET_ERROR;
+        return NULL;
+    }
+
+    unsigned long hash = hash_key(path);
+    cache_shard_t *shard = shard_for(hash);
+
+    pthread_mutex_lock(&shard->mutex);
+    static_asset_t *asset = shard->buckets[bucket_for(hash)];
+    while (asset && (asset->hash != hash || strcmp(asset->key, path) != 0)) {
+        asset = asset->hash_next;
+    }
+
+    if (asset) {
+        asset->refcount++;
+        while (asset->state == ENTRY_LOADING) {
+            pthread_cond_wait(&shard->loaded, &shard->mutex);
+        }
+        if (asset->state == ENTRY_READY && asset->linked) {
+            lru_remove(shard, asset);
+            lru_push_front(shard, asset);
+        }
+    } else {
+        // Miss: publish a placeholder so concurrent misses wait for this load
+        asset = calloc(1, sizeof(static_asset_t));
+        if (!asset || !(asset->key = strdup(path))) {
+            pthread_mutex_unlock(&shard->mutex);
+            free(asset);
+            *status = ASSET_ERROR;
+            return NULL;
+        }
+        asset->hash = hash;
+        asset->state = ENTRY_LOADING;
+        asset->refcount = 1;
+        asset->linked = 1;
+        asset->hash_next = shard->buckets[bucket_for(hash)];
+        shard->buckets[bucket_for(hash)] = asset;
+        pthread_mutex_unlock(&shard->mutex);
+
+        load_asset(asset);
+
+        pthread_mutex_lock(&shard->mutex);
+        int ok = asset->status == ASSET_CACHED || asset->status == ASSET_UNCACHED;
+        if (!ok) {
+            // Misses are not cached; waiters still see this result
+            asset->state = ENTRY_FAILED;
+            unlink_asset(shard, asset);
+        } else {
+            asset->state = ENTRY_READY;
+            if (asset->linked) {
+                lru_push_front(shard, asset);
+                shard->bytes += asset_cost(asset);
+
+                // Evict least recently used entries beyond the byte budget
+                while (shard->bytes > shard_budget && shard->lru_tail != asset) {
+                    unlink_asset(shard, shard->lru_tail);
+                }
+            }
+        }
+        pthread_cond_broadcast(&shard->loaded);
+    }
+
+    *status = asset->status;
+    if (asset->state == ENTRY_FAILED) {
+        if (--asset->refcount == 0 && !asset->linked) {
+            free_asset(asset);
+        }
+        pthread_mutex_unlock(&shard->mutex);
+        return NULL;
+    }
+    pthread_mutex_unlock(&shard->mutex);
+    return asset;
+}
+
+void static_cache_release(static_asset_t *asset) {
+    if (!asset) return;
+
+    cache_shard_t *shard = shard_for(asset->hash);
+    pthread_mutex_lock(&shard->mutex);
+    if (--asset->refcount == 0 && !asset->linked) {
+        free_asset(asset);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+// Drop every entry for a file (NULL drops everything). Entries still loading
+// are dropped too, since they may have read the old contents.
+void static_cache_invalidate(const char *resolved_path) {
+    for (int s = 0; s < STATIC_CACHE_SHARDS; s++) {
+        cache_shard_t *shard = &shards[s];
+        pthread_mutex_lock(&shard->mutex);
+        for (int b = 0; b < SHARD_BUCKETS; b++) {
+            static_asset_t *asset = shard->buckets[b];
+            while (asset) {
+                static_asset_t *next = asset->hash_next;
+                if (!resolved_path || asset->state == ENTRY_LOADING ||
+                    (asset->resolved_path && strcmp(asset->resolved_path, resolved_path) == 0)) {
+                    unlink_asset(shard, asset);
+                }
+                asset = next;
+            }
+        }
+        pthread_mutex_unlock(&shard->mutex);
+    }
+}
+
+// Turn inotify events into invalidations
+static void *watch_thread(void *arg) {
+    (void)arg;
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (1) {
+        ssize_t len = read(inotify_fd, buffer, sizeof(buffer));
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            perror("inotify read");
+            return NULL;
+        }
+
+        for (char *ptr = buffer; ptr < buffer + len; ) {
+            struct inotify_event *event = (struct inotify_event *)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                static_cache_invalidate(NULL);
+                continue;
+            }
+            if (event->len == 0) continue;
+
+            char changed[PATH_MAX * 2];
+            changed[0] = '\0';
+            pthread_mutex_lock(&watch_mutex);
+            for (int i = 0; i < watch_count; i++) {
+                if (watches[i].wd == event->wd) {
+                    snprintf(changed, sizeof(changed), "%s/%s", watches[i].path, event->name);
+                    break;
+                }
+            }
+            pthread_mutex_unlock(&watch_mutex);
+
+            if (changed[0]) {
+                static_cache_invalidate(changed);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+int static_cache_init(const char *root, size_t budget) {
+    if (realpath(root, static_root) == NULL) {
+        perror("static root");
+        return -1;
+    }
+    static_root_len = strlen(static_root);
+    shard_budget = budget / STATIC_CACHE_SHARDS;
+
+    for (int i = 0; i < STATIC_CACHE_SHARDS; i++) {
+        pthread_mutex_init(&shards[i].mutex, NULL);
+        pthread_cond_init(&shards[i].loaded, NULL);
+    }
+
+    // Without inotify everything is served uncached, so edits are never missed
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        perror("inotify_init1");
+    } else {
+        pthread_t watcher;
+        if (pthread_create(&watcher, NULL, watch_thread, NULL) != 0) {
+            close(inotify_fd);
+            inotify_fd = -1;
+        } else {
+            pthread_detach(watcher);
+        }
+    }
+
+    cache_ready = 1;
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "utils/trace.h"
+
+// The slowest requests seen during one window, unordered
+typedef struct {
+    uint64_t window;
+    int count;
+    slow_request_t entries[SLOW_REQUEST_SLOTS];
+} slow_window_t;
+
+// Two windows alternate: the current one fills while the previous one is
+// still reported
+static slow_window_t windows[2];
+static pthread_mutex_t slow_mutex = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic uint64_t current_window = 0;
+// Once the current window is full, requests this fast cannot get in; it
+// keeps the lock off the common path
+static _Atomic uint32_t slow_floor_us = 0;
+
+static const char *phase_names[PHASE_COUNT] = {
+    "accept", "handshake", "read", "parse", "queue", "handler", "write"
+};
+
+const char *trace_phase_name(trace_phase_t phase) {
+    return phase_names[phase];
+}
+
+static uint64_t window_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec / SLOW_WINDOW_SEC + 1;
+}
+
+static uint32_t clamp_us(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    return us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+}
+
+// Index of the fastest entry of a full window
+static int fastest_entry(const slow_window_t *w) {
+    int min = 0;
+    for (int i = 1; i < w->count; i++) {
+        if (w->entries[i].total_us < w->entries[min].total_us) {
+            min = i;
+        }
+    }
+    return min;
+}
+
+// Offer a finished request to the slow-request table
+void trace_slow_request(const request_trace_t *trace, uint64_t total_ns, const peer_addr_t *peer,
+                        const char *method, const char *path, int status) {
+    uint32_t total_us = clamp_us(total_ns);
+    uint64_t window = window_now();
+    if (window == atomic_load_explicit(&current_window, memory_order_relaxed) &&
+        total_us <= atomic_load_explicit(&slow_floor_us, memory_order_relaxed)) {
+        return;
+    }
+
+    pthread_mutex_lock(&slow_mutex);
+    slow_window_t *w = &windows[window & 1];
+    if (w->window != window) {
+        w->window = window;
+        w->count = 0;
+        atomic_store(&slow_floor_us, 0);
+        atomic_store(&current_window, window);
+    }
+
+    int slot;
+    if (w->count < SLOW_REQUEST_SLOTS) {
+        slot = w->count++;
+    } else {
+        slot = fastest_entry(w);
+        if (w->entries[slot].total_us >= total_us) {
+            pthread_mutex_unlock(&slow_mutex);
+            return;
+        }
+    }
+
+    slow_request_t *entry = &w->entries[slot];
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    entry->timestamp_ns = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+    entry->total_us = total_us;
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        entry->phase_us[p] = clamp_us(trace->phase_ns[p]);
+    }
+    entry->status = (uint16_t)status;
+    if (peer) {
+        entry->peer = *peer;
+    } else {
+        memset(&entry->peer, 0, sizeof(entry->peer));
+    }
+    strncpy(entry->method, method ? method : "-", sizeof(entry->method) - 1);
+    entry->method[sizeof(entry->method) - 1] = '\0';
+    const char *p = path ? path : "-";
+    size_t len = strnlen(p, SLOW_PATH_MAX);
+    memcpy(entry->path, p, len);
+    entry->path_len = (uint16_t)len;
+
+    if (w->count == SLOW_REQUEST_SLOTS) {
+        atomic_store(&slow_floor_us, w->entries[fastest_entry(w)].total_us);
+    }
+    pthread_mutex_unlock(&slow_mutex);
+}
+
+static int slower_first(const void *a, const void *b) {
+    uint32_t x = ((const slow_request_t *)a)->total_us;
+    uint32_t y = ((const slow_request_t *)b)->total_us;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// Copy up to max of the slowest requests from the current and previous
+// windows, slowest first. Returns how many were copied.
+int trace_get_slow_requests(slow_request_t *out, int max) {
+    slow_request_t all[2 * SLOW_REQUEST_SLOTS];
+    int count = 0;
+    uint64_t window = window_now();
+
+    pthread_mutex_lock(&slow_mutex);
+    for (int i = 0; i < 2; i++) {
+        const slow_window_t *w = &windows[i];
+        if (w->count > 0 && w->window + 1 >= window) {
+            memcpy(all + count, w->entries, w->count * sizeof(slow_request_t));
+            count += w->count;
+        }
+    }
+    pthread_mutex_unlock(&slow_mutex);
+
+    qsort(all, count, sizeof(slow_request_t), slower_first);
+    if (count > max) {
+        count = max;
+    }
+    memcpy(out, all, count * sizeof(slow_request_t));
+    return count;
+}
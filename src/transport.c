@@ -0,0 +1,398 @@
+#define _GNU_SOURCE
+#include "utils/transport.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+
+#ifdef USE_SSL
+#include "utils/ssl.h"
+#endif
+
+// Sockets are non-blocking and nothing here waits for them. Whatever a
+// socket does not take is copied onto the caller's backlog, which the
+// reactor sends once epoll reports the socket writable; without a backlog
+// the rest is dropped and the call fails with EAGAIN.
+
+static transport_chunk_t *queue_chunk(transport_queue_t *backlog, size_t data_len) {
+    transport_chunk_t *chunk = malloc(sizeof(transport_chunk_t) + data_len);
+    if (!chunk) {
+        return NULL;
+    }
+    chunk->next = NULL;
+    chunk->file_fd = -1;
+    chunk->offset = 0;
+    chunk->len = data_len;
+    if (backlog->tail) {
+        backlog->tail->next = chunk;
+    } else {
+        backlog->head = chunk;
+    }
+    backlog->tail = chunk;
+    return chunk;
+}
+
+// Copy buffers onto the backlog, together as one chunk
+static int queue_iov(transport_queue_t *backlog, const struct iovec *iov, int iovcnt) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    transport_chunk_t *chunk = queue_chunk(backlog, total);
+    if (!chunk) {
+        return -1;
+    }
+    char *dst = chunk->data;
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+        dst += iov[i].iov_len;
+    }
+    return 0;
+}
+
+// Queue a file range on a descriptor of the backlog's own, since the
+// caller's is closed once the response is built
+static int queue_file(transport_queue_t *backlog, int file_fd, off_t offset, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    int fd = fcntl(file_fd, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    transport_chunk_t *chunk = queue_chunk(backlog, 0);
+    if (!chunk) {
+        close(fd);
+        return -1;
+    }
+    chunk->file_fd = fd;
+    chunk->offset = offset;
+    chunk->len = len;
+    return 0;
+}
+
+static void queue_pop(transport_queue_t *backlog) {
+    transport_chunk_t *chunk = backlog->head;
+    backlog->head = chunk->next;
+    if (!backlog->head) {
+        backlog->tail = NULL;
+    }
+    if (chunk->file_fd >= 0) {
+        close(chunk->file_fd);
+    }
+    free(chunk);
+}
+
+void transport_queue_clear(transport_queue_t *backlog) {
+    while (backlog->head) {
+        queue_pop(backlog);
+    }
+}
+
+// Bytes still waiting, file ranges included
+size_t transport_queue_bytes(const transport_queue_t *backlog) {
+    size_t bytes = 0;
+    for (const transport_chunk_t *chunk = backlog->head; chunk; chunk = chunk->next) {
+        bytes += chunk->len;
+    }
+    return bytes;
+}
+
+// The socket is full and there is no backlog to keep the rest
+static int would_block(void) {
+    errno = EAGAIN;
+    return -1;
+}
+
+// Queue the unsent end of a buffer and the buffers after it
+static int defer(transport_queue_t *backlog, const char *data, size_t len,
+                 const struct iovec *iov, int iovcnt) {
+    if (!backlog) {
+        return would_block();
+    }
+    struct iovec rest = { (void *)data, len };
+    if (queue_iov(backlog, &rest, 1) != 0 || queue_iov(backlog, iov, iovcnt) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Write from a buffer until it is done or the socket is full: the number
+// of bytes written, or -1 on error. A TLS write that stops short must be
+// repeated with the same bytes, so the unsent end is queued from exactly
+// where it stopped and sent again the same way.
+static ssize_t send_some(int client_fd, void *ssl, const char *data, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        size_t left = len - done;
+        ssize_t written;
+#ifdef USE_SSL
+        if (ssl) {
+            written = ssl_write((SSL*)ssl, data + done, left > INT_MAX ? INT_MAX : (int)left);
+        } else {
+            written = write(client_fd, data + done, left);
+        }
+#else
+        (void)ssl;
+        written = write(client_fd, data + done, left);
+#endif
+        if (written > 0) {
+            done += written;
+            continue;
+        }
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        return -1;
+    }
+    return done;
+}
+
+#ifdef USE_SSL
+// Copy small buffers together so a response becomes as few TLS records as
+// possible; anything a record can't hold goes out as is
+static int tls_writev(void *ssl, struct iovec *iov, int iovcnt, transport_queue_t *backlog) {
+    char record[TLS_RECORD_SIZE];
+    size_t pending = 0;
+    for (int i = 0; i <= iovcnt; i++) {
+        size_t len = i < iovcnt ? iov[i].iov_len : 0;
+        if (pending > 0 && (i == iovcnt || pending + len > sizeof(record))) {
+            ssize_t sent = send_some(-1, ssl, record, pending);
+            if (sent < 0) {
+                return -1;
+            }
+            if ((size_t)sent < pending) {
+                return defer(backlog, record + sent, pending - sent, iov + i, iovcnt - i);
+            }
+            pending = 0;
+        }
+        if (i == iovcnt) {
+            break;
+        }
+        if (len >= sizeof(record)) {
+            ssize_t sent = send_some(-1, ssl, iov[i].iov_base, len);
+            if (sent < 0) {
+                return -1;
+            }
+            if ((size_t)sent < len) {
+                return defer(backlog, (char *)iov[i].iov_base + sent, len - sent,
+                             iov + i + 1, iovcnt - i - 1);
+            }
+            continue;
+        }
+        memcpy(record + pending, iov[i].iov_base, len);
+        pending += len;
+    }
+    return 0;
+}
+#endif
+
+// Write all buffers, in order, as far as the socket takes them; the rest
+// goes on the backlog. iov is consumed (advanced) as data goes out.
+// Returns 0 when everything was written or queued.
+int transport_writev(int client_fd, void *ssl, struct iovec *iov, int iovcnt,
+                     transport_queue_t *backlog) {
+    // Earlier output is still waiting; this has to go after it
+    if (backlog && backlog->head) {
+        return queue_iov(backlog, iov, iovcnt);
+    }
+#ifdef USE_SSL
+    if (ssl) {
+        return tls_writev(ssl, iov, iovcnt, backlog);
+    }
+#else
+    (void)ssl;
+#endif
+
+    while (iovcnt > 0) {
+        ssize_t written = writev(client_fd, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return defer(backlog, NULL, 0, iov, iovcnt);
+            }
+            return -1;
+        }
+
+        // Skip fully written buffers, then trim a partially written one
+        while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return 0;
+}
+
+// Send a file range on either kind of connection, as far as the socket
+// takes it, and queue the rest. Plain HTTP goes straight from the page
+// cache; TLS has to encrypt in user space, so it streams through a
+// record-sized buffer instead.
+int transport_send_file(int client_fd, void *ssl, int file_fd, off_t offset, size_t len,
+                        transport_queue_t *backlog) {
+    if (backlog && backlog->head) {
+        return queue_file(backlog, file_fd, offset, len);
+    }
+#ifdef USE_SSL
+    if (ssl) {
+        char chunk[TLS_RECORD_SIZE];
+        off_t end = offset + len;
+        while (offset < end) {
+            size_t want = end - offset < (off_t)sizeof(chunk) ? (size_t)(end - offset) : sizeof(chunk);
+            ssize_t n = pread(file_fd, chunk, want, offset);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return -1;
+            }
+            ssize_t sent = send_some(client_fd, ssl, chunk, n);
+            if (sent < 0) {
+                return -1;
+            }
+            offset += n;
+            if (sent < n) {
+                if (defer(backlog, chunk + sent, n - sent, NULL, 0) != 0) {
+                    return -1;
+                }
+                return queue_file(backlog, file_fd, offset, end - offset);
+            }
+        }
+        return 0;
+    }
+#else
+    (void)ssl;
+#endif
+
+    while (len > 0) {
+        ssize_t sent = sendfile(client_fd, file_fd, &offset, len);
+        if (sent > 0) {
+            len -= sent;
+            continue;
+        }
+        if (sent == 0) {
+            // File shrank underneath us; the peer will see a short body
+            return -1;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            if (!backlog) {
+                return would_block();
+            }
+            return queue_file(backlog, file_fd, offset, len);
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+// Send the backlog while the socket takes it. Returns 0 once it is empty,
+// 1 when the socket is full again (wait for EPOLLOUT), -1 on error.
+int transport_flush(int client_fd, void *ssl, transport_queue_t *backlog) {
+    while (backlog->head) {
+        transport_chunk_t *chunk = backlog->head;
+        if (chunk->len == 0) {
+            queue_pop(backlog);
+            continue;
+        }
+
+        if (chunk->file_fd < 0) {
+            ssize_t sent = send_some(client_fd, ssl, chunk->data + chunk->offset, chunk->len);
+            if (sent < 0) {
+                return -1;
+            }
+            chunk->offset += sent;
+            chunk->len -= sent;
+            if (chunk->len > 0) {
+                return 1;
+            }
+            continue;
+        }
+
+#ifdef USE_SSL
+        if (ssl) {
+            // Encryption needs the bytes in memory: read the next record
+            // into a chunk of its own, ahead of the rest of the range
+            size_t want = chunk->len < TLS_RECORD_SIZE ? chunk->len : TLS_RECORD_SIZE;
+            transport_chunk_t *record = malloc(sizeof(transport_chunk_t) + want);
+            if (!record) {
+                return -1;
+            }
+            ssize_t n;
+            do {
+                n = pread(chunk->file_fd, record->data, want, chunk->offset);
+            } while (n < 0 && errno == EINTR);
+            if (n <= 0) {
+                free(record);
+                return -1;
+            }
+            record->next = chunk;
+            record->file_fd = -1;
+            record->offset = 0;
+            record->len = n;
+            backlog->head = record;
+            chunk->offset += n;
+            chunk->len -= n;
+            continue;
+        }
+#endif
+
+        ssize_t sent = sendfile(client_fd, chunk->file_fd, &chunk->offset, chunk->len);
+        if (sent > 0) {
+            chunk->len -= sent;
+            continue;
+        }
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 1;
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+// Disable Nagle: responses are gathered before they are written, so small
+// segments are complete responses and must not wait for the peer's ACK
+int transport_set_nodelay(int client_fd) {
+    int on = 1;
+    return setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+// Hold back partial frames while a response is written in several steps
+// (headers, then sendfile); uncorking pushes out whatever is left
+int transport_cork(int client_fd, void *ssl, int cork) {
+#ifdef USE_SSL
+    if (ssl && client_fd < 0) {
+        client_fd = SSL_get_fd((SSL*)ssl);
+    }
+#else
+    (void)ssl;
+#endif
+    return setsockopt(client_fd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+}
@@ -0,0 +1,1300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "utils/user_store.h"
+#include "utils/epoch.h"
+#include "utils/json.h"
+
+// Index entries pack the id (high 32 bits) with its slot (low 32 bits);
+// 0 marks an empty bucket and all ones a deleted one
+#define INDEX_EMPTY 0
+#define INDEX_TOMBSTONE UINT64_MAX
+
+// Logged changes: a put carries the user's whole record after a create or
+// update (op, id, then name, email and created_at as a length byte and the
+// bytes), a delete just the id. Both are idempotent, so replaying them over
+// a snapshot that already has some of them is harmless.
+#define LOG_PUT 1
+#define LOG_DELETE 2
+#define LOG_PUT_MAX (5 + 3 + sizeof(((user_t *)0)->name) + sizeof(((user_t *)0)->email) + \
+                     sizeof(((user_t *)0)->created_at))
+
+#define LOG_NAME "users"
+#define SNAPSHOT_FILE "users.snap"
+#define SNAPSHOT_TEMP "users.snap.tmp"
+#define SNAPSHOT_MAGIC "USRSNAP1"
+
+// users.snap: this header, then count user_t records in id order, so
+// recovery can map the file and read records in place
+typedef struct {
+    char magic[8];
+    uint32_t record_size;
+    uint32_t crc;                // CRC32C of the records
+    uint64_t count;
+    uint64_t wal_seq;            // first WAL segment the snapshot may lack
+    int32_t next_id;
+    uint32_t reserved;
+} snapshot_header_t;
+
+// A user's JSON is rendered when the record is written and kept in the
+// slab record, up to this many bytes; longer renderings (long, escape-heavy
+// names and emails) are allocated separately
+#define USER_JSON_INLINE 160
+// Keys and id, plus every string byte escaped at its longest
+#define USER_JSON_MAX (64 + JSON_ESCAPED_MAX(sizeof(user_t)))
+
+// A slab record holds a user and its JSON, or links the free list once
+// released. Published records are never written again: updates publish a
+// copy.
+typedef union user_record {
+    struct {
+        user_t user;
+        uint32_t json_len;
+        char *json;                          // json_inline or the heap
+        char json_inline[USER_JSON_INLINE];
+    };
+    union user_record *next_free;
+} user_record_t;
+
+typedef struct user_slab {
+    struct user_slab *next;
+    user_record_t records[USER_SLAB_RECORDS];
+} user_slab_t;
+
+// Users in id order. A deleted user keeps its slot (and id) with no record
+// until the slots are compacted, so ids stay sorted for list cursors.
+typedef struct {
+    int id;
+    _Atomic(user_record_t *) record;
+} user_slot_t;
+
+typedef struct {
+    size_t cap;
+    _Atomic size_t count;        // slots published to readers
+    user_slot_t entries[];
+} slot_array_t;
+
+typedef struct {
+    size_t cap;
+    size_t used;                 // live entries and tombstones (writer only)
+    size_t tombstones;           // writer only
+    _Atomic uint64_t entries[];
+} id_index_t;
+
+// What readers see: an index and the slots it points into. Writers change
+// both in place where a reader only ever observes a whole entry, and
+// publish a new view when either has to be rebuilt or grown. Readers take
+// no lock; an epoch keeps whatever they reached alive until they leave.
+typedef struct {
+    id_index_t *index;
+    id_index_t *emails;
+    slot_array_t *slots;
+} store_view_t;
+
+static _Atomic(store_view_t *) current_view = NULL;
+
+// Writers serialize among themselves; everything below is theirs
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static epoch_limbo_t limbo = {0};
+
+static user_slab_t *slabs = NULL;
+static size_t json_heap_bytes = 0;      // renderings too long for their record
+static size_t slab_count = 0;
+static size_t slab_used = 0;         // records handed out from the newest slab
+static user_record_t *free_records = NULL;
+
+static size_t live_users = 0;
+static size_t slot_tombstones = 0;
+static int next_id = 1;
+
+// Persistence. Writers log under the writer lock; persisting only changes
+// with both the writer lock and persist_mutex held.
+static int persisting = 0;
+static wal_t wal;
+static char persist_dir[WAL_PATH_MAX];
+static user_store_persist_t persist_config;
+static pthread_mutex_t persist_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t persist_cond;
+static pthread_t snapshot_thread;
+static int snapshot_stop = 0;
+static uint64_t last_snapshot_ms = 0;
+static user_store_persist_stats_t persist_stats;
+
+static inline size_t hash_id(int id) {
+    uint64_t x = (uint64_t)(uint32_t)id * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(x ^ (x >> 32));
+}
+
+static inline uint64_t index_entry(int id, size_t slot) {
+    return ((uint64_t)(uint32_t)id << 32) | (uint32_t)slot;
+}
+
+// Bucket holding the id, or -1; the slot is read from the same entry
+static long index_find(const id_index_t *index, int id, size_t *slot) {
+    size_t mask = index->cap - 1;
+    for (size_t i = hash_id(id) & mask;; i = (i + 1) & mask) {
+        uint64_t entry = atomic_load_explicit(&index->entries[i], memory_order_acquire);
+        if (entry == INDEX_EMPTY) {
+            return -1;
+        }
+        if (entry != INDEX_TOMBSTONE && (int)(entry >> 32) == id) {
+            *slot = (uint32_t)entry;
+            return (long)i;
+        }
+    }
+}
+
+// Store an entry in the first empty or deleted bucket on its path. The
+// release store publishes whatever it points to.
+static void index_put(id_index_t *index, size_t hash, uint64_t new_entry) {
+    size_t mask = index->cap - 1;
+    size_t i = hash & mask;
+    uint64_t entry;
+    while ((entry = atomic_load_explicit(&index->entries[i], memory_order_relaxed)) != INDEX_EMPTY &&
+           entry != INDEX_TOMBSTONE) {
+        i = (i + 1) & mask;
+    }
+    if (entry == INDEX_TOMBSTONE) {
+        index->tombstones--;
+    } else {
+        index->used++;
+    }
+    atomic_store_explicit(&index->entries[i], new_entry, memory_order_release);
+}
+
+// Insert an id known to be absent
+static void index_insert(id_index_t *index, int id, size_t slot) {
+    index_put(index, hash_id(id), index_entry(id, slot));
+}
+
+// A new index over the live slots
+static id_index_t *index_build(const slot_array_t *slots, size_t cap) {
+    id_index_t *index = calloc(1, sizeof(id_index_t) + cap * sizeof(uint64_t));
+    if (!index) {
+        return NULL;
+    }
+    index->cap = cap;
+    size_t count = atomic_load_explicit(&slots->count, memory_order_relaxed);
+    for (size_t s = 0; s < count; s++) {
+        if (atomic_load_explicit(&slots->entries[s].record, memory_order_relaxed)) {
+            index_insert(index, slots->entries[s].id, s);
+        }
+    }
+    return index;
+}
+
+// The email index has the same layout, keyed by a hash of the lowercased
+// email (high 32 bits) and holding the user's id (low 32 bits). A hash
+// match only narrows the search; the record itself confirms the email.
+// Empty emails are not indexed.
+static inline uint32_t hash_email(const char *email) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (const unsigned char *p = (const unsigned char *)email; *p; p++) {
+        unsigned char c = *p;
+        if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        h = (h ^ c) * 0x100000001b3ULL;
+    }
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+static inline uint64_t email_entry(uint32_t hash, int id) {
+    return ((uint64_t)hash << 32) | (uint32_t)id;
+}
+
+static void email_insert(id_index_t *emails, const char *email, int id) {
+    if (email[0]) {
+        uint32_t hash = hash_email(email);
+        index_put(emails, hash_id((int)hash), email_entry(hash, id));
+    }
+}
+
+static void email_remove(id_index_t *emails, const char *email, int id) {
+    if (!email[0]) {
+        return;
+    }
+    uint32_t hash = hash_email(email);
+    uint64_t wanted = email_entry(hash, id);
+    size_t mask = emails->cap - 1;
+    for (size_t i = hash_id((int)hash) & mask;; i = (i + 1) & mask) {
+        uint64_t entry = atomic_load_explicit(&emails->entries[i], memory_order_relaxed);
+        if (entry == INDEX_EMPTY) {
+            return;
+        }
+        if (entry == wanted) {
+            atomic_store_explicit(&emails->entries[i], INDEX_TOMBSTONE, memory_order_release);
+            emails->tombstones++;
+            return;
+        }
+    }
+}
+
+static slot_array_t *slot_array_new(size_t cap) {
+    slot_array_t *slots = malloc(sizeof(slot_array_t) + cap * sizeof(user_slot_t));
+    if (slots) {
+        slots->cap = cap;
+        atomic_init(&slots->count, 0);
+    }
+    return slots;
+}
+
+static store_view_t *writer_view(void) {
+    return atomic_load_explicit(&current_view, memory_order_relaxed);
+}
+
+// A new email index over the live records
+static id_index_t *emails_build(const slot_array_t *slots, size_t cap) {
+    id_index_t *emails = calloc(1, sizeof(id_index_t) + cap * sizeof(uint64_t));
+    if (!emails) {
+        return NULL;
+    }
+    emails->cap = cap;
+    size_t count = atomic_load_explicit(&slots->count, memory_order_relaxed);
+    for (size_t s = 0; s < count; s++) {
+        user_record_t *record = atomic_load_explicit(&slots->entries[s].record, memory_order_relaxed);
+        if (record) {
+            email_insert(emails, record->user.email, record->user.id);
+        }
+    }
+    return emails;
+}
+
+// Swap in a view; whatever the old one held that the new one does not is
+// retired, to be freed once no reader can still be using it
+static int publish_view(id_index_t *index, id_index_t *emails, slot_array_t *slots) {
+    store_view_t *view = malloc(sizeof(store_view_t));
+    if (!view) {
+        return -1;
+    }
+    view->index = index;
+    view->emails = emails;
+    view->slots = slots;
+    store_view_t *old = atomic_exchange_explicit(&current_view, view, memory_order_acq_rel);
+    if (old) {
+        if (old->index != index) epoch_retire(&limbo, old->index, free);
+        if (old->emails != emails) epoch_retire(&limbo, old->emails, free);
+        if (old->slots != slots) epoch_retire(&limbo, old->slots, free);
+        epoch_retire(&limbo, old, free);
+    }
+    return 0;
+}
+
+// Room for one more index entry below the load limit; a rebuilt index is
+// at most half as full as the limit
+static int index_reserve(void) {
+    store_view_t *view = writer_view();
+    id_index_t *index = view->index;
+    if ((index->used + 1) * 100 <= index->cap * USER_INDEX_MAX_LOAD_PERCENT) {
+        return 0;
+    }
+    size_t cap = index->cap;
+    while ((live_users + 1) * 200 > cap * USER_INDEX_MAX_LOAD_PERCENT) {
+        cap *= 2;
+    }
+    id_index_t *rebuilt = index_build(view->slots, cap);
+    if (!rebuilt || publish_view(rebuilt, view->emails, view->slots) != 0) {
+        free(rebuilt);
+        return -1;
+    }
+    return 0;
+}
+
+// The same for the email index
+static int emails_reserve(void) {
+    store_view_t *view = writer_view();
+    id_index_t *emails = view->emails;
+    if ((emails->used + 1) * 100 <= emails->cap * USER_INDEX_MAX_LOAD_PERCENT) {
+        return 0;
+    }
+    size_t cap = emails->cap;
+    while ((live_users + 1) * 200 > cap * USER_INDEX_MAX_LOAD_PERCENT) {
+        cap *= 2;
+    }
+    id_index_t *rebuilt = emails_build(view->slots, cap);
+    if (!rebuilt || publish_view(view->index, rebuilt, view->slots) != 0) {
+        free(rebuilt);
+        return -1;
+    }
+    return 0;
+}
+
+// Room to append a slot. The grown array keeps every position, so the
+// index carries over.
+static int slots_reserve(void) {
+    store_view_t *view = writer_view();
+    slot_array_t *slots = view->slots;
+    size_t count = atomic_load_explicit(&slots->count, memory_order_relaxed);
+    if (count < slots->cap) {
+        return 0;
+    }
+    slot_array_t *grown = slot_array_new(slots->cap * 2);
+    if (!grown) {
+        return -1;
+    }
+    for (size_t s = 0; s < count; s++) {
+        grown->entries[s].id = slots->entries[s].id;
+        atomic_init(&grown->entries[s].record,
+                    atomic_load_explicit(&slots->entries[s].record, memory_order_relaxed));
+    }
+    atomic_init(&grown->count, count);
+    if (publish_view(view->index, view->emails, grown) != 0) {
+        free(grown);
+        return -1;
+    }
+    return 0;
+}
+
+// Squeeze deleted slots out once they make up half the array. Order is
+// kept; positions change, so a new id index is built with the new slots
+// (the email index holds ids and carries over).
+// Skipped (and retried on a later delete) if memory is short.
+static void slots_compact(void) {
+    store_view_t *view = writer_view();
+    slot_array_t *slots = view->slots;
+    size_t count = atomic_load_explicit(&slots->count, memory_order_relaxed);
+    if (count < USER_COMPACT_MIN_SLOTS || slot_tombstones * 2 < count) {
+        return;
+    }
+    slot_array_t *compacted = slot_array_new(slots->cap);
+    if (!compacted) {
+        return;
+    }
+    size_t kept = 0;
+    for (size_t s = 0; s < count; s++) {
+        user_record_t *record = atomic_load_explicit(&slots->entries[s].record, memory_order_relaxed);
+        if (record) {
+            compacted->entries[kept].id = slots->entries[s].id;
+            atomic_init(&compacted->entries[kept].record, record);
+            kept++;
+        }
+    }
+    atomic_init(&compacted->count, kept);
+    id_index_t *index = index_build(compacted, view->index->cap);
+    if (!index || publish_view(index, view->emails, compacted) != 0) {
+        free(index);
+        free(compacted);
+        return;
+    }
+    slot_tombstones = 0;
+}
+
+static user_record_t *record_alloc(void) {
+    user_record_t *record;
+    if (free_records) {
+        record = free_records;
+        free_records = record->next_free;
+    } else {
+        if (!slabs || slab_used == USER_SLAB_RECORDS) {
+            user_slab_t *slab = malloc(sizeof(user_slab_t));
+            if (!slab) {
+                return NULL;
+            }
+            slab->next = slabs;
+            slabs = slab;
+            slab_count++;
+            slab_used = 0;
+        }
+        record = &slabs->records[slab_used++];
+    }
+    record->json = record->json_inline;
+    record->json_len = 0;
+    return record;
+}
+
+// Reclaim callback for retired records; runs under the writer lock
+static void record_free(void *ptr) {
+    user_record_t *record = ptr;
+    if (record->json != record->json_inline) {
+        json_heap_bytes -= record->json_len;
+        free(record->json);
+    }
+    record->next_free = free_records;
+    free_records = record;
+}
+
+static size_t append_literal(char *out, const char *literal) {
+    size_t len = strlen(literal);
+    memcpy(out, literal, len);
+    return len;
+}
+
+// Render the user's JSON into the record, escaped, in the form api.c's
+// user_to_json writes; readers then copy it out as is
+static int record_render(user_record_t *record) {
+    const user_t *user = &record->user;
+    char buf[USER_JSON_MAX];
+    size_t n = snprintf(buf, sizeof(buf), "{\"id\": %d, \"name\": \"", user->id);
+    n += json_escape(user->name, strnlen(user->name, sizeof(user->name)), buf + n);
+    n += append_literal(buf + n, "\", \"email\": \"");
+    n += json_escape(user->email, strnlen(user->email, sizeof(user->email)), buf + n);
+    n += append_literal(buf + n, "\", \"created_at\": \"");
+    n += json_escape(user->created_at, strnlen(user->created_at, sizeof(user->created_at)), buf + n);
+    n += append_literal(buf + n, "\"}");
+
+    char *json = record->json_inline;
+    if (n > USER_JSON_INLINE) {
+        json = malloc(n);
+        if (!json) {
+            return -1;
+        }
+        json_heap_bytes += n;
+    }
+    memcpy(json, buf, n);
+    record->json = json;
+    record->json_len = n;
+    return 0;
+}
+
+static void copy_field(char *dst, size_t size, const char *src) {
+    strncpy(dst, src, size - 1);
+    dst[size - 1] = '\0';
+}
+
+// Readers normally run inside an epoch; a thread that could not register
+// for one reads under the writer lock instead
+static int read_begin(void) {
+    if (epoch_enter() == 0) {
+        return 1;
+    }
+    pthread_mutex_lock(&writer_mutex);
+    return 0;
+}
+
+static void read_end(int in_epoch) {
+    if (in_epoch) {
+        epoch_exit();
+    } else {
+        pthread_mutex_unlock(&writer_mutex);
+    }
+}
+
+// The user's current record in a view, or NULL
+static user_record_t *view_lookup(const store_view_t *view, int id) {
+    size_t slot;
+    if (index_find(view->index, id, &slot) < 0 ||
+        slot >= atomic_load_explicit(&view->slots->count, memory_order_acquire)) {
+        return NULL;
+    }
+    return atomic_load_explicit(&view->slots->entries[slot].record, memory_order_acquire);
+}
+
+// The record of a user other than except_id whose email matches (ignoring
+// case), or NULL. Expected O(1): one probe run, confirmed by the record.
+static user_record_t *email_lookup(const store_view_t *view, const char *email, int except_id) {
+    if (!email[0]) {
+        return NULL;
+    }
+    uint32_t hash = hash_email(email);
+    const id_index_t *emails = view->emails;
+    size_t mask = emails->cap - 1;
+    for (size_t i = hash_id((int)hash) & mask;; i = (i + 1) & mask) {
+        uint64_t entry = atomic_load_explicit(&emails->entries[i], memory_order_acquire);
+        if (entry == INDEX_EMPTY) {
+            return NULL;
+        }
+        int id = (int)(uint32_t)entry;
+        if (entry != INDEX_TOMBSTONE && (uint32_t)(entry >> 32) == hash && id != except_id) {
+            user_record_t *record = view_lookup(view, id);
+            if (record && strcasecmp(record->user.email, email) == 0) {
+                return record;
+            }
+        }
+    }
+}
+
+// Queue a change in the WAL (writer lock held), so the log has changes in
+// the order they were published. lsn is 0 when nothing was logged.
+static int log_change(const unsigned char *buf, size_t len, uint64_t *lsn) {
+    *lsn = 0;
+    if (!persisting) {
+        return 0;
+    }
+    *lsn = wal_append(&wal, buf, len);
+    return *lsn ? 0 : -1;
+}
+
+static size_t encode_field(unsigned char *p, const char *field, size_t size) {
+    size_t len = strnlen(field, size - 1);
+    p[0] = (unsigned char)len;
+    memcpy(p + 1, field, len);
+    return len + 1;
+}
+
+static int log_put(const user_t *user, uint64_t *lsn) {
+    unsigned char buf[LOG_PUT_MAX];
+    size_t len = 5;
+    buf[0] = LOG_PUT;
+    memcpy(buf + 1, &user->id, 4);
+    len += encode_field(buf + len, user->name, sizeof(user->name));
+    len += encode_field(buf + len, user->email, sizeof(user->email));
+    len += encode_field(buf + len, user->created_at, sizeof(user->created_at));
+    return log_change(buf, len, lsn);
+}
+
+static int log_delete(int id, uint64_t *lsn) {
+    unsigned char buf[5];
+    buf[0] = LOG_DELETE;
+    memcpy(buf + 1, &id, 4);
+    return log_change(buf, sizeof(buf), lsn);
+}
+
+// After the writer lock is dropped: wait until the change is durable, as
+// far as the sync policy promises. On failure the change stays in memory
+// but may not survive a restart.
+static int log_wait(uint64_t lsn) {
+    if (lsn && wal_wait(&wal, lsn) != 0) {
+        return USER_STORE_IO_ERROR;
+    }
+    return 0;
+}
+
+int user_store_init(void) {
+    int ret = 0;
+    pthread_mutex_lock(&writer_mutex);
+    if (!writer_view()) {
+        slot_array_t *slots = slot_array_new(USER_SLOTS_INITIAL);
+        id_index_t *index = slots ? index_build(slots, USER_INDEX_INITIAL) : NULL;
+        id_index_t *emails = index ? emails_build(slots, USER_INDEX_INITIAL) : NULL;
+        if (!emails || publish_view(index, emails, slots) != 0) {
+            free(emails);
+            free(index);
+            free(slots);
+            ret = -1;
+        }
+    }
+    pthread_mutex_unlock(&writer_mutex);
+    return ret;
+}
+
+// Returns the new user's id, USER_STORE_CONFLICT if another user has the
+// email, USER_STORE_IO_ERROR or USER_STORE_NO_MEMORY, or -1 before
+// user_store_init
+int user_store_create(const char *name, const char *email) {
+    char created_at[32];
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    strftime(created_at, sizeof(created_at), "%Y-%m-%d %H:%M:%S", &tm);
+
+    pthread_mutex_lock(&writer_mutex);
+    if (!writer_view()) {
+        pthread_mutex_unlock(&writer_mutex);
+        return -1;
+    }
+    store_view_t *view;
+    user_record_t *record = NULL;
+    if (slots_reserve() != 0 || index_reserve() != 0 || emails_reserve() != 0 ||
+        !(record = record_alloc())) {
+        pthread_mutex_unlock(&writer_mutex);
+        return USER_STORE_NO_MEMORY;
+    }
+    view = writer_view();
+
+    user_t *user = &record->user;
+    memset(user, 0, sizeof(*user));
+    user->id = next_id;
+    copy_field(user->name, sizeof(user->name), name);
+    copy_field(user->email, sizeof(user->email), email);
+    memcpy(user->created_at, created_at, sizeof(created_at));
+    if (email_lookup(view, user->email, 0)) {
+        record_free(record);
+        pthread_mutex_unlock(&writer_mutex);
+        return USER_STORE_CONFLICT;
+    }
+    uint64_t lsn;
+    if (record_render(record) != 0) {
+        record_free(record);
+        pthread_mutex_unlock(&writer_mutex);
+        return USER_STORE_NO_MEMORY;
+    }
+    if (log_put(user, &lsn) != 0) {
+        record_free(record);
+        pthread_mutex_unlock(&writer_mutex);
+        return USER_STORE_IO_ERROR;
+    }
+    next_id++;
+
+    // Fill the slot, publish it to list readers, then to lookups
+    size_t pos = atomic_load_explicit(&view->slots->count, memory_order_relaxed);
+    view->slots->entries[pos].id = user->id;
+    atomic_store_explicit(&view->slots->entries[pos].record, record, memory_order_relaxed);
+    atomic_store_explicit(&view->slots->count, pos + 1, memory_order_release);
+    index_insert(view->index, user->id, pos);
+    email_insert(view->emails, user->email, user->id);
+    live_users++;
+
+    int id = user->id;
+    epoch_collect(&limbo);
+    pthread_mutex_unlock(&writer_mutex);
+    int ret = log_wait(lsn);
+    return ret == 0 ? id : ret;
+}
+
+// Copy a user out; 0 if found, -1 otherwise. Lock-free.
+int user_store_get(int id, user_t *out) {
+    int found = -1;
+    int in_epoch = read_begin();
+    store_view_t *view = atomic_load_explicit(&current_view, memory_order_acquire);
+    user_record_t *record = view ? view_lookup(view, id) : NULL;
+    if (record) {
+        *out = record->user;
+        found = 0;
+    }
+    read_end(in_epoch);
+    return found;
+}
+
+// Copy out the user with this email (any case); 0 if found, -1 otherwise.
+// Lock-free.
+int user_store_find_email(const char *email, user_t *out) {
+    int found = -1;
+    int in_epoch = read_begin();
+    store_view_t *view = atomic_load_explicit(&current_view, memory_order_acquire);
+    user_record_t *record = view ? email_lookup(view, email, 0) : NULL;
+    if (record) {
+        *out = record->user;
+        found = 0;
+    }
+    read_end(in_epoch);
+    return found;
+}
+
+// Replace the name and/or email (NULL leaves a field as is). Readers see
+// the old record or the new one, never a mix. Returns 0, -1 if there is
+// no such user, USER_STORE_CONFLICT if another user has the email, or
+// USER_STORE_IO_ERROR or USER_STORE_NO_MEMORY.
+int user_store_update(int id, const char *name, const char *email) {
+    pthread_mutex_lock(&writer_mutex);
+    store_view_t *view = writer_view();
+    size_t slot;
+    if (!view || index_find(view->index, id, &slot) < 0) {
+        pthread_mutex_unlock(&writer_mutex);
+        return -1;
+    }
+    user_record_t *record = NULL;
+    if (emails_reserve() != 0 || !(record = record_alloc())) {
+        pthread_mutex_unlock(&writer_mutex);
+        return USER_STORE_NO_MEMORY;
+    }
+    // Reserving may have published a bigger email index
+    view = writer_view();
+
+    user_slot_t *entry = &view->slots->entries[slot];
+    user_record_t *old = atomic_load_explicit(&entry->record, memory_order_relaxed);
+    record->user = old->user;
+    if (name) copy_field(record->user.name, sizeof(record->user.name), name);
+    if (email) copy_field(record->user.email, sizeof(record->user.email), email);
+    int email_changed = strcasecmp(record->user.email, old->user.email) != 0;
+    if (email_changed && email_lookup(view, record->user.email, id)) {
+        record_free(record);
+        pthread_mutex_unlock(&writer_mutex);
+        return USER_STORE_CONFLICT;
+    }
+    uint64_t lsn;
+    if (record_render(record) != 0) {
+        record_free(record);
+        pthread_mutex_unlock(&writer_mutex);
+        return USER_STORE_NO_MEMORY;
+    }
+    if (log_put(&record->user, &lsn) != 0) {
+        record_free(record);
+        pthread_mutex_unlock(&writer_mutex);
+        return USER_STORE_IO_ERROR;
+    }
+    // Lookups confirm against the record, so the new email resolves from
+    // the moment the record is published and the old one stops resolving
+    if (email_changed) email_insert(view->emails, record->user.email, id);
+    atomic_store_explicit(&entry->record, record, memory_order_release);
+    if (email_changed) email_remove(view->emails, old->user.email, id);
+    epoch_retire(&limbo, old, record_free);
+
+    epoch_collect(&limbo);
+    pthread_mutex_unlock(&writer_mutex);
+    return log_wait(lsn);
+}
+
+// The index entries and the slot become tombstones
+static void remove_slot(store_view_t *view, long bucket, size_t slot) {
+    user_slot_t *entry = &view->slots->entries[slot];
+    user_record_t *old = atomic_load_explicit(&entry->record, memory_order_relaxed);
+    email_remove(view->emails, old->user.email, old->user.id);
+    atomic_store_explicit(&view->index->entries[bucket], INDEX_TOMBSTONE, memory_order_release);
+    view->index->tombstones++;
+    atomic_store_explicit(&entry->record, NULL, memory_order_release);
+    epoch_retire(&limbo, old, record_free);
+    slot_tombstones++;
+    live_users--;
+    slots_compact();
+}
+
+// O(1). Returns 0, -1 if there is no such user, or USER_STORE_IO_ERROR.
+int user_store_delete(int id) {
+    pthread_mutex_lock(&writer_mutex);
+    store_view_t *view = writer_view();
+    size_t slot;
+    long bucket = view ? index_find(view->index, id, &slot) : -1;
+    if (bucket < 0) {
+        pthread_mutex_unlock(&writer_mutex);
+        return -1;
+    }
+    uint64_t lsn;
+    if (log_delete(id, &lsn) != 0) {
+        pthread_mutex_unlock(&writer_mutex);
+        return USER_STORE_IO_ERROR;
+    }
+    remove_slot(view, bucket, slot);
+
+    epoch_collect(&limbo);
+    pthread_mutex_unlock(&writer_mutex);
+    return log_wait(lsn);
+}
+
+// The first of the published slots with an id above after_id. Slots are
+// sorted by id, deleted ones included.
+static size_t first_slot_after(const slot_array_t *slots, size_t published, int after_id) {
+    size_t low = 0;
+    size_t high = published;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (slots->entries[mid].id <= after_id) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Copy up to max users with ids above after_id, in id order. Returns the
+// number copied; pass the last id back in to continue. Lock-free.
+int user_store_list(int after_id, user_t *out, int max) {
+    int count = 0;
+    int in_epoch = read_begin();
+    store_view_t *view = atomic_load_explicit(&current_view, memory_order_acquire);
+    if (view) {
+        slot_array_t *slots = view->slots;
+        size_t published = atomic_load_explicit(&slots->count, memory_order_acquire);
+        for (size_t s = first_slot_after(slots, published, after_id); s < published && count < max; s++) {
+            user_record_t *record = atomic_load_explicit(&slots->entries[s].record, memory_order_acquire);
+            if (record) {
+                out[count++] = record->user;
+            }
+        }
+    }
+    read_end(in_epoch);
+    return count;
+}
+
+// Hand a user's rendered JSON to emit; 0 if found, -1 otherwise. The bytes
+// are only valid during the call. Lock-free.
+int user_store_get_json(int id, user_json_fn emit, void *ctx) {
+    int found = -1;
+    int in_epoch = read_begin();
+    store_view_t *view = atomic_load_explicit(&current_view, memory_order_acquire);
+    user_record_t *record = view ? view_lookup(view, id) : NULL;
+    if (record) {
+        emit(record->user.id, record->json, record->json_len, ctx);
+        found = 0;
+    }
+    read_end(in_epoch);
+    return found;
+}
+
+// user_store_list for responses: up to max users' rendered JSON, in id
+// order, handed to emit without copying the records out first. Returns the
+// number emitted. emit runs inside the read epoch and must not block.
+int user_store_list_json(int after_id, int max, user_json_fn emit, void *ctx) {
+    int count = 0;
+    int in_epoch = read_begin();
+    store_view_t *view = atomic_load_explicit(&current_view, memory_order_acquire);
+    if (view) {
+        slot_array_t *slots = view->slots;
+        size_t published = atomic_load_explicit(&slots->count, memory_order_acquire);
+        for (size_t s = first_slot_after(slots, published, after_id); s < published && count < max; s++) {
+            user_record_t *record = atomic_load_explicit(&slots->entries[s].record, memory_order_acquire);
+            if (record) {
+                emit(record->user.id, record->json, record->json_len, ctx);
+                count++;
+            }
+        }
+    }
+    read_end(in_epoch);
+    return count;
+}
+
+void user_store_get_stats(user_store_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    pthread_mutex_lock(&writer_mutex);
+    store_view_t *view = writer_view();
+    if (view) {
+        stats->users = live_users;
+        stats->index_capacity = view->index->cap;
+        stats->index_tombstones = view->index->tombstones;
+        stats->email_index_capacity = view->emails->cap;
+        stats->email_index_tombstones = view->emails->tombstones;
+        stats->email_index_bytes = sizeof(id_index_t) + view->emails->cap * sizeof(uint64_t);
+        stats->slot_tombstones = slot_tombstones;
+        stats->slabs = slab_count;
+        stats->retired = limbo.pending;
+        stats->memory_bytes = sizeof(id_index_t) + view->index->cap * sizeof(uint64_t) +
+                              sizeof(slot_array_t) + view->slots->cap * sizeof(user_slot_t) +
+                              slab_count * sizeof(user_slab_t) + stats->email_index_bytes +
+                              json_heap_bytes;
+    }
+    pthread_mutex_unlock(&writer_mutex);
+}
+
+// --- Persistence ---
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void persist_path(char *buf, size_t size, const char *file) {
+    snprintf(buf, size, "%s/%s", persist_dir, file);
+}
+
+// Recovery only, before any reader: size an empty store for what the
+// snapshot holds so loading it never regrows
+static int store_presize(size_t users) {
+    size_t slot_cap = USER_SLOTS_INITIAL;
+    size_t index_cap = USER_INDEX_INITIAL;
+    while (slot_cap < users) {
+        slot_cap *= 2;
+    }
+    while (users * 200 > index_cap * USER_INDEX_MAX_LOAD_PERCENT) {
+        index_cap *= 2;
+    }
+    store_view_t *view = writer_view();
+    if (slot_cap <= view->slots->cap && index_cap <= view->index->cap) {
+        return 0;
+    }
+    slot_array_t *slots = slot_array_new(slot_cap);
+    id_index_t *index = slots ? index_build(slots, index_cap) : NULL;
+    id_index_t *emails = index ? emails_build(slots, index_cap) : NULL;
+    if (!emails || publish_view(index, emails, slots) != 0) {
+        free(emails);
+        free(index);
+        free(slots);
+        return -1;
+    }
+    return 0;
+}
+
+// Recovery only: make the user's record the logged one, inserting it where
+// its id belongs if it is not there yet. Emails are indexed as logged;
+// uniqueness was checked when the change was made.
+static int restore_put(const user_t *user) {
+    if (emails_reserve() != 0) {
+        return -1;
+    }
+    store_view_t *view = writer_view();
+    size_t slot;
+    user_record_t *record = record_alloc();
+    if (!record) {
+        return -1;
+    }
+    record->user = *user;
+    if (record_render(record) != 0) {
+        record_free(record);
+        return -1;
+    }
+    if (index_find(view->index, user->id, &slot) >= 0) {
+        user_slot_t *entry = &view->slots->entries[slot];
+        user_record_t *old = atomic_load_explicit(&entry->record, memory_order_relaxed);
+        if (strcasecmp(old->user.email, user->email) != 0) {
+            email_remove(view->emails, old->user.email, user->id);
+            email_insert(view->emails, user->email, user->id);
+        }
+        record_free(old);
+        atomic_store_explicit(&entry->record, record, memory_order_relaxed);
+        return 0;
+    }
+    if (slots_reserve() != 0 || index_reserve() != 0) {
+        record_free(record);
+        return -1;
+    }
+
+    view = writer_view();
+    slot_array_t *slots = view->slots;
+    size_t count = atomic_load_explicit(&slots->count, memory_order_relaxed);
+    if (count == 0 || slots->entries[count - 1].id < user->id) {
+        slots->entries[count].id = user->id;
+        atomic_store_explicit(&slots->entries[count].record, record, memory_order_relaxed);
+        atomic_store_explicit(&slots->count, count + 1, memory_order_relaxed);
+        index_insert(view->index, user->id, count);
+        email_insert(view->emails, user->email, user->id);
+        live_users++;
+        return 0;
+    }
+
+    // A create replayed over a snapshot that was taken while it was in
+    // flight can come out of id order: shift it into place and reindex
+    size_t low = 0;
+    size_t high = count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (slots->entries[mid].id < user->id) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (slots->entries[low].id == user->id) {
+        atomic_store_explicit(&slots->entries[low].record, record, memory_order_relaxed);
+        index_insert(view->index, user->id, low);
+        slot_tombstones--;
+    } else {
+        memmove(&slots->entries[low + 1], &slots->entries[low], (count - low) * sizeof(user_slot_t));
+        slots->entries[low].id = user->id;
+        atomic_store_explicit(&slots->entries[low].record, record, memory_order_relaxed);
+        atomic_store_explicit(&slots->count, count + 1, memory_order_relaxed);
+        id_index_t *index = index_build(slots, view->index->cap);
+        if (!index || publish_view(index, view->emails, slots) != 0) {
+            free(index);
+            return -1;
+        }
+    }
+    email_insert(writer_view()->emails, user->email, user->id);
+    live_users++;
+    return 0;
+}
+
+static int decode_field(const unsigned char **p, const unsigned char *end, char *field, size_t size) {
+    if (*p >= end || (size_t)**p >= size || (size_t)(end - *p) < 1 + (size_t)**p) {
+        return -1;
+    }
+    size_t len = **p;
+    memset(field, 0, size);
+    memcpy(field, *p + 1, len);
+    *p += 1 + len;
+    return 0;
+}
+
+// wal_replay callback
+static int apply_logged(const void *payload, size_t len, void *ctx) {
+    (void)ctx;
+    const unsigned char *p = payload;
+    const unsigned char *end = p + len;
+    int id;
+    if (len < 5) {
+        return -1;
+    }
+    memcpy(&id, p + 1, 4);
+    if (p[0] == LOG_DELETE) {
+        store_view_t *view = writer_view();
+        size_t slot;
+        long bucket = index_find(view->index, id, &slot);
+        if (bucket >= 0) {
+            remove_slot(view, bucket, slot);
+        }
+        return 0;
+    }
+    if (p[0] != LOG_PUT) {
+        return -1;
+    }
+
+    user_t user;
+    user.id = id;
+    p += 5;
+    if (decode_field(&p, end, user.name, sizeof(user.name)) != 0 ||
+        decode_field(&p, end, user.email, sizeof(user.email)) != 0 ||
+        decode_field(&p, end, user.created_at, sizeof(user.created_at)) != 0) {
+        return -1;
+    }
+    if (id >= next_id) {
+        next_id = id + 1;
+    }
+    return restore_put(&user);
+}
+
+// Load users.snap if there is one. wal_seq receives the first segment to
+// replay over it (0 without a snapshot).
+static int snapshot_load(uint64_t *wal_seq) {
+    char path[WAL_PATH_MAX + 32];
+    persist_path(path, sizeof(path), SNAPSHOT_FILE);
+    *wal_seq = 0;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(snapshot_header_t)) {
+        close(fd);
+        fprintf(stderr, "User store: %s is damaged\n", path);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    const char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    const snapshot_header_t *header = (const snapshot_header_t *)map;
+    const user_t *records = (const user_t *)(map + sizeof(snapshot_header_t));
+    int ret = 0;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->record_size != sizeof(user_t) ||
+        header->count != (size - sizeof(snapshot_header_t)) / sizeof(user_t) ||
+        (size - sizeof(snapshot_header_t)) % sizeof(user_t) != 0 ||
+        wal_crc32c(0, records, header->count * sizeof(user_t)) != header->crc) {
+        fprintf(stderr, "User store: %s is damaged\n", path);
+        ret = -1;
+    } else if (store_presize(header->count) != 0) {
+        ret = -1;
+    } else {
+        for (uint64_t i = 0; i < header->count && ret == 0; i++) {
+            ret = restore_put(&records[i]);
+        }
+        if (header->next_id > next_id) {
+            next_id = header->next_id;
+        }
+        *wal_seq = header->wal_seq;
+    }
+    munmap((void *)map, size);
+    return ret;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Copy every user out through the lock-free list cursor into a temporary
+// file, then rename it over users.snap
+static int snapshot_write(uint64_t wal_seq, int snap_next_id, uint64_t *users) {
+    char temp[WAL_PATH_MAX + 32];
+    char path[WAL_PATH_MAX + 32];
+    persist_path(temp, sizeof(temp), SNAPSHOT_TEMP);
+    persist_path(path, sizeof(path), SNAPSHOT_FILE);
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("User store: snapshot");
+        return -1;
+    }
+
+    snapshot_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.record_size = sizeof(user_t);
+    header.wal_seq = wal_seq;
+    header.next_id = snap_next_id;
+
+    user_t batch[USER_SNAPSHOT_BATCH];
+    int after = 0;
+    int count;
+    int ret = lseek(fd, sizeof(header), SEEK_SET) < 0 ? -1 : 0;
+    while (ret == 0 && (count = user_store_list(after, batch, USER_SNAPSHOT_BATCH)) > 0) {
+        header.crc = wal_crc32c(header.crc, batch, count * sizeof(user_t));
+        header.count += count;
+        after = batch[count - 1].id;
+        ret = write_all(fd, batch, count * sizeof(user_t));
+    }
+    if (ret == 0 && (pwrite(fd, &header, sizeof(header), 0) != sizeof(header) || fsync(fd) != 0)) {
+        ret = -1;
+    }
+    close(fd);
+    if (ret == 0 && (rename(temp, path) != 0 || wal_sync_dir(persist_dir) != 0)) {
+        ret = -1;
+    }
+    if (ret != 0) {
+        perror("User store: snapshot");
+        unlink(temp);
+        return -1;
+    }
+    *users = header.count;
+    return 0;
+}
+
+// Write a snapshot and drop the WAL segments it covers. The snapshot is
+// fuzzy: writers carry on while it is copied, and whatever they change is
+// in the segments it keeps, replayed over it at recovery.
+int user_store_snapshot(void) {
+    if (!persisting) {
+        return -1;
+    }
+    pthread_mutex_lock(&snapshot_mutex);
+    uint64_t start = monotonic_ms();
+    uint64_t seq;
+    uint64_t users = 0;
+    int ret = -1;
+    if (wal_rotate(&wal, &seq) == 0) {
+        // Writers log and publish under their lock, so once it has been
+        // taken after the rotation every change in an older segment is
+        // visible to the copy
+        pthread_mutex_lock(&writer_mutex);
+        int snap_next_id = next_id;
+        pthread_mutex_unlock(&writer_mutex);
+        ret = snapshot_write(seq, snap_next_id, &users);
+        if (ret == 0) {
+            wal_remove_before(&wal, seq);
+        }
+    }
+
+    pthread_mutex_lock(&persist_mutex);
+    last_snapshot_ms = monotonic_ms();
+    if (ret == 0) {
+        persist_stats.snapshots++;
+        persist_stats.snapshot_users = users;
+        persist_stats.snapshot_ms = last_snapshot_ms - start;
+    } else {
+        persist_stats.snapshot_failures++;
+    }
+    pthread_mutex_unlock(&persist_mutex);
+    pthread_mutex_unlock(&snapshot_mutex);
+    return ret;
+}
+
+// Checks once a second whether the WAL has grown enough, or gone long
+// enough, to be worth a snapshot
+static void *snapshot_worker(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&persist_mutex);
+    while (!snapshot_stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += 1;
+        pthread_cond_timedwait(&persist_cond, &persist_mutex, &deadline);
+        if (snapshot_stop) {
+            break;
+        }
+        wal_stats_t stats;
+        wal_get_stats(&wal, &stats);
+        uint64_t since = monotonic_ms() - last_snapshot_ms;
+        if (stats.segment_bytes < persist_config.snapshot_bytes &&
+            (stats.segment_bytes == 0 || since < (uint64_t)persist_config.snapshot_interval_sec * 1000)) {
+            continue;
+        }
+        pthread_mutex_unlock(&persist_mutex);
+        user_store_snapshot();
+        pthread_mutex_lock(&persist_mutex);
+    }
+    pthread_mutex_unlock(&persist_mutex);
+    return NULL;
+}
+
+// Set up the store and, with a directory configured, recover it from the
+// last snapshot plus the WAL after it, then log every change from here on
+int user_store_open(const user_store_persist_t *config) {
+    if (user_store_init() != 0) {
+        return -1;
+    }
+    if (!config || !config->dir || persisting) {
+        return 0;
+    }
+    if (mkdir(config->dir, 0755) != 0 && errno != EEXIST) {
+        perror("User store: data directory");
+        return -1;
+    }
+    snprintf(persist_dir, sizeof(persist_dir), "%s", config->dir);
+    persist_config = *config;
+    persist_config.dir = persist_dir;
+    if (persist_config.snapshot_bytes == 0) {
+        persist_config.snapshot_bytes = USER_SNAPSHOT_WAL_BYTES;
+    }
+    if (persist_config.snapshot_interval_sec <= 0) {
+        persist_config.snapshot_interval_sec = USER_SNAPSHOT_INTERVAL_SEC;
+    }
+    char temp[WAL_PATH_MAX + 32];
+    persist_path(temp, sizeof(temp), SNAPSHOT_TEMP);
+    unlink(temp);
+
+    uint64_t start = monotonic_ms();
+    uint64_t wal_seq;
+    uint64_t last_seq = 0;
+    long replayed = -1;
+    pthread_mutex_lock(&writer_mutex);
+    if (snapshot_load(&wal_seq) == 0) {
+        replayed = wal_replay(persist_dir, LOG_NAME, wal_seq, apply_logged, NULL, &last_seq);
+    }
+    size_t recovered = live_users;
+    epoch_collect(&limbo);
+    pthread_mutex_unlock(&writer_mutex);
+    if (replayed < 0) {
+        fprintf(stderr, "User store: recovery from %s failed\n", persist_dir);
+        return -1;
+    }
+
+    // Appends always start a fresh segment after whatever was replayed
+    uint64_t seq = last_seq + 1 > wal_seq ? last_seq + 1 : wal_seq;
+    if (wal_open(&wal, persist_dir, LOG_NAME, seq, &persist_config.wal) != 0) {
+        return -1;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&persist_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_mutex_lock(&writer_mutex);
+    pthread_mutex_lock(&persist_mutex);
+    persisting = 1;
+    snapshot_stop = 0;
+    last_snapshot_ms = monotonic_ms();
+    persist_stats.recovered_users = recovered;
+    persist_stats.replayed_records = (uint64_t)replayed;
+    persist_stats.recovery_ms = last_snapshot_ms - start;
+    pthread_mutex_unlock(&persist_mutex);
+    pthread_mutex_unlock(&writer_mutex);
+
+    if (pthread_create(&snapshot_thread, NULL, snapshot_worker, NULL) != 0) {
+        pthread_mutex_lock(&writer_mutex);
+        pthread_mutex_lock(&persist_mutex);
+        persisting = 0;
+        pthread_mutex_unlock(&persist_mutex);
+        pthread_mutex_unlock(&writer_mutex);
+        wal_close(&wal);
+        return -1;
+    }
+    return 0;
+}
+
+// Stop snapshotting and flush the WAL; later changes are memory only
+void user_store_close(void) {
+    pthread_mutex_lock(&writer_mutex);
+    pthread_mutex_lock(&persist_mutex);
+    int was_persisting = persisting;
+    persisting = 0;
+    snapshot_stop = 1;
+    pthread_cond_signal(&persist_cond);
+    pthread_mutex_unlock(&persist_mutex);
+    pthread_mutex_unlock(&writer_mutex);
+    if (!was_persisting) {
+        return;
+    }
+    pthread_join(snapshot_thread, NULL);
+    wal_close(&wal);
+}
+
+void user_store_get_persist_stats(user_store_persist_stats_t *stats) {
+    pthread_mutex_lock(&persist_mutex);
+    *stats = persist_stats;
+    stats->enabled = persisting;
+    stats->sync = persist_config.wal.sync;
+    pthread_mutex_unlock(&persist_mutex);
+    if (stats->enabled) {
+        wal_get_stats(&wal, &stats->wal);
+    }
+}
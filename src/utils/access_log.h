@@ -0,0 +1,47 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/socket.h>
+
+// Records each thread can queue before the writer catches up
+#define ACCESS_LOG_RING_SIZE 512
+// Longest path kept in a record; longer paths are truncated
+#define ACCESS_LOG_PATH_MAX 160
+// How long the writer sleeps when every ring is empty
+#define ACCESS_LOG_IDLE_MS 20
+
+// Per-request debug output, off unless SERVER_DEBUG is set
+extern int debug_logging;
+#define DEBUG_LOG(...) do { if (debug_logging) printf(__VA_ARGS__); } while (0)
+
+// Compact copy of the client address, kept with the connection
+typedef struct {
+    uint16_t family;
+    uint16_t port;
+    uint8_t addr[16];
+} peer_addr_t;
+
+typedef struct {
+    const char *path;        // file to append to; NULL or "-" for stdout
+    unsigned sample_every;   // log 1 in N successful requests (errors always)
+} access_log_config_t;
+
+typedef struct {
+    uint64_t written;
+    uint64_t dropped;        // rings were full
+    unsigned sample_every;
+} access_log_stats_t;
+
+// Function declarations
+int access_log_start(const access_log_config_t *config);
+void access_log_stop(void);
+int access_log_enabled(void);
+void peer_addr_from(const struct sockaddr *addr, peer_addr_t *peer);
+void access_log_record(const peer_addr_t *peer, const char *method, const char *path,
+                       int status, size_t bytes, uint64_t latency_ns);
+void access_log_get_stats(access_log_stats_t *stats);
+
+#endif
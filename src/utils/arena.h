@@ -0,0 +1,37 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Size of a pooled block: receive buffer plus the views of one request
+#define ARENA_BLOCK_SIZE (16 * 1024)
+// Share of a fresh block handed to the receive buffer
+#define ARENA_INITIAL_BUFFER 4096
+// Idle blocks each thread keeps for reuse
+#define ARENA_FREE_LIST_MAX 64
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    char data[];
+} arena_block_t;
+
+// Per-connection double-ended bump arena. The receive buffer grows up from
+// the bottom of the block; request views are carved down from the top, so
+// dropping them between requests is a single store. Views that don't fit
+// spill into separate blocks, freed at reset.
+typedef struct {
+    arena_block_t *block;
+    size_t bottom;           // bytes claimed by the receive buffer
+    size_t top;              // views occupy [top, block->size)
+    arena_block_t *spill;
+} arena_t;
+
+// Function declarations
+int arena_init(arena_t *arena);
+void arena_destroy(arena_t *arena);
+int arena_grow_buffer(arena_t *arena, size_t used, size_t min_size);
+void *arena_alloc(arena_t *arena, size_t size);
+void arena_reset(arena_t *arena);
+
+#endif
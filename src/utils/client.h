@@ -2,38 +2,108 @@
 #define CLIENT_H
 
 #include <pthread.h>
+#include <sys/socket.h>
+#include "event_loop.h"
+#include "work_queue.h"
 
 #ifdef USE_SSL
 #include <openssl/ssl.h>
 extern SSL_CTX *global_ssl_ctx;  // Global SSL context
 #endif
 
-// Thread pool structure
+// Pool sizing: every interval the controller compares worker utilization
+// and queue wait against these thresholds and adds or retires a worker
+#define POOL_ADJUST_INTERVAL_MS 100
+#define POOL_GROW_UTILIZATION 85     // percent busy that adds a worker
+#define POOL_SHRINK_UTILIZATION 25   // percent busy that counts as idle
+#define POOL_SHRINK_AFTER_TICKS 50   // idle intervals before retiring one
+
+// Load shedding (CoDel): once the pool is at its maximum size and queue
+// wait has stayed above the target for a whole interval, queued requests
+// are answered with 503 at an increasing rate until the wait drops
+#define CODEL_TARGET_MS 20
+#define CODEL_INTERVAL_MS 100
+#define RETRY_AFTER_SECONDS 1
+
+typedef enum {
+    POOL_HOLD,
+    POOL_GROW,
+    POOL_SHRINK
+} pool_decision_t;
+
+struct thread_pool;
+
 typedef struct {
+    struct thread_pool *pool;
+    int index;               // deque this worker owns
+    int running;             // thread started and not yet joined
+} worker_slot_t;
+
+// Thread pool structure: reactors queue connections holding a complete
+// request onto per-worker deques; idle workers steal, then park. The
+// number of workers moves between min_threads and max_threads.
+typedef struct thread_pool {
     pthread_t *threads;
-    int thread_count;
-    int *client_queue;
-#ifdef USE_SSL
-    SSL **ssl_queue;  // SSL connections for each client
-#endif
-    int queue_size;
-    int queue_front;
-    int queue_rear;
-    int queue_count;
-    pthread_mutex_t queue_mutex;
-    pthread_cond_t queue_cond;
-    int shutdown;
+    worker_slot_t *slots;
+    int min_threads;
+    int max_threads;
+    _Atomic int thread_count; // active workers
+    work_queue_t queue;
+    int queue_size;          // capacity of each worker's deque
+    pthread_t controller;
+    int controller_started;
+    _Atomic int shutdown;
+
+    // Samples for the controller, reset every interval
+    _Atomic uint64_t busy_ns;
+    _Atomic uint64_t wait_ns;
+    _Atomic uint64_t dequeued;
+
+    // CoDel state; the lock is only taken while wait is above the target
+    pthread_mutex_t codel_mutex;
+    _Atomic uint64_t codel_first_above_ns;
+    _Atomic int codel_dropping;
+    uint64_t codel_drop_next_ns;
+    unsigned codel_count;
+
+    // Reported on /metrics
+    _Atomic int last_utilization;   // percent, last interval
+    _Atomic uint64_t last_wait_us;  // mean queue wait, last interval
+    _Atomic int last_decision;      // pool_decision_t
+    _Atomic uint64_t grown;
+    _Atomic uint64_t shrunk;
+    _Atomic uint64_t shed_codel;    // 503s from the queue-delay controller
+    _Atomic uint64_t shed_full;     // 503s because every deque was full
 #ifdef USE_SSL
     SSL_CTX *ssl_ctx;  // SSL context for the thread pool
 #endif
 } thread_pool_t;
 
+// Snapshot of the pool for /metrics
+typedef struct {
+    int threads;
+    int min_threads;
+    int max_threads;
+    int utilization;
+    uint64_t queue_wait_us;
+    const char *decision;
+    int shedding;
+    uint64_t grown;
+    uint64_t shrunk;
+    uint64_t shed_codel;
+    uint64_t shed_full;
+} thread_pool_stats_t;
+
+extern thread_pool_t *global_pool;
+
 // Function declarations
-int create_client(int server_fd);
-void handle_client_request(int client_fd, void *ssl);
+int create_client(int server_fd, struct sockaddr_storage *client_addr);
+void handle_client_request(connection_t *conn);
 void *worker_thread(void *arg);
-thread_pool_t *create_thread_pool(int thread_count, int queue_size, void *ssl_ctx);
+thread_pool_t *create_thread_pool(int min_threads, int max_threads, int queue_size, void *ssl_ctx);
 void destroy_thread_pool(thread_pool_t *pool);
-int add_client_to_pool(thread_pool_t *pool, int client_fd, void *ssl);
+int add_client_to_pool(thread_pool_t *pool, connection_t *conn);
+void shed_connection(thread_pool_t *pool, connection_t *conn);
+void get_thread_pool_stats(thread_pool_t *pool, thread_pool_stats_t *stats);
 
 #endif
@@ -0,0 +1,34 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Epoch-based reclamation: readers bracket their accesses with
+// epoch_enter/epoch_exit and take no locks; writers unlink memory, retire
+// it, and it is reclaimed once every reader that might still see it has
+// left (two epoch advances later).
+
+// Retired memory waiting to be reclaimed
+typedef struct epoch_garbage {
+    struct epoch_garbage *next;
+    uint64_t epoch;                 // global epoch when it was retired
+    void *ptr;
+    void (*reclaim)(void *ptr);
+} epoch_garbage_t;
+
+// One writer's retired memory, protected by that writer's own lock
+typedef struct {
+    epoch_garbage_t *head;          // oldest first
+    epoch_garbage_t *tail;
+    size_t pending;
+} epoch_limbo_t;
+
+// Function declarations
+int epoch_enter(void);
+void epoch_exit(void);
+void epoch_retire(epoch_limbo_t *limbo, void *ptr, void (*reclaim)(void *ptr));
+size_t epoch_collect(epoch_limbo_t *limbo);
+void epoch_synchronize(void);
+
+#endif
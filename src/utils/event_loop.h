@@ -0,0 +1,88 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "parse_req.h"
+#include "arena.h"
+#include "server.h"
+#include "rate_limit.h"
+#include "access_log.h"
+#include "trace.h"
+#include "transport.h"
+
+// Upper bound on a buffered request (request line + headers + body)
+#define MAX_REQUEST_SIZE 65536
+
+// Connection lifecycle as seen by the reactor
+typedef enum {
+    CONN_DETECT,         // waiting for the first byte to tell HTTP from TLS
+    CONN_TLS_HANDSHAKE,  // non-blocking TLS handshake in progress
+    CONN_READING,        // buffering a request
+    CONN_DISPATCHED,     // full request buffered, owned by a worker
+    CONN_WRITING         // sending a response the socket did not take at once
+} conn_state_t;
+
+struct reactor;
+
+// Per-connection state owned by a reactor (or a worker while dispatched)
+typedef struct connection {
+    int fd;
+    void *ssl;
+    conn_state_t state;
+    struct reactor *reactor;
+    arena_t arena;       // owns the receive buffer and the parsed request
+    char *buffer;        // receive buffer (bottom of the arena), always NUL-terminated
+    size_t buffer_len;
+    size_t buffer_cap;
+    size_t request_len;  // length of the complete request at the buffer start
+    http_parser_t parser;  // resumes across reads of a partial request
+    int requests_served;
+    peer_addr_t peer;
+    rate_limit_key_t rate_key;  // the peer's address and prefix buckets
+    int rate_charged;           // current request already counted
+    uint64_t enqueued_ns;  // when it was queued for a worker (monotonic)
+    request_trace_t trace; // phase timing of the current request
+    transport_queue_t backlog;  // response bytes waiting for EPOLLOUT
+    int close_after_write;      // close once the backlog is sent
+    time_t last_active;  // monotonic seconds, for the idle timeout
+    struct connection *prev;  // idle list while owned by the reactor,
+    struct connection *next;  // resume list while handed back by a worker
+} connection_t;
+
+// One epoll instance and thread per core
+typedef struct reactor {
+    int epoll_fd;
+    int listen_fd;
+    int index;
+    pthread_t thread;
+    void *pool;          // thread_pool_t that runs the handlers
+    int wake_fd;         // eventfd used by workers to hand connections back
+    int inline_handlers; // run handlers on this thread instead of the pool
+    pthread_mutex_t resume_mutex;
+    connection_t *resume_head;
+    connection_t *local_resume;  // released by this reactor's own handlers
+    connection_t *idle_head;  // least recently active first
+    connection_t *idle_tail;
+    time_t last_sweep;
+} reactor_t;
+
+// How reactors receive connections and where requests are handled
+typedef struct {
+    int reactor_count;                  // 0 = one per online CPU
+    const listen_options_t *reuseport;  // set: each reactor gets its own listener
+    int cpu_steering;                   // reuseport only: pick the listener by CPU
+    int inline_handlers;                // serve on the reactor; no pool handoff
+} event_loop_config_t;
+
+// Function declarations
+int start_event_loops(int listen_fd, const event_loop_config_t *config, void *pool);
+void stop_event_loops(void);
+void wait_event_loops(void);
+void close_event_loops(void);
+void close_connection(connection_t *conn);
+void resume_connection(connection_t *conn);
+
+#endif
@@ -2,8 +2,12 @@
 #define HTTP_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "transport.h"
 
 // HTTP Methods
 #define HTTP_METHOD_GET "GET"
@@ -15,12 +19,25 @@
 #define HTTP_STATUS_200 "HTTP/1.1 200 OK"
 #define HTTP_STATUS_201 "HTTP/1.1 201 Created"
 #define HTTP_STATUS_204 "HTTP/1.1 204 No Content"
+#define HTTP_STATUS_206 "HTTP/1.1 206 Partial Content"
+#define HTTP_STATUS_304 "HTTP/1.1 304 Not Modified"
 #define HTTP_STATUS_403 "HTTP/1.1 403 Forbidden"
 #define HTTP_STATUS_400 "HTTP/1.1 400 Bad Request"
 #define HTTP_STATUS_404 "HTTP/1.1 404 Not Found"
 #define HTTP_STATUS_405 "HTTP/1.1 405 Method Not Allowed"
+#define HTTP_STATUS_409 "HTTP/1.1 409 Conflict"
+#define HTTP_STATUS_413 "HTTP/1.1 413 Content Too Large"
+#define HTTP_STATUS_416 "HTTP/1.1 416 Range Not Satisfiable"
 #define HTTP_STATUS_500 "HTTP/1.1 500 Internal Server Error"
 #define HTTP_STATUS_429 "HTTP/1.1 429 Too Many Requests"
+#define HTTP_STATUS_503 "HTTP/1.1 503 Service Unavailable"
+
+// Persistent connection limits
+#define KEEPALIVE_TIMEOUT_SEC 5
+#define KEEPALIVE_MAX_REQUESTS 100
+
+// Byte ranges accepted in one Range header before it is ignored
+#define MAX_BYTE_RANGES 16
 
 // Content Types
 #define CONTENT_TYPE_HTML "text/html"
@@ -32,22 +49,95 @@
 #define CONTENT_TYPE_JPG "image/jpeg"
 #define CONTENT_TYPE_GIF "image/gif"
 
-// Request structure
+// Header view into the connection's receive buffer
+typedef struct {
+    const char *name;
+    const char *value;
+    size_t name_len;
+    size_t value_len;
+} http_header_t;
+
+// A query parameter as views into the query string, still percent-encoded;
+// decode on demand with query_decode
+typedef struct {
+    const char *name;
+    const char *value;
+    size_t name_len;
+    size_t value_len;
+} query_param_t;
+
+// Request structure. Every string is a NUL-terminated view into memory
+// owned by the connection arena, valid until the next request is read.
 typedef struct {
-    char method[16];
-    char path[256];
-    char query_string[512];
-    char headers[2048];
-    char body[4096];
-    int content_length;
+    const char *method;
+    const char *path;
+    const char *query_string;
+    const char *body;
+    size_t method_len;
+    size_t path_len;
+    size_t query_len;
+    size_t content_length;
+    const http_header_t *header_list;
+    int header_count;
+    int keep_alive;  // HTTP/1.1 default, overridden by the Connection header
+    int version_minor;  // x in HTTP/1.x
 } http_request_t;
 
+// One satisfiable byte range, inclusive on both ends
+typedef struct {
+    off_t first;
+    off_t last;
+} byte_range_t;
+
+// Response builder storage. Small responses live in the inline buffer;
+// larger ones spill into a list of heap chunks, never reallocated, so
+// fragments already queued stay where they are.
+#define RESPONSE_INLINE_SIZE 2048
+#define RESPONSE_CHUNK_SIZE 16384
+// Streamed bodies go out once this much is pending
+#define RESPONSE_STREAM_FLUSH 8192
+// A stream stops producing while more than this waits on a slow reader,
+// and gives up once the reader has taken nothing for RESPONSE_STREAM_STALL_MS
+#define RESPONSE_STREAM_BACKLOG (256 * 1024)
+#define RESPONSE_STREAM_STALL_MS 5000
+
+typedef struct response_chunk {
+    struct response_chunk *next;
+    size_t cap;
+    char data[];
+} response_chunk_t;
+
+// One piece of a response: bytes (copied into the builder or referenced
+// in place) or a range of an open file
+typedef struct response_segment {
+    struct response_segment *next;
+    const char *data;          // NULL for a file range
+    size_t len;
+    int owned;                 // data lives in the builder and may grow
+    int file_fd;
+    off_t offset;
+} response_segment_t;
+
 // Response structure
 typedef struct {
-    char status[64];
-    char headers[2048];
-    char body[8192];
-    int content_length;
+    const char *status;
+    response_segment_t *headers;
+    response_segment_t *headers_last;
+    response_segment_t *body;
+    response_segment_t *body_last;
+    size_t content_length;
+    int send_length;           // emit Content-Length (not for 204/304)
+    int has_file;
+    int failed;                // out of memory while building
+    int chunked;               // streaming with Transfer-Encoding: chunked
+    int stream_fd;
+    void *stream_ssl;
+    int stream_failed;
+    response_chunk_t *chunks;
+    char *arena;               // current bump region
+    size_t arena_used;
+    size_t arena_cap;
+    char inline_buf[RESPONSE_INLINE_SIZE];
 } http_response_t;
 
 // Function declarations
@@ -55,26 +145,54 @@ void send_http_response(int client_fd, const char *status, const char *content_t
 void send_http_response_ssl(void *ssl, const char *status, const char *content_type, const char *body);
 void send_error_response(int client_fd, const char *status, const char *message);
 void send_error_response_ssl(void *ssl, const char *status, const char *message);
+void send_retry_later_response(int client_fd, void *ssl, const char *status,
+                               const char *message, int retry_after);
 const char* get_content_type(const char *filename);
+void set_response_keep_alive(int keep_alive);
+int get_response_keep_alive(void);
+const char* connection_header(void);
 int is_supported_method(const char *method);
+void format_http_date(time_t when, char *out, size_t size);
+void format_etag(const struct stat *st, char *out, size_t size);
+int request_not_modified(const http_request_t *req, const char *etag, time_t mtime);
+int parse_range_header(const char *value, off_t size, byte_range_t *ranges, int max_ranges);
+int request_range_applies(const http_request_t *req, const char *etag, time_t mtime);
 
 // HTTP method handlers
-int handle_get_request(int client_fd, void *ssl, const char *path);
+int handle_get_request(int client_fd, void *ssl, const char *path, const http_request_t *req);
 int handle_post_request(int client_fd, void *ssl, const char *path);
 int handle_put_request(int client_fd, void *ssl, const char *path);
 int handle_delete_request(int client_fd, void *ssl, const char *path);
 
 // New advanced features
-int parse_http_request(const char *buffer, http_request_t *req);
 void send_json_response(int client_fd, void *ssl, const char *status, const char *json_data);
-void send_cors_headers(int client_fd);
-int parse_query_string(const char *query, char **params, int max_params);
+void send_cors_headers(int client_fd, void *ssl);
+int parse_query_string(const char *query, size_t len, query_param_t *params, int max_params);
+int query_decode(const char *src, size_t len, char *out, size_t out_size);
+const query_param_t *find_query_param(const query_param_t *params, int count, const char *name);
+
+// Response builder
+void response_init(http_response_t *resp, const char *status);
+void response_free(http_response_t *resp);
 void add_response_header(http_response_t *resp, const char *name, const char *value);
-void send_full_response(int client_fd, http_response_t *resp);
+void response_add_headers(http_response_t *resp, const char *lines, size_t len);
+void response_append(http_response_t *resp, const void *data, size_t len);
+void response_append_ref(http_response_t *resp, const void *data, size_t len);
+void response_appendf(http_response_t *resp, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void response_append_file(http_response_t *resp, int file_fd, off_t offset, size_t len);
+int send_full_response(int client_fd, void *ssl, http_response_t *resp);
+int response_stream_begin(int client_fd, void *ssl, http_response_t *resp, const http_request_t *req);
+int response_stream_flush(http_response_t *resp, int force);
+int response_stream_end(http_response_t *resp);
+void response_set_backlog(transport_queue_t *backlog);
+void response_stats_reset(void);
+void response_stats_get(int *status, size_t *bytes);
+uint64_t response_stats_write_ns(void);
 
 // API endpoints
 int handle_api_users(int client_fd, void *ssl, const char *method, const char *path, const http_request_t *req);
 int handle_api_health(int client_fd, void *ssl);
-int handle_api_metrics(int client_fd, void *ssl);
+int handle_api_metrics(int client_fd, void *ssl, const http_request_t *req);
+int handle_api_debug_slow(int client_fd, void *ssl, const http_request_t *req);
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,54 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Validating single-pass JSON tokenizer (RFC 8259). The input is checked
+// in full, strings included (escapes, UTF-8), and described by a tape the
+// caller provides, usually on the stack: one token per value and per
+// object key, in document order. Nothing is copied or allocated; string
+// tokens point into the input and are decoded on demand. json_escape
+// goes the other way, for output.
+
+// Containers nested deeper than this are refused
+#define JSON_MAX_DEPTH 32
+// Room json_escape may need for len input bytes (\u00XX for each)
+#define JSON_ESCAPED_MAX(len) ((len) * 6)
+
+typedef enum {
+    JSON_OBJECT,
+    JSON_ARRAY,
+    JSON_STRING,
+    JSON_NUMBER,
+    JSON_TRUE,
+    JSON_FALSE,
+    JSON_NULL
+} json_type_t;
+
+typedef struct {
+    uint32_t offset;     // into the input; strings start after the quote
+    uint32_t len;        // strings: without the quotes
+    uint32_t next;       // tape index of the next sibling (skips contents)
+    uint16_t type;       // json_type_t
+    uint16_t escaped;    // string contains backslash escapes
+} json_token_t;
+
+typedef struct {
+    const char *json;
+    json_token_t *tape;
+    int count;
+    int cap;
+    const char *error;   // why parsing failed
+    size_t error_offset;
+} json_doc_t;
+
+// Function declarations
+int json_parse(json_doc_t *doc, const char *json, size_t len, json_token_t *tape, int tape_cap);
+int json_object_get(const json_doc_t *doc, int object, const char *key);
+int json_get_string(const json_doc_t *doc, int token, char *out, size_t out_size);
+int json_get_int(const json_doc_t *doc, int token, long *out);
+int json_get_bool(const json_doc_t *doc, int token, int *out);
+size_t json_escape(const char *in, size_t len, char *out);
+
+#endif
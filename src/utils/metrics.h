@@ -0,0 +1,57 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "trace.h"
+
+// Latency histograms are log-linear (HDR-style): values below
+// 2^METRICS_SUB_BITS microseconds get a bucket each, and every power of two
+// above that is split into 2^METRICS_SUB_BITS equal buckets (<= 6.25% error)
+#define METRICS_SUB_BITS 4
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BITS)
+#define METRICS_MAX_EXPONENT 27   // 2^28 us (~4.5 minutes) and up share the last bucket
+#define METRICS_BUCKETS ((METRICS_MAX_EXPONENT - METRICS_SUB_BITS + 2) * METRICS_SUB_BUCKETS)
+
+// Routes requests are grouped by
+typedef enum {
+    ROUTE_HEALTH,
+    ROUTE_METRICS,
+    ROUTE_USERS,
+    ROUTE_STATIC,
+    ROUTE_OTHER,
+    ROUTE_COUNT
+} metrics_route_t;
+
+// Status classes: 1xx, 2xx, 3xx, 4xx, 5xx
+#define STATUS_CLASS_COUNT 5
+
+// Merged latency distribution of one route and status class
+typedef struct {
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t buckets[METRICS_BUCKETS];
+} latency_histogram_t;
+
+// Totals over every thread, computed when /metrics is read
+typedef struct {
+    uint64_t requests[ROUTE_COUNT][STATUS_CLASS_COUNT];
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t connections_opened;
+    uint64_t connections_closed;
+} metrics_totals_t;
+
+// Function declarations
+void metrics_record_request(metrics_route_t route, int status, size_t bytes_in,
+                            size_t bytes_out, uint64_t latency_ns);
+void metrics_record_phases(const request_trace_t *trace);
+void metrics_connection_opened(void);
+void metrics_connection_closed(void);
+void metrics_get_totals(metrics_totals_t *totals);
+void metrics_get_histogram(metrics_route_t route, int status_class, latency_histogram_t *hist);
+void metrics_get_phase_histogram(trace_phase_t phase, latency_histogram_t *hist);
+uint64_t metrics_percentile(const latency_histogram_t *hist, double quantile);
+const char *metrics_route_name(metrics_route_t route);
+
+#endif
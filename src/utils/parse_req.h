@@ -1,12 +1,72 @@
 #ifndef REQUEST_H
 #define REQUEST_H
 
+#include <stddef.h>
 #include "http.h"
+#include "arena.h"
 
-// Enhanced request parsing
-int parse_request(const char *buffer, char *method, size_t msize, char *path, size_t psize);
-int parse_full_request(const char *buffer, http_request_t *req);
-int extract_path_and_query(const char *uri, char *path, size_t path_size, char *query, size_t query_size);
-int parse_headers(const char *header_section, char *headers, size_t header_size);
+#define MAX_REQUEST_HEADERS 64
+
+// Result of feeding bytes to the incremental parser
+#define PARSE_INCOMPLETE 0
+#define PARSE_COMPLETE 1
+#define PARSE_FAILED (-1)
+// Content-Length announces a body the receive buffer can never hold
+#define PARSE_TOO_LARGE (-2)
+
+// Parser states; the parser stops mid-state when it runs out of input
+typedef enum {
+    PARSE_METHOD,
+    PARSE_TARGET,
+    PARSE_VERSION,
+    PARSE_REQUEST_LINE_LF,
+    PARSE_HEADER_START,
+    PARSE_HEADER_NAME,
+    PARSE_HEADER_VALUE_START,
+    PARSE_HEADER_VALUE,
+    PARSE_HEADER_LF,
+    PARSE_HEADERS_END_LF,
+    PARSE_BODY,
+    PARSE_DONE
+} parse_state_t;
+
+// Slice of the receive buffer. Offsets rather than pointers, so the buffer
+// may grow (and move) between calls.
+typedef struct {
+    size_t offset;
+    size_t len;
+} span_t;
+
+typedef struct {
+    span_t name;
+    span_t value;
+} header_span_t;
+
+// Resumable request parser state
+typedef struct {
+    parse_state_t state;
+    size_t pos;            // next byte to examine
+    size_t token_start;    // start of the token being scanned
+    span_t method;
+    span_t path;
+    span_t query;
+    span_t version;
+    span_t header_block;   // raw header lines, without the final empty line
+    header_span_t headers[MAX_REQUEST_HEADERS];
+    int header_count;
+    size_t content_length;
+    int has_content_length;
+    span_t body;
+    size_t request_len;    // total bytes once PARSE_COMPLETE
+    int keep_alive;
+} http_parser_t;
+
+// Incremental request parsing
+void http_parser_init(http_parser_t *parser);
+int http_parser_execute(http_parser_t *parser, const char *buffer, size_t len);
+int fill_request(const http_parser_t *parser, char *buffer, size_t buffer_len, arena_t *arena, http_request_t *req);
+
+// Request header lookup
+const char *find_request_header(const http_request_t *req, const char *name);
 
 #endif
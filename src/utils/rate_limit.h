@@ -0,0 +1,46 @@
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+// Ways per shard; a client's buckets live in the shard its key hashes to
+#define RATE_LIMIT_WAYS 8
+// Default cap on tracked buckets (hosts and prefixes together)
+#define RATE_LIMIT_DEFAULT_ENTRIES 65536
+// Bucket sizes are stored in thousandths of a token in 24 bits
+#define RATE_LIMIT_MAX_BURST 16000
+
+// Token bucket settings: requests per second and the burst allowed on top
+typedef struct {
+    unsigned rate;
+    unsigned burst;
+} rate_limit_rule_t;
+
+typedef struct {
+    rate_limit_rule_t host;     // per address; rate 0 disables limiting
+    rate_limit_rule_t prefix;   // per IPv4 /24 or IPv6 /64; rate 0 = off
+    unsigned max_entries;
+} rate_limit_config_t;
+
+// Bucket keys for one client, computed once at accept
+typedef struct {
+    uint64_t host;
+    uint64_t prefix;
+} rate_limit_key_t;
+
+typedef struct {
+    uint64_t limited;           // requests answered with 429
+    uint64_t evicted;           // buckets recycled by the CLOCK hand
+    unsigned entries;           // capacity
+} rate_limit_stats_t;
+
+// Function declarations
+int rate_limit_init(const rate_limit_config_t *config);
+int rate_limit_enabled(void);
+int rate_limit_parse_rule(const char *spec, rate_limit_rule_t *rule);
+void rate_limit_key(const struct sockaddr *addr, rate_limit_key_t *key);
+int rate_limit_allow(const rate_limit_key_t *key, int *retry_after);
+void rate_limit_get_stats(rate_limit_stats_t *stats);
+
+#endif
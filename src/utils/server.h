@@ -1,5 +1,21 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+#include <sys/socket.h>
+
+// Pending connections per listener unless configured otherwise
+#define DEFAULT_LISTEN_BACKLOG SOMAXCONN
+
+// Listening socket configuration
+typedef struct {
+    int port;
+    int backlog;
+    int reuseport;       // SO_REUSEPORT: one listener per reactor on the same port
+    int defer_accept;    // TCP_DEFER_ACCEPT seconds (wake on data, not on SYN); 0 = off
+    int fastopen;        // TCP_FASTOPEN pending-request queue length; 0 = off
+} listen_options_t;
+
 int init_server(int port);
+int create_listener(const listen_options_t *opts);
+int attach_cpu_steering(int listen_fd, int group_size);
 #endif
@@ -0,0 +1,65 @@
+#ifndef STATIC_CACHE_H
+#define STATIC_CACHE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Default byte budget shared by all cached assets
+#define STATIC_CACHE_BUDGET (64 * 1024 * 1024)
+// Files larger than this are served with sendfile() instead of from memory
+#define STATIC_CACHE_MAX_ENTRY (1024 * 1024)
+#define STATIC_CACHE_SHARDS 16
+#define MAX_CACHE_CONTROL_RULES 32
+
+// Outcome of a lookup
+typedef enum {
+    ASSET_CACHED,     // body and headers are in memory
+    ASSET_UNCACHED,   // too large to cache; serve resolved_path from disk
+    ASSET_NOT_FOUND,
+    ASSET_FORBIDDEN,
+    ASSET_ERROR
+} asset_status_t;
+
+typedef enum {
+    ENTRY_LOADING,
+    ENTRY_READY,
+    ENTRY_FAILED
+} entry_state_t;
+
+// A cached static file, shared by all threads while referenced
+typedef struct static_asset {
+    char *key;                 // request path
+    unsigned long hash;
+    char *resolved_path;
+    const char *content_type;
+    const char *cache_control;
+    char etag[64];
+    char *headers;             // pre-rendered Content-Type and validators
+    size_t headers_len;
+    const char *validators;    // tail of headers: ETag, Last-Modified, ...
+    size_t validators_len;
+    char *data;                // file contents (NULL for ASSET_UNCACHED)
+    size_t size;
+    ino_t inode;
+    time_t mtime;
+    entry_state_t state;
+    asset_status_t status;
+    int refcount;
+    int linked;                // still reachable from the hash table
+    struct static_asset *hash_next;
+    struct static_asset *lru_prev;
+    struct static_asset *lru_next;
+} static_asset_t;
+
+// Function declarations
+int static_cache_init(const char *root, size_t budget);
+static_asset_t *static_cache_get(const char *path, asset_status_t *status);
+void static_cache_release(static_asset_t *asset);
+void static_cache_invalidate(const char *resolved_path);
+
+// Cache-Control per file extension; configure before serving requests
+int static_cache_set_cache_control(const char *extension, const char *value);
+int static_cache_parse_cache_control(const char *spec);
+const char *static_cache_control_for(const char *path);
+
+#endif
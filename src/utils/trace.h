@@ -0,0 +1,75 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include "access_log.h"
+
+// Static tracepoints (USDT) for bpftrace/perf, e.g.
+//   bpftrace -e 'usdt:./server:http_server:request_done { @[arg2] = hist(arg3); }'
+// Built in when <sys/sdt.h> is available (USE_USDT); a disabled probe is a
+// single nop in the instruction stream.
+#ifdef USE_USDT
+#include <sys/sdt.h>
+#define TRACE_PROBE1(name, a) DTRACE_PROBE1(http_server, name, a)
+#define TRACE_PROBE2(name, a, b) DTRACE_PROBE2(http_server, name, a, b)
+#define TRACE_PROBE3(name, a, b, c) DTRACE_PROBE3(http_server, name, a, b, c)
+#define TRACE_PROBE4(name, a, b, c, d) DTRACE_PROBE4(http_server, name, a, b, c, d)
+#else
+#define TRACE_PROBE1(name, a) do { (void)(a); } while (0)
+#define TRACE_PROBE2(name, a, b) do { (void)(a); (void)(b); } while (0)
+#define TRACE_PROBE3(name, a, b, c) do { (void)(a); (void)(b); (void)(c); } while (0)
+#define TRACE_PROBE4(name, a, b, c, d) do { (void)(a); (void)(b); (void)(c); (void)(d); } while (0)
+#endif
+
+// Where a request's time went
+typedef enum {
+    PHASE_ACCEPT,     // listener ready -> accepted (first request on a connection)
+    PHASE_HANDSHAKE,  // TLS handshake (first request on a TLS connection)
+    PHASE_READ,       // first bytes -> request fully buffered, parsing excluded
+    PHASE_PARSE,      // parser and request views
+    PHASE_QUEUE,      // waiting for a worker
+    PHASE_HANDLER,    // handler, writes excluded
+    PHASE_WRITE,      // socket writes
+    PHASE_COUNT
+} trace_phase_t;
+
+// Per-request timing, kept with the connection
+typedef struct {
+    uint64_t start_ns;       // accept for the first request, else first bytes
+    uint64_t mark_ns;        // start of the phase in progress
+    uint64_t read_start_ns;  // first bytes of this request, 0 until seen
+    uint64_t phase_ns[PHASE_COUNT];
+} request_trace_t;
+
+// Slowest requests kept for /debug/slow, per window; a read covers the
+// current and the previous window
+#define SLOW_REQUEST_SLOTS 32
+#define SLOW_WINDOW_SEC 60
+#define SLOW_PATH_MAX 64
+
+typedef struct {
+    uint64_t timestamp_ns;   // wall clock, when it finished
+    uint32_t total_us;
+    uint32_t phase_us[PHASE_COUNT];
+    uint16_t status;
+    uint16_t path_len;
+    peer_addr_t peer;
+    char method[8];
+    char path[SLOW_PATH_MAX];
+} slow_request_t;
+
+static inline uint64_t trace_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Function declarations
+const char *trace_phase_name(trace_phase_t phase);
+void trace_slow_request(const request_trace_t *trace, uint64_t total_ns, const peer_addr_t *peer,
+                        const char *method, const char *path, int status);
+int trace_get_slow_requests(slow_request_t *out, int max);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// TLS writes are coalesced into records of up to this size
+#define TLS_RECORD_SIZE 16384
+
+// Part of a response the socket would not take yet: copied bytes, or a
+// range of a file (on a descriptor of its own)
+typedef struct transport_chunk {
+    struct transport_chunk *next;
+    int file_fd;         // -1 for bytes
+    off_t offset;        // next byte to send, in data or in the file
+    size_t len;          // bytes still to send
+    char data[];
+} transport_chunk_t;
+
+// Output waiting for the socket to drain, oldest first. Writers queue
+// behind it once it holds anything, so responses stay in order.
+typedef struct {
+    transport_chunk_t *head;
+    transport_chunk_t *tail;
+} transport_queue_t;
+
+// Function declarations
+int transport_writev(int client_fd, void *ssl, struct iovec *iov, int iovcnt,
+                     transport_queue_t *backlog);
+int transport_send_file(int client_fd, void *ssl, int file_fd, off_t offset, size_t len,
+                        transport_queue_t *backlog);
+int transport_flush(int client_fd, void *ssl, transport_queue_t *backlog);
+void transport_queue_clear(transport_queue_t *backlog);
+size_t transport_queue_bytes(const transport_queue_t *backlog);
+int transport_set_nodelay(int client_fd);
+int transport_cork(int client_fd, void *ssl, int cork);
+
+#endif
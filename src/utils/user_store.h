@@ -0,0 +1,97 @@
+#ifndef USER_STORE_H
+#define USER_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "wal.h"
+
+// Records are allocated this many at a time; freed records are reused
+#define USER_SLAB_RECORDS 1024
+// Initial sizes; both grow by doubling
+#define USER_INDEX_INITIAL 1024
+#define USER_SLOTS_INITIAL 1024
+// The id index is rebuilt once live entries and tombstones fill this share
+#define USER_INDEX_MAX_LOAD_PERCENT 70
+// Deleted slots are squeezed out once they are half of the slot array
+#define USER_COMPACT_MIN_SLOTS 1024
+
+// Returned by create and update when another user has the email
+#define USER_STORE_CONFLICT -2
+// Returned by writes the log refused or could not make durable. The log
+// has failed; the change may already be visible but will not survive a
+// restart.
+#define USER_STORE_IO_ERROR -3
+// Returned by writes that ran out of memory; nothing was changed
+#define USER_STORE_NO_MEMORY -4
+
+// Snapshot once the current WAL segment grows past this
+#define USER_SNAPSHOT_WAL_BYTES (64 * 1024 * 1024)
+// ...or this often while anything is being logged
+#define USER_SNAPSHOT_INTERVAL_SEC 300
+// Users copied out per snapshot write
+#define USER_SNAPSHOT_BATCH 256
+
+// A user as stored and as handed out (always by copy)
+typedef struct {
+    int id;
+    char name[64];
+    char email[128];
+    char created_at[32];
+} user_t;
+
+// Receives a user's id and JSON object, rendered and escaped when the user
+// was last written; the bytes are only valid during the call
+typedef void (*user_json_fn)(int id, const char *json, size_t len, void *ctx);
+
+typedef struct {
+    size_t users;            // live users
+    size_t index_capacity;   // hash index entries
+    size_t index_tombstones;
+    size_t email_index_capacity;
+    size_t email_index_tombstones;
+    size_t email_index_bytes;
+    size_t slot_tombstones;  // deleted, not yet compacted
+    size_t slabs;
+    size_t retired;          // replaced records and arrays waiting for readers
+    size_t memory_bytes;     // indexes, slots, slabs and spilled JSON
+} user_store_stats_t;
+
+// Persistence: changes are logged to <dir>/users.<seq>.wal and compacted
+// into <dir>/users.snap in the background
+typedef struct {
+    const char *dir;              // NULL keeps users in memory only
+    wal_config_t wal;
+    size_t snapshot_bytes;
+    int snapshot_interval_sec;
+} user_store_persist_t;
+
+typedef struct {
+    int enabled;
+    wal_sync_t sync;
+    wal_stats_t wal;
+    uint64_t snapshots;
+    uint64_t snapshot_failures;
+    uint64_t snapshot_users;      // in the last snapshot
+    uint64_t snapshot_ms;         // time the last snapshot took
+    uint64_t recovered_users;
+    uint64_t replayed_records;    // WAL records applied over the snapshot
+    uint64_t recovery_ms;
+} user_store_persist_stats_t;
+
+// Function declarations
+int user_store_init(void);
+int user_store_open(const user_store_persist_t *config);
+void user_store_close(void);
+int user_store_snapshot(void);
+int user_store_create(const char *name, const char *email);
+int user_store_get(int id, user_t *out);
+int user_store_find_email(const char *email, user_t *out);
+int user_store_get_json(int id, user_json_fn emit, void *ctx);
+int user_store_list_json(int after_id, int max, user_json_fn emit, void *ctx);
+int user_store_update(int id, const char *name, const char *email);
+int user_store_delete(int id);
+int user_store_list(int after_id, user_t *out, int max);
+void user_store_get_stats(user_store_stats_t *stats);
+void user_store_get_persist_stats(user_store_persist_stats_t *stats);
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+// Append-only write-ahead log. Records are framed as
+//   uint32 payload length | uint32 CRC32C of the payload | payload
+// and written to numbered segments, <dir>/<name>.<seq>.wal. Appends go to
+// an in-memory batch; one flusher thread writes each batch out and, unless
+// syncing is off, covers it with a single fdatasync.
+
+// A record longer than this is refused, and so is an empty one
+#define WAL_RECORD_MAX 4096
+#define WAL_FRAME_HEADER 8
+// Default flush interval for WAL_SYNC_INTERVAL and WAL_SYNC_NONE
+#define WAL_FLUSH_INTERVAL_MS 10
+#define WAL_PATH_MAX 512
+
+typedef enum {
+    WAL_SYNC_ALWAYS,     // wal_wait returns once the record is on disk
+    WAL_SYNC_INTERVAL,   // written and synced every flush interval
+    WAL_SYNC_NONE        // written every flush interval, never synced
+} wal_sync_t;
+
+typedef struct {
+    wal_sync_t sync;
+    int flush_interval_ms;
+} wal_config_t;
+
+typedef struct {
+    uint64_t appends;
+    uint64_t bytes;
+    uint64_t flushes;        // batches written
+    uint64_t syncs;          // fdatasync calls
+    uint64_t segment;        // sequence number being appended to
+    uint64_t segment_bytes;
+    int failed;              // a write or sync failed; appends are refused
+} wal_stats_t;
+
+typedef struct {
+    char dir[WAL_PATH_MAX];
+    char name[64];
+    wal_config_t config;
+    int fd;
+    uint64_t seq;
+    uint64_t segment_bytes;
+
+    // Appends fill the active batch; a flush swaps it for the spare.
+    // io_mutex serializes flushes (and rotation) so batches land in order;
+    // it is always taken before mutex.
+    pthread_mutex_t mutex;
+    pthread_mutex_t io_mutex;
+    pthread_cond_t flush_cond;
+    pthread_cond_t durable_cond;
+    char *active;
+    size_t active_len;
+    size_t active_cap;
+    char *spare;
+    size_t spare_cap;
+    uint64_t next_lsn;       // assigned to the next append
+    uint64_t durable_lsn;    // every record up to here is written (and synced)
+    int waiters;
+    int failed;
+    int stop;
+    int running;
+    pthread_t flusher;
+    wal_stats_t stats;
+} wal_t;
+
+// Called for each intact record, oldest first; non-zero stops the replay
+typedef int (*wal_apply_fn)(const void *payload, size_t len, void *ctx);
+
+// Function declarations
+uint32_t wal_crc32c(uint32_t crc, const void *data, size_t len);
+int wal_parse_sync(const char *value, wal_sync_t *sync);
+const char *wal_sync_name(wal_sync_t sync);
+long wal_replay(const char *dir, const char *name, uint64_t from_seq, wal_apply_fn apply,
+                void *ctx, uint64_t *last_seq);
+int wal_open(wal_t *wal, const char *dir, const char *name, uint64_t seq,
+             const wal_config_t *config);
+uint64_t wal_append(wal_t *wal, const void *payload, size_t len);
+int wal_wait(wal_t *wal, uint64_t lsn);
+int wal_rotate(wal_t *wal, uint64_t *new_seq);
+void wal_remove_before(wal_t *wal, uint64_t seq);
+void wal_close(wal_t *wal);
+void wal_get_stats(wal_t *wal, wal_stats_t *stats);
+int wal_sync_dir(const char *dir);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Bounded multi-producer, multi-consumer ring over a fixed power-of-two
+// array. Each slot carries a sequence number saying whose turn it is:
+// producers claim the next position at the bottom and consumers the next
+// at the top, each with a CAS, so nobody waits on a lock held by a
+// preempted thread and each deque drains in arrival order.
+typedef struct {
+    _Atomic long seq;
+    _Atomic(void *) item;
+} work_cell_t;
+
+typedef struct {
+    _Atomic long top;
+    char pad_top[64 - sizeof(long)];
+    _Atomic long bottom;
+    char pad_bottom[64 - sizeof(long)];
+    size_t mask;
+    work_cell_t *slots;
+} work_deque_t;
+
+// One deque and one futex word per worker
+typedef struct {
+    work_deque_t deque;
+    _Atomic int sleeping;    // futex word: 1 while parked (or about to park)
+    char pad[64];
+} work_slot_t;
+
+// Items are pushed round-robin onto the deques of the active workers; a
+// worker whose deque is empty steals from the others before parking on its
+// futex. Workers at or above the active count retire once out of work.
+typedef struct {
+    work_slot_t *workers;
+    int worker_count;        // slots allocated (the most workers ever active)
+    _Atomic int active;
+    _Atomic unsigned push_cursor;
+    _Atomic int sleepers;
+    _Atomic int shutdown;
+} work_queue_t;
+
+// Function declarations
+int work_queue_init(work_queue_t *queue, int worker_count, size_t capacity);
+void work_queue_destroy(work_queue_t *queue);
+int work_queue_push(work_queue_t *queue, void *item);
+void *work_queue_pop(work_queue_t *queue, int worker);
+void work_queue_set_active(work_queue_t *queue, int active);
+size_t work_queue_depth(work_queue_t *queue);
+void work_queue_shutdown(work_queue_t *queue);
+
+#endif
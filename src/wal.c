@@ -0,0 +1,515 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "utils/wal.h"
+
+// Batches start this large and grow by doubling
+#define WAL_BATCH_INITIAL 65536
+
+// CRC32C (Castagnoli): SSE4.2 has an instruction for it, else a table
+#define CRC32C_POLY 0x82F63B78u
+
+static uint32_t crc32c_table[256];
+static int crc32c_hw = 0;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLY : 0);
+        }
+        crc32c_table[i] = crc;
+    }
+#if defined(__x86_64__)
+    crc32c_hw = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len) {
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc64 = __builtin_ia32_crc32di(crc64, word);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while (len--) {
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+// Running CRC32C: pass 0 to start, or a previous result to continue
+uint32_t wal_crc32c(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&crc32c_once, crc32c_init);
+    const unsigned char *p = data;
+    crc = ~crc;
+#if defined(__x86_64__)
+    if (crc32c_hw) {
+        return ~crc32c_sse42(crc, p, len);
+    }
+#endif
+    while (len--) {
+        crc = crc32c_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static const char *sync_names[] = {"always", "interval", "none"};
+
+int wal_parse_sync(const char *value, wal_sync_t *sync) {
+    for (int i = 0; i < 3; i++) {
+        if (strcmp(value, sync_names[i]) == 0) {
+            *sync = (wal_sync_t)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *wal_sync_name(wal_sync_t sync) {
+    return sync_names[sync];
+}
+
+static void segment_path(char *buf, size_t size, const char *dir, const char *name, uint64_t seq) {
+    snprintf(buf, size, "%s/%s.%016llx.wal", dir, name, (unsigned long long)seq);
+}
+
+// Make created, renamed and removed entries durable
+int wal_sync_dir(const char *dir) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    int ret = fsync(fd);
+    close(fd);
+    return ret;
+}
+
+static int compare_seq(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Sequence numbers of the log's segments, sorted. Returns how many, or -1.
+static long list_segments(const char *dir, const char *name, uint64_t **out) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        return -1;
+    }
+    size_t name_len = strlen(name);
+    uint64_t *seqs = NULL;
+    size_t count = 0;
+    size_t cap = 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        // <name>.<16 hex digits>.wal
+        const char *file = entry->d_name;
+        if (strncmp(file, name, name_len) != 0 || file[name_len] != '.' ||
+            strlen(file) != name_len + 1 + 16 + 4 || strcmp(file + name_len + 17, ".wal") != 0) {
+            continue;
+        }
+        char *end;
+        uint64_t seq = strtoull(file + name_len + 1, &end, 16);
+        if (end != file + name_len + 17) {
+            continue;
+        }
+        if (count == cap) {
+            cap = cap ? cap * 2 : 16;
+            uint64_t *grown = realloc(seqs, cap * sizeof(uint64_t));
+            if (!grown) {
+                free(seqs);
+                closedir(d);
+                return -1;
+            }
+            seqs = grown;
+        }
+        seqs[count++] = seq;
+    }
+    closedir(d);
+    qsort(seqs, count, sizeof(uint64_t), compare_seq);
+    *out = seqs;
+    return (long)count;
+}
+
+// Apply one segment's records. Returns how many were applied, or -1 if
+// apply failed or the segment is damaged; a damaged tail is cut off and
+// accepted only when truncate_tail is set (the last segment, where a crash
+// can leave a partly written batch).
+static long replay_segment(const char *path, int truncate_tail, wal_apply_fn apply, void *ctx) {
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    if (size == 0) {
+        close(fd);
+        return 0;
+    }
+    const unsigned char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    madvise((void *)data, size, MADV_SEQUENTIAL);
+
+    long applied = 0;
+    size_t offset = 0;
+    while (offset + WAL_FRAME_HEADER <= size) {
+        uint32_t len;
+        uint32_t crc;
+        memcpy(&len, data + offset, 4);
+        memcpy(&crc, data + offset + 4, 4);
+        // Records are never empty, and an empty frame's CRC is 0, so a
+        // zero-filled tail would otherwise read as a run of valid records
+        if (len == 0 || len > WAL_RECORD_MAX || len > size - offset - WAL_FRAME_HEADER ||
+            wal_crc32c(0, data + offset + WAL_FRAME_HEADER, len) != crc) {
+            break;
+        }
+        if (apply(data + offset + WAL_FRAME_HEADER, len, ctx) != 0) {
+            applied = -1;
+            break;
+        }
+        applied++;
+        offset += WAL_FRAME_HEADER + len;
+    }
+    munmap((void *)data, size);
+
+    if (applied >= 0 && offset < size) {
+        if (truncate_tail && ftruncate(fd, (off_t)offset) == 0 && fdatasync(fd) == 0) {
+            fprintf(stderr, "WAL: dropped %zu damaged bytes at the end of %s\n", size - offset, path);
+        } else {
+            fprintf(stderr, "WAL: %s is damaged at offset %zu\n", path, offset);
+            applied = -1;
+        }
+    }
+    close(fd);
+    return applied;
+}
+
+// Feed every intact record in segments from_seq onwards to apply, oldest
+// first. last_seq receives the newest segment present (0 if none), so new
+// appends can start a segment after it. Returns the number of records
+// applied, or -1.
+long wal_replay(const char *dir, const char *name, uint64_t from_seq, wal_apply_fn apply,
+                void *ctx, uint64_t *last_seq) {
+    uint64_t *seqs = NULL;
+    long count = list_segments(dir, name, &seqs);
+    if (count < 0) {
+        return -1;
+    }
+    *last_seq = count > 0 ? seqs[count - 1] : 0;
+
+    long total = 0;
+    char path[WAL_PATH_MAX + 96];
+    for (long i = 0; i < count; i++) {
+        if (seqs[i] < from_seq) {
+            continue;
+        }
+        segment_path(path, sizeof(path), dir, name, seqs[i]);
+        long applied = replay_segment(path, i == count - 1, apply, ctx);
+        if (applied < 0) {
+            total = -1;
+            break;
+        }
+        total += applied;
+    }
+    free(seqs);
+    return total;
+}
+
+// Open segment seq for appending; the caller installs the descriptor
+static int open_segment(wal_t *wal, uint64_t seq, uint64_t *size) {
+    char path[WAL_PATH_MAX + 96];
+    segment_path(path, sizeof(path), wal->dir, wal->name, seq);
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("WAL: open segment");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || wal_sync_dir(wal->dir) != 0) {
+        perror("WAL: open segment");
+        close(fd);
+        return -1;
+    }
+    *size = (uint64_t)st.st_size;
+    return fd;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Write out the active batch and sync it. Caller holds io_mutex, which
+// keeps batches in append order.
+static int flush_batch(wal_t *wal, int force_sync) {
+    pthread_mutex_lock(&wal->mutex);
+    char *batch = wal->active;
+    size_t batch_cap = wal->active_cap;
+    size_t len = wal->active_len;
+    uint64_t upto = wal->next_lsn - 1;
+    wal->active = wal->spare;
+    wal->active_cap = wal->spare_cap;
+    wal->active_len = 0;
+    wal->spare = NULL;
+    wal->spare_cap = 0;
+    int failed = wal->failed;
+    pthread_mutex_unlock(&wal->mutex);
+
+    int ret = failed ? -1 : 0;
+    int synced = 0;
+    if (ret == 0 && len > 0 && write_all(wal->fd, batch, len) != 0) {
+        perror("WAL: write");
+        ret = -1;
+    }
+    if (ret == 0 && (len > 0 || force_sync) && (wal->config.sync != WAL_SYNC_NONE || force_sync)) {
+        if (fdatasync(wal->fd) != 0) {
+            perror("WAL: fdatasync");
+            ret = -1;
+        }
+        synced = 1;
+    }
+
+    pthread_mutex_lock(&wal->mutex);
+    wal->spare = batch;
+    wal->spare_cap = batch_cap;
+    if (ret == 0) {
+        wal->durable_lsn = upto;
+        wal->segment_bytes += len;
+        wal->stats.bytes += len;
+        if (len > 0) wal->stats.flushes++;
+        if (synced) wal->stats.syncs++;
+    } else {
+        wal->failed = 1;
+    }
+    pthread_cond_broadcast(&wal->durable_cond);
+    pthread_mutex_unlock(&wal->mutex);
+    return ret;
+}
+
+static int flush_now(wal_t *wal, int force_sync) {
+    pthread_mutex_lock(&wal->io_mutex);
+    int ret = flush_batch(wal, force_sync);
+    pthread_mutex_unlock(&wal->io_mutex);
+    return ret;
+}
+
+// With WAL_SYNC_ALWAYS a batch goes out as soon as a writer waits on it;
+// writers arriving during the write and sync form the next batch. The
+// other policies flush on a timer.
+static void *wal_flusher(void *arg) {
+    wal_t *wal = (wal_t *)arg;
+    pthread_mutex_lock(&wal->mutex);
+    while (!wal->stop) {
+        if (wal->config.sync == WAL_SYNC_ALWAYS) {
+            if (wal->active_len == 0 || wal->waiters == 0) {
+                pthread_cond_wait(&wal->flush_cond, &wal->mutex);
+                continue;
+            }
+        } else {
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += wal->config.flush_interval_ms / 1000;
+            deadline.tv_nsec += (long)(wal->config.flush_interval_ms % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&wal->flush_cond, &wal->mutex, &deadline);
+            if (wal->active_len == 0) {
+                continue;
+            }
+        }
+        pthread_mutex_unlock(&wal->mutex);
+        flush_now(wal, 0);
+        pthread_mutex_lock(&wal->mutex);
+    }
+    pthread_mutex_unlock(&wal->mutex);
+    return NULL;
+}
+
+// Open segment seq for appending and start the flusher
+int wal_open(wal_t *wal, const char *dir, const char *name, uint64_t seq,
+             const wal_config_t *config) {
+    memset(wal, 0, sizeof(*wal));
+    snprintf(wal->dir, sizeof(wal->dir), "%s", dir);
+    snprintf(wal->name, sizeof(wal->name), "%s", name);
+    wal->config = *config;
+    if (wal->config.flush_interval_ms <= 0) {
+        wal->config.flush_interval_ms = WAL_FLUSH_INTERVAL_MS;
+    }
+    wal->next_lsn = 1;
+    wal->seq = seq;
+    wal->fd = open_segment(wal, seq, &wal->segment_bytes);
+    if (wal->fd < 0) {
+        return -1;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&wal->mutex, NULL);
+    pthread_mutex_init(&wal->io_mutex, NULL);
+    pthread_cond_init(&wal->flush_cond, &attr);
+    pthread_cond_init(&wal->durable_cond, NULL);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&wal->flusher, NULL, wal_flusher, wal) != 0) {
+        close(wal->fd);
+        wal->fd = -1;
+        return -1;
+    }
+    wal->running = 1;
+    return 0;
+}
+
+// Queue a record. Returns its sequence number for wal_wait, or 0 if it
+// was refused (empty, too long, out of memory, or the log has failed).
+uint64_t wal_append(wal_t *wal, const void *payload, size_t len) {
+    if (len == 0 || len > WAL_RECORD_MAX) {
+        return 0;
+    }
+    uint32_t header[2] = {(uint32_t)len, wal_crc32c(0, payload, len)};
+
+    pthread_mutex_lock(&wal->mutex);
+    if (wal->failed || !wal->running) {
+        pthread_mutex_unlock(&wal->mutex);
+        return 0;
+    }
+    size_t need = wal->active_len + WAL_FRAME_HEADER + len;
+    if (need > wal->active_cap) {
+        size_t cap = wal->active_cap ? wal->active_cap : WAL_BATCH_INITIAL;
+        while (cap < need) {
+            cap *= 2;
+        }
+        char *grown = realloc(wal->active, cap);
+        if (!grown) {
+            pthread_mutex_unlock(&wal->mutex);
+            return 0;
+        }
+        wal->active = grown;
+        wal->active_cap = cap;
+    }
+    memcpy(wal->active + wal->active_len, header, WAL_FRAME_HEADER);
+    memcpy(wal->active + wal->active_len + WAL_FRAME_HEADER, payload, len);
+    wal->active_len = need;
+    uint64_t lsn = wal->next_lsn++;
+    wal->stats.appends++;
+    pthread_mutex_unlock(&wal->mutex);
+    return lsn;
+}
+
+// Under WAL_SYNC_ALWAYS, block until the record is on disk; a no-op under
+// the other policies. Returns -1 if the log failed first.
+int wal_wait(wal_t *wal, uint64_t lsn) {
+    if (wal->config.sync != WAL_SYNC_ALWAYS) {
+        return 0;
+    }
+    pthread_mutex_lock(&wal->mutex);
+    if (wal->durable_lsn < lsn && !wal->failed) {
+        wal->waiters++;
+        pthread_cond_signal(&wal->flush_cond);
+        while (wal->durable_lsn < lsn && !wal->failed) {
+            pthread_cond_wait(&wal->durable_cond, &wal->mutex);
+        }
+        wal->waiters--;
+    }
+    int ret = wal->durable_lsn >= lsn ? 0 : -1;
+    pthread_mutex_unlock(&wal->mutex);
+    return ret;
+}
+
+// Finish the current segment (written and synced) and append to the next
+// from here on. Records appended before the call are in older segments;
+// new_seq receives the first segment that may hold later ones.
+int wal_rotate(wal_t *wal, uint64_t *new_seq) {
+    pthread_mutex_lock(&wal->io_mutex);
+    uint64_t size;
+    int fd = -1;
+    if (flush_batch(wal, 1) != 0 || (fd = open_segment(wal, wal->seq + 1, &size)) < 0) {
+        pthread_mutex_unlock(&wal->io_mutex);
+        return -1;
+    }
+    close(wal->fd);
+    pthread_mutex_lock(&wal->mutex);
+    wal->fd = fd;
+    wal->seq++;
+    wal->segment_bytes = size;
+    *new_seq = wal->seq;
+    pthread_mutex_unlock(&wal->mutex);
+    pthread_mutex_unlock(&wal->io_mutex);
+    return 0;
+}
+
+// Delete segments older than seq, once a snapshot covers them
+void wal_remove_before(wal_t *wal, uint64_t seq) {
+    uint64_t *seqs = NULL;
+    long count = list_segments(wal->dir, wal->name, &seqs);
+    char path[WAL_PATH_MAX + 96];
+    for (long i = 0; i < count && seqs[i] < seq; i++) {
+        segment_path(path, sizeof(path), wal->dir, wal->name, seqs[i]);
+        unlink(path);
+    }
+    free(seqs);
+    wal_sync_dir(wal->dir);
+}
+
+// Refuse further appends, stop the flusher, then write and sync whatever
+// is left
+void wal_close(wal_t *wal) {
+    if (!wal->running) {
+        return;
+    }
+    pthread_mutex_lock(&wal->mutex);
+    wal->stop = 1;
+    wal->running = 0;
+    pthread_cond_signal(&wal->flush_cond);
+    pthread_mutex_unlock(&wal->mutex);
+    pthread_join(wal->flusher, NULL);
+
+    flush_now(wal, 1);
+    close(wal->fd);
+    wal->fd = -1;
+    free(wal->active);
+    free(wal->spare);
+    wal->active = wal->spare = NULL;
+    wal->active_cap = wal->spare_cap = wal->active_len = 0;
+}
+
+void wal_get_stats(wal_t *wal, wal_stats_t *stats) {
+    pthread_mutex_lock(&wal->mutex);
+    *stats = wal->stats;
+    stats->segment = wal->seq;
+    stats->segment_bytes = wal->segment_bytes;
+    stats->failed = wal->failed;
+    pthread_mutex_unlock(&wal->mutex);
+}
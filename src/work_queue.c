@@ -0,0 +1,253 @@
+#define _GNU_SOURCE
+#include "utils/work_queue.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+static void futex_wait(_Atomic int *addr, int expected) {
+    syscall(SYS_futex, (int *)addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic int *addr) {
+    syscall(SYS_futex, (int *)addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static int deque_init(work_deque_t *deque, size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+        size *= 2;
+    }
+    deque->slots = calloc(size, sizeof(*deque->slots));
+    if (!deque->slots) {
+        return -1;
+    }
+    deque->mask = size - 1;
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&deque->slots[i].seq, (long)i);
+        atomic_init(&deque->slots[i].item, NULL);
+    }
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+    return 0;
+}
+
+// Append at the bottom; -1 when the ring is full. A slot is free for
+// position b once its sequence reads b; the item is published by moving the
+// sequence to b + 1.
+static int deque_push(work_deque_t *deque, void *item) {
+    long b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    for (;;) {
+        work_cell_t *cell = &deque->slots[b & deque->mask];
+        long seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        if (seq < b) {
+            // Still holds the item from one lap ago
+            return -1;
+        }
+        if (seq > b) {
+            // Another producer claimed b; try the position after it
+            b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&deque->bottom, &b, b + 1,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+            atomic_store_explicit(&cell->item, item, memory_order_relaxed);
+            atomic_store_explicit(&cell->seq, b + 1, memory_order_release);
+            return 0;
+        }
+    }
+}
+
+// Take the oldest item, or NULL when empty. A slot holds the item for
+// position t once its sequence reads t + 1; taking it hands the slot to the
+// producer one lap ahead. An item claimed but not yet published reads as
+// empty, and its producer's wake-up brings a worker back for it.
+static void *deque_take(work_deque_t *deque) {
+    long t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+    for (;;) {
+        work_cell_t *cell = &deque->slots[t & deque->mask];
+        long seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        if (seq < t + 1) {
+            return NULL;
+        }
+        if (seq > t + 1) {
+            t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&deque->top, &t, t + 1,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+            void *item = atomic_load_explicit(&cell->item, memory_order_relaxed);
+            atomic_store_explicit(&cell->seq, t + (long)deque->mask + 1, memory_order_release);
+            return item;
+        }
+    }
+}
+
+int work_queue_init(work_queue_t *queue, int worker_count, size_t capacity) {
+    queue->workers = calloc(worker_count, sizeof(work_slot_t));
+    if (!queue->workers) {
+        return -1;
+    }
+    queue->worker_count = worker_count;
+    for (int i = 0; i < worker_count; i++) {
+        if (deque_init(&queue->workers[i].deque, capacity) != 0) {
+            queue->worker_count = i;
+            work_queue_destroy(queue);
+            return -1;
+        }
+        atomic_init(&queue->workers[i].sleeping, 0);
+    }
+    atomic_init(&queue->active, worker_count);
+    atomic_init(&queue->push_cursor, 0);
+    atomic_init(&queue->sleepers, 0);
+    atomic_init(&queue->shutdown, 0);
+    return 0;
+}
+
+void work_queue_destroy(work_queue_t *queue) {
+    for (int i = 0; i < queue->worker_count; i++) {
+        free(queue->workers[i].deque.slots);
+    }
+    free(queue->workers);
+    queue->workers = NULL;
+    queue->worker_count = 0;
+}
+
+// Unpark a worker; whoever clears the flag accounts for the sleeper
+static int wake_worker(work_queue_t *queue, int worker) {
+    work_slot_t *slot = &queue->workers[worker];
+    int expected = 1;
+    if (!atomic_compare_exchange_strong(&slot->sleeping, &expected, 0)) {
+        return 0;
+    }
+    atomic_fetch_sub(&queue->sleepers, 1);
+    futex_wake(&slot->sleeping);
+    return 1;
+}
+
+// Queue an item on the next worker's deque in turn, trying the others when
+// it is full; -1 when every deque is full or the queue is shutting down
+int work_queue_push(work_queue_t *queue, void *item) {
+    if (atomic_load(&queue->shutdown)) {
+        return -1;
+    }
+
+    int n = atomic_load(&queue->active);
+    if (n <= 0) {
+        return -1;
+    }
+    int start = (int)(atomic_fetch_add_explicit(&queue->push_cursor, 1, memory_order_relaxed) % (unsigned)n);
+    for (int i = 0; i < n; i++) {
+        int worker = (start + i) % n;
+        if (deque_push(&queue->workers[worker].deque, item) != 0) {
+            continue;
+        }
+
+        // Pairs with the fence in work_queue_pop: either the worker sees the
+        // item on its re-check or we see it parked
+        atomic_thread_fence(memory_order_seq_cst);
+        if (wake_worker(queue, worker)) {
+            return 0;
+        }
+        // The owner is awake, so it is busy with an earlier item (even when
+        // its deque looked empty, it is still running what it took last)
+        // or retired after we picked it; let an idle worker steal instead
+        if (atomic_load_explicit(&queue->sleepers, memory_order_relaxed) > 0) {
+            for (int j = 1; j < queue->worker_count; j++) {
+                if (wake_worker(queue, (worker + j) % queue->worker_count)) {
+                    break;
+                }
+            }
+        }
+        return 0;
+    }
+    return -1;
+}
+
+// Own deque first, then every other slot starting from the next worker
+static void *find_work(work_queue_t *queue, int worker) {
+    int n = queue->worker_count;
+    for (int i = 0; i < n; i++) {
+        void *item = deque_take(&queue->workers[(worker + i) % n].deque);
+        if (item) {
+            return item;
+        }
+    }
+    return NULL;
+}
+
+// Shutting down, or this worker's slot is above the active count
+static int should_exit(work_queue_t *queue, int worker) {
+    return atomic_load(&queue->shutdown) || worker >= atomic_load(&queue->active);
+}
+
+// Next item for this worker, parking while there is none; NULL on shutdown
+// or once the worker has been retired and found no more work
+void *work_queue_pop(work_queue_t *queue, int worker) {
+    work_slot_t *slot = &queue->workers[worker];
+
+    for (;;) {
+        void *item = find_work(queue, worker);
+        if (item) {
+            return item;
+        }
+        if (should_exit(queue, worker)) {
+            return NULL;
+        }
+
+        // Announce the park, then look once more so a push that raced with
+        // the scan above is not missed
+        atomic_fetch_add(&queue->sleepers, 1);
+        atomic_store(&slot->sleeping, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+
+        item = find_work(queue, worker);
+        if (item || should_exit(queue, worker)) {
+            if (atomic_exchange(&slot->sleeping, 0) == 1) {
+                atomic_fetch_sub(&queue->sleepers, 1);
+            }
+            return item;
+        }
+
+        futex_wait(&slot->sleeping, 1);
+
+        // Spurious or signal wake-ups leave the flag set
+        if (atomic_exchange(&slot->sleeping, 0) == 1) {
+            atomic_fetch_sub(&queue->sleepers, 1);
+        }
+    }
+}
+
+// Change how many workers receive pushes. Slots at or above the new count
+// are woken so they can drain and retire; a grown slot needs its thread
+// started after this call.
+void work_queue_set_active(work_queue_t *queue, int active) {
+    atomic_store(&queue->active, active);
+    for (int i = active; i < queue->worker_count; i++) {
+        wake_worker(queue, i);
+    }
+}
+
+// Items waiting across every deque (a snapshot; it moves while counted)
+size_t work_queue_depth(work_queue_t *queue) {
+    size_t depth = 0;
+    for (int i = 0; i < queue->worker_count; i++) {
+        work_deque_t *deque = &queue->workers[i].deque;
+        long t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+        long b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+        if (b > t) {
+            depth += (size_t)(b - t);
+        }
+    }
+    return depth;
+}
+
+// Refuse further pushes and release every parked worker
+void work_queue_shutdown(work_queue_t *queue) {
+    atomic_store(&queue->shutdown, 1);
+    for (int i = 0; i < queue->worker_count; i++) {
+        wake_worker(queue, i);
+    }
+}